@@ -17,6 +17,9 @@ pub fn build(b: *std.Build) void {
     } else {
         exe.linkSystemLibrary("gl");
     }
+    if (target.result.os.tag == .windows) {
+        exe.linkSystemLibrary("ws2_32");
+    }
     exe.addIncludePath(.{ .cwd_relative = "stb/" });
     exe.addIncludePath(.{ .cwd_relative = "src/" });
     const sources: []const []const u8 = if (target.result.os.tag == .windows)
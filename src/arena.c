@@ -0,0 +1,110 @@
+#include "common.h"
+#include "math3d.h"
+#include "arena.h"
+#include "mem.h"
+
+arena_t arena_frame;
+arena_t arena_job;
+
+#define ARENA_ROUND(n) (((n) + (ARENA_ALIGN - 1)) & ~(size_t)(ARENA_ALIGN - 1))
+// header padded so block data stays aligned
+#define ARENA_HEADER ARENA_ROUND(sizeof(arena_block))
+
+static inline
+uint8_t* block_data(arena_block* b)
+{
+	return (uint8_t*)b + ARENA_HEADER;
+}
+
+static
+arena_block* new_block(arena_t* arena, size_t size)
+{
+	arena_block* b = mem_alloc(arena->tag, ARENA_HEADER + size);
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	arena->capacity += size;
+	return b;
+}
+
+void arena_init(arena_t* arena, int tag, size_t block_size)
+{
+	memset(arena, 0, sizeof(arena_t));
+	arena->tag = tag;
+	arena->block_size = ARENA_ROUND(block_size);
+	arena->first = arena->current = new_block(arena, arena->block_size);
+}
+
+void arena_destroy(arena_t* arena)
+{
+	arena_block* b = arena->first;
+	while (b != NULL) {
+		arena_block* next = b->next;
+		mem_free(b);
+		b = next;
+	}
+	memset(arena, 0, sizeof(arena_t));
+}
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+	arena_block* b = arena->current;
+	size = ARENA_ROUND(size);
+	if (b->used + size > b->size) {
+		// move on to the next block, reusing it if it is big enough
+		arena_block* next = b->next;
+		if (next == NULL || next->size < size) {
+			arena_block* nb = new_block(arena, ML_MAX(arena->block_size, size));
+			nb->next = next;
+			b->next = nb;
+			next = nb;
+		}
+		next->used = 0;
+		arena->current = b = next;
+	}
+	void* ptr = block_data(b) + b->used;
+	b->used += size;
+	arena->used += size;
+	if (arena->used > arena->peak)
+		arena->peak = arena->used;
+	arena->last = ptr;
+	return ptr;
+}
+
+// resize an allocation. The most recent allocation is extended in
+// place when its block has room, anything else is copied.
+void* arena_grow(arena_t* arena, void* ptr, size_t oldsize, size_t newsize)
+{
+	if (ptr == NULL)
+		return arena_alloc(arena, newsize);
+	oldsize = ARENA_ROUND(oldsize);
+	newsize = ARENA_ROUND(newsize);
+	if (newsize <= oldsize)
+		return ptr;
+	arena_block* b = arena->current;
+	if (ptr == arena->last && (uint8_t*)ptr + newsize <= block_data(b) + b->size) {
+		b->used += newsize - oldsize;
+		arena->used += newsize - oldsize;
+		if (arena->used > arena->peak)
+			arena->peak = arena->used;
+		return ptr;
+	}
+	void* p = arena_alloc(arena, newsize);
+	memcpy(p, ptr, oldsize);
+	return p;
+}
+
+void arena_reset(arena_t* arena)
+{
+	arena->current = arena->first;
+	arena->current->used = 0;
+	arena->used = 0;
+	arena->last = NULL;
+	arena->resets++;
+}
+
+void arena_end_frame(arena_t* arena)
+{
+	arena->last_peak = arena->peak;
+	arena->peak = arena->used;
+}
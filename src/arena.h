@@ -0,0 +1,45 @@
+#pragma once
+#include "common.h"
+
+/*
+  Bump allocator for short-lived scratch memory. Allocations are
+  freed all at once by arena_reset(), which is O(1): the chain of
+  blocks is kept and reused. When the current block is full a new one
+  is chained on, so an arena never runs out.
+
+  arena_frame is reset at the end of every frame, arena_job at the
+  start of every job (currently: meshing one chunk). Since memory
+  from an arena is invalid after a reset, long-lived users compare
+  arena->resets against the value they saw when allocating.
+ */
+
+#define ARENA_ALIGN 16
+
+typedef struct arena_block {
+	struct arena_block* next;
+	size_t size;
+	size_t used;
+} arena_block;
+
+typedef struct arena_t {
+	arena_block* first;
+	arena_block* current;
+	size_t block_size;
+	size_t used; // bytes handed out since the last reset
+	size_t capacity; // bytes held in blocks
+	size_t peak; // highest used this frame
+	size_t last_peak; // peak of the previous frame
+	uint32_t resets;
+	int tag; // mem.h tag for the blocks
+	void* last; // most recent allocation, can grow in place
+} arena_t;
+
+extern arena_t arena_frame;
+extern arena_t arena_job;
+
+void  arena_init(arena_t* arena, int tag, size_t block_size);
+void  arena_destroy(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_grow(arena_t* arena, void* ptr, size_t oldsize, size_t newsize);
+void  arena_reset(arena_t* arena);
+void  arena_end_frame(arena_t* arena); // roll peak into last_peak
@@ -1,3 +1,4 @@
+#include <ctype.h>
 #include "common.h"
 #include "math3d.h"
 #include "images.h"
@@ -201,3 +202,24 @@ void blocks_init()
 		}
 	}
 }
+
+// look up a blocktype by number or name, '_' matches a space in the
+// name ("green_leaves"). Returns -1 if not found.
+int blocks_find(const char* name)
+{
+	char* end;
+	long n = strtol(name, &end, 10);
+	if (*name != '\0' && *end == '\0')
+		return (n >= 0 && n < NUM_BLOCKTYPES) ? (int)n : -1;
+	for (int i = 0; i < NUM_BLOCKTYPES; ++i) {
+		const char* a = blockinfo[i].name;
+		const char* b = name;
+		while (*a && *b && (tolower(*a) == tolower(*b) || (*a == ' ' && *b == '_'))) {
+			++a;
+			++b;
+		}
+		if (*a == '\0' && *b == '\0')
+			return i;
+	}
+	return -1;
+}
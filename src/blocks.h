@@ -83,3 +83,4 @@ extern struct blockinfo blockinfo[];
 
 
 void blocks_init(void);
+int blocks_find(const char* name);
@@ -0,0 +1,373 @@
+#include <time.h>
+#include "common.h"
+#include "math3d.h"
+#include "capture.h"
+#include "script.h"
+#include "mem.h"
+#include "ui.h"
+#include "stb_image_write.h"
+
+#define CAPTURE_PBOS 3 // reads in flight on the GPU
+#define CAPTURE_MAX_IMAGES 8 // frames waiting for or held by the workers
+#define CAPTURE_MAX_WORKERS 4
+
+enum CaptureFormat {
+	CAPTURE_PNG,
+	CAPTURE_PPM
+};
+
+struct capture_target {
+	char filename[CAPTURE_FILENAME];
+	int format;
+	bool report; // tell the console when it's written
+};
+
+// a read in flight
+struct capture_slot {
+	GLsync fence;
+	int w, h;
+	struct capture_target target;
+};
+
+// a frame in system memory, top row first, RGB
+struct capture_image {
+	uint8_t* pixels;
+	size_t size;
+	int w, h;
+	bool ok;
+	struct capture_target target;
+	struct capture_image* next;
+};
+
+static GLuint capture_pbo[CAPTURE_PBOS];
+static size_t capture_pbo_size[CAPTURE_PBOS];
+static struct capture_slot capture_slots[CAPTURE_PBOS];
+static int capture_head; // slot the next read goes to
+static int capture_inflight;
+
+// the lists are shared with the workers, under capture_lock
+static struct capture_image capture_images[CAPTURE_MAX_IMAGES];
+static struct capture_image* capture_free;
+static struct capture_image* capture_todo;
+static struct capture_image* capture_todo_tail;
+static struct capture_image* capture_done;
+static SDL_mutex* capture_lock;
+static SDL_cond* capture_cond;
+static bool capture_quit;
+static SDL_Thread* capture_workers[CAPTURE_MAX_WORKERS];
+static int capture_nworkers;
+
+static char capture_shot[CAPTURE_FILENAME]; // screenshot wanted for the next frame
+static bool capture_recording;
+static int capture_format;
+static char capture_prefix[128];
+static uint64_t capture_frames;
+static uint64_t capture_dropped;
+
+
+static
+bool capture_write(const struct capture_image* img)
+{
+	if (img->target.format == CAPTURE_PNG)
+		return stbi_write_png(img->target.filename, img->w, img->h, 3, img->pixels, img->w * 3) != 0;
+	FILE* fp = fopen(img->target.filename, "wb");
+	if (fp == NULL)
+		return false;
+	size_t bytes = (size_t)img->w * img->h * 3;
+	bool ok = fprintf(fp, "P6\n%d %d\n255\n", img->w, img->h) > 0 &&
+	          fwrite(img->pixels, 1, bytes, fp) == bytes;
+	return (fclose(fp) == 0) && ok;
+}
+
+static
+int capture_worker(void* data)
+{
+	SDL_LockMutex(capture_lock);
+	for (;;) {
+		while (capture_todo == NULL && !capture_quit)
+			SDL_CondWait(capture_cond, capture_lock);
+		struct capture_image* img = capture_todo;
+		if (img == NULL)
+			break; // quitting, and the queue is empty
+		capture_todo = img->next;
+		if (capture_todo == NULL)
+			capture_todo_tail = NULL;
+		SDL_UnlockMutex(capture_lock);
+
+		img->ok = capture_write(img);
+
+		SDL_LockMutex(capture_lock);
+		img->next = capture_done;
+		capture_done = img;
+	}
+	SDL_UnlockMutex(capture_lock);
+	return 0;
+}
+
+// the oldest read is done: copy it out, flipped, and queue it
+static
+void capture_readback(struct capture_slot* slot, GLuint pbo)
+{
+	glDeleteSync(slot->fence);
+	slot->fence = NULL;
+
+	SDL_LockMutex(capture_lock);
+	struct capture_image* img = capture_free;
+	if (img != NULL)
+		capture_free = img->next;
+	SDL_UnlockMutex(capture_lock);
+	if (img == NULL) {
+		capture_dropped++;
+		if (slot->target.report)
+			ui_console_printf("capture: busy, dropped %s", slot->target.filename);
+		return;
+	}
+
+	size_t stride = (size_t)slot->w * 3;
+	size_t size = stride * slot->h;
+	if (img->size < size) {
+		img->pixels = mem_realloc(MEM_MISC, img->pixels, size);
+		img->size = size;
+	}
+	img->w = slot->w;
+	img->h = slot->h;
+	img->target = slot->target;
+
+	M_CHECKGL(glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo));
+	const uint8_t* src = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr)size, GL_MAP_READ_BIT);
+	if (src != NULL) {
+		for (int y = 0; y < slot->h; ++y)
+			memcpy(img->pixels + stride * y, src + stride * (slot->h - 1 - y), stride);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	M_CHECKGL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+	SDL_LockMutex(capture_lock);
+	if (src == NULL) {
+		img->next = capture_free;
+		capture_free = img;
+	} else {
+		img->next = NULL;
+		if (capture_todo_tail != NULL)
+			capture_todo_tail->next = img;
+		else
+			capture_todo = img;
+		capture_todo_tail = img;
+		SDL_CondSignal(capture_cond);
+	}
+	SDL_UnlockMutex(capture_lock);
+}
+
+// reads whose fences have passed, or all of them if wait is set
+static
+void capture_collect(bool wait)
+{
+	while (capture_inflight > 0) {
+		int oldest = (capture_head - capture_inflight + CAPTURE_PBOS) % CAPTURE_PBOS;
+		struct capture_slot* slot = capture_slots + oldest;
+		GLenum r = glClientWaitSync(slot->fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0,
+		                            wait ? 1000000000ull : 0);
+		if (r == GL_TIMEOUT_EXPIRED && !wait)
+			break;
+		capture_readback(slot, capture_pbo[oldest]);
+		capture_inflight--;
+	}
+}
+
+// finished images back to the free list, reporting the screenshots
+static
+void capture_recycle()
+{
+	SDL_LockMutex(capture_lock);
+	struct capture_image* done = capture_done;
+	capture_done = NULL;
+	SDL_UnlockMutex(capture_lock);
+
+	while (done != NULL) {
+		struct capture_image* img = done;
+		done = img->next;
+		if (!img->ok)
+			ui_console_printf("capture: failed to write %s", img->target.filename);
+		else if (img->target.report)
+			ui_console_printf("Saved %s.", img->target.filename);
+		SDL_LockMutex(capture_lock);
+		img->next = capture_free;
+		capture_free = img;
+		SDL_UnlockMutex(capture_lock);
+	}
+}
+
+static
+void capture_read(int w, int h, const struct capture_target* target)
+{
+	if (capture_inflight == CAPTURE_PBOS) {
+		// the GPU is three frames behind, wait for the oldest read
+		int oldest = (capture_head - capture_inflight + CAPTURE_PBOS) % CAPTURE_PBOS;
+		glClientWaitSync(capture_slots[oldest].fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		capture_readback(capture_slots + oldest, capture_pbo[oldest]);
+		capture_inflight--;
+	}
+	int i = capture_head;
+	size_t size = (size_t)w * h * 3;
+	M_CHECKGL(glBindBuffer(GL_PIXEL_PACK_BUFFER, capture_pbo[i]));
+	if (capture_pbo_size[i] < size) {
+		M_CHECKGL(glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)size, NULL, GL_STREAM_READ));
+		// the old storage is released, so track it as one buffer replacing another
+		if (capture_pbo_size[i] != 0)
+			mem_track(MEM_GPU, -(ptrdiff_t)capture_pbo_size[i]);
+		mem_track(MEM_GPU, (ptrdiff_t)size);
+		capture_pbo_size[i] = size;
+	}
+	M_CHECKGL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+	M_CHECKGL(glReadBuffer(GL_BACK));
+	M_CHECKGL(glReadPixels(0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, NULL));
+	M_CHECKGL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+	struct capture_slot* slot = capture_slots + i;
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	slot->w = w;
+	slot->h = h;
+	slot->target = *target;
+	capture_head = (capture_head + 1) % CAPTURE_PBOS;
+	capture_inflight++;
+}
+
+void capture_frame(int w, int h)
+{
+	if (capture_nworkers == 0)
+		return;
+	capture_collect(false);
+	capture_recycle();
+	if (w <= 0 || h <= 0)
+		return;
+
+	struct capture_target target;
+	if (capture_shot[0] != '\0') {
+		snprintf(target.filename, sizeof(target.filename), "%s", capture_shot);
+		target.format = CAPTURE_PNG;
+		target.report = true;
+		capture_shot[0] = '\0';
+		capture_read(w, h, &target);
+	}
+	if (capture_recording) {
+		snprintf(target.filename, sizeof(target.filename), "%s-%06llu.%s",
+		         capture_prefix, (unsigned long long)capture_frames,
+		         capture_format == CAPTURE_PNG ? "png" : "ppm");
+		target.format = capture_format;
+		target.report = false;
+		capture_frames++;
+		capture_read(w, h, &target);
+	}
+}
+
+void capture_screenshot(const char* filename)
+{
+	size_t len = strlen(filename);
+	if (len >= sizeof(capture_shot)) {
+		ui_console_printf("screenshot: file name too long (%zu bytes, max %d)", len, CAPTURE_FILENAME - 1);
+		return;
+	}
+	memcpy(capture_shot, filename, len + 1);
+}
+
+static
+void capture_start(int format)
+{
+	char date[64];
+	time_t t = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%d", localtime(&t));
+	const char* ext = (format == CAPTURE_PNG) ? "png" : "ppm";
+	for (int n = 0; ; ++n) {
+		char first[CAPTURE_FILENAME];
+		snprintf(capture_prefix, sizeof(capture_prefix), "capture-%s-%d", date, n);
+		snprintf(first, sizeof(first), "%s-%06d.%s", capture_prefix, 0, ext);
+		if (!sys_isfile(first))
+			break;
+	}
+	capture_format = format;
+	capture_frames = capture_dropped = 0;
+	capture_recording = true;
+	ui_console_printf("capture: recording to %s-*.%s", capture_prefix, ext);
+}
+
+static
+void capture_stop()
+{
+	if (!capture_recording)
+		return;
+	capture_recording = false;
+	ui_console_printf("capture: %llu frames, %llu dropped",
+	                  (unsigned long long)capture_frames, (unsigned long long)capture_dropped);
+}
+
+static
+void capture_cmd(int argc, char** argv)
+{
+	if (argc > 0 && strcmp(argv[1], "off") == 0) {
+		capture_stop();
+	} else if (argc > 0 && (strcmp(argv[1], "png") == 0 || strcmp(argv[1], "ppm") == 0)) {
+		capture_stop();
+		capture_start(strcmp(argv[1], "png") == 0 ? CAPTURE_PNG : CAPTURE_PPM);
+	} else if (argc > 0) {
+		ui_console_printf("usage: capture [png|ppm|off]");
+	} else if (capture_recording) {
+		ui_console_printf("capture: recording to %s, %llu frames, %llu dropped", capture_prefix,
+		                  (unsigned long long)capture_frames, (unsigned long long)capture_dropped);
+	} else {
+		ui_console_printf("capture: off");
+	}
+}
+
+void capture_init()
+{
+	capture_lock = SDL_CreateMutex();
+	capture_cond = SDL_CreateCond();
+	capture_quit = false;
+	capture_free = capture_todo = capture_todo_tail = capture_done = NULL;
+	for (int i = 0; i < CAPTURE_MAX_IMAGES; ++i) {
+		capture_images[i].next = capture_free;
+		capture_free = capture_images + i;
+	}
+	M_CHECKGL(glGenBuffers(CAPTURE_PBOS, capture_pbo));
+	capture_head = capture_inflight = 0;
+
+	// png encoding is the slow part, leave a core for the game
+	int n = ML_MAX(1, ML_MIN(SDL_GetCPUCount() - 1, CAPTURE_MAX_WORKERS));
+	for (capture_nworkers = 0; capture_nworkers < n; ++capture_nworkers) {
+		SDL_Thread* t = SDL_CreateThread(capture_worker, "capture", NULL);
+		if (t == NULL)
+			break;
+		capture_workers[capture_nworkers] = t;
+	}
+	if (capture_nworkers == 0)
+		printf("capture: no worker threads, screenshots disabled\n");
+	script_defun("capture", capture_cmd);
+}
+
+void capture_exit()
+{
+	capture_stop();
+	if (capture_nworkers > 0)
+		capture_collect(true);
+	SDL_LockMutex(capture_lock);
+	capture_quit = true;
+	SDL_CondBroadcast(capture_cond);
+	SDL_UnlockMutex(capture_lock);
+	for (int i = 0; i < capture_nworkers; ++i)
+		SDL_WaitThread(capture_workers[i], NULL);
+	capture_nworkers = 0;
+	capture_recycle();
+
+	M_CHECKGL(glDeleteBuffers(CAPTURE_PBOS, capture_pbo));
+	for (int i = 0; i < CAPTURE_PBOS; ++i) {
+		mem_track(MEM_GPU, -(ptrdiff_t)capture_pbo_size[i]);
+		capture_pbo_size[i] = 0;
+	}
+	for (int i = 0; i < CAPTURE_MAX_IMAGES; ++i) {
+		mem_free(capture_images[i].pixels);
+		capture_images[i].pixels = NULL;
+		capture_images[i].size = 0;
+	}
+	SDL_DestroyCond(capture_cond);
+	SDL_DestroyMutex(capture_lock);
+}
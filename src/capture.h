@@ -0,0 +1,28 @@
+#pragma once
+#include "common.h"
+
+/*
+  Screenshots and frame capture without stalling the frame.
+
+  capture_frame() starts an asynchronous read of the finished frame
+  into one of a ring of pixel buffer objects and fences it. Later
+  frames map the buffer once the fence has passed, copy the rows out
+  bottom up and hand the image to worker threads, which encode and
+  write it.
+
+  F10 takes a PNG screenshot. "capture [png|ppm|off]" records every
+  frame to numbered files until turned off. png is compressed and
+  slower to encode, ppm is raw RGB. Both read as an image sequence,
+  e.g. ffmpeg -i capture-DATE-N-%06d.ppm. If the workers fall behind,
+  frames are dropped and counted instead of blocking the game.
+ */
+
+#define CAPTURE_FILENAME 256 // bytes, including the terminator
+
+void capture_init(void);
+void capture_exit(void);
+// PNG of the next frame, written in the background. Names of
+// CAPTURE_FILENAME bytes or more are refused.
+void capture_screenshot(const char* filename);
+// main thread, after the frame is drawn and before the swap
+void capture_frame(int w, int h);
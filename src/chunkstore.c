@@ -0,0 +1,179 @@
+#include "common.h"
+#include "chunkstore.h"
+#include "rnd.h"
+#include "mem.h"
+
+#define CHUNKSTORE_BUCKETS 256
+#define SAVE_MAGIC 0x56534d52 // "RMSV"
+#define SAVE_VERSION 1
+
+struct chunkstore_entry {
+	int64_t x;
+	int64_t z;
+	size_t size;
+	uint8_t* data;
+	struct chunkstore_entry* next;
+};
+
+static struct chunkstore_entry* store_buckets[CHUNKSTORE_BUCKETS];
+static size_t store_count;
+static size_t store_bytes;
+
+
+static inline
+struct chunkstore_entry** bucket_for(int64_t x, int64_t z)
+{
+	uint64_t h = rand64(rand64((uint64_t)x) ^ (uint64_t)z);
+	return &store_buckets[(h >> 32) & (CHUNKSTORE_BUCKETS - 1)];
+}
+
+static
+struct chunkstore_entry* unlink_entry(int64_t x, int64_t z)
+{
+	struct chunkstore_entry** pp = bucket_for(x, z);
+	for (; *pp != NULL; pp = &(*pp)->next) {
+		struct chunkstore_entry* e = *pp;
+		if (e->x == x && e->z == z) {
+			*pp = e->next;
+			store_count--;
+			store_bytes -= e->size;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+static
+void put_owned(int64_t x, int64_t z, uint8_t* data, size_t size)
+{
+	struct chunkstore_entry* e = unlink_entry(x, z);
+	if (e != NULL)
+		mem_free(e->data);
+	else
+		e = mem_alloc(MEM_MAP, sizeof(struct chunkstore_entry));
+	struct chunkstore_entry** bucket = bucket_for(x, z);
+	e->x = x;
+	e->z = z;
+	e->size = size;
+	e->data = data;
+	e->next = *bucket;
+	*bucket = e;
+	store_count++;
+	store_bytes += size;
+}
+
+void chunkstore_init()
+{
+	memset(store_buckets, 0, sizeof(store_buckets));
+	store_count = 0;
+	store_bytes = 0;
+}
+
+void chunkstore_exit()
+{
+	chunkstore_clear();
+}
+
+void chunkstore_clear()
+{
+	for (int i = 0; i < CHUNKSTORE_BUCKETS; ++i) {
+		struct chunkstore_entry* e = store_buckets[i];
+		while (e != NULL) {
+			struct chunkstore_entry* next = e->next;
+			mem_free(e->data);
+			mem_free(e);
+			e = next;
+		}
+		store_buckets[i] = NULL;
+	}
+	store_count = 0;
+	store_bytes = 0;
+}
+
+void chunkstore_put(int64_t x, int64_t z, const uint8_t* data, size_t size)
+{
+	uint8_t* copy = mem_alloc(MEM_MAP, size);
+	memcpy(copy, data, size);
+	put_owned(x, z, copy, size);
+}
+
+uint8_t* chunkstore_take(int64_t x, int64_t z, size_t* size)
+{
+	struct chunkstore_entry* e = unlink_entry(x, z);
+	if (e == NULL)
+		return NULL;
+	uint8_t* data = e->data;
+	*size = e->size;
+	mem_free(e);
+	return data;
+}
+
+size_t chunkstore_count()
+{
+	return store_count;
+}
+
+size_t chunkstore_bytes()
+{
+	return store_bytes;
+}
+
+/*
+  save file:
+    u32 magic, u32 version, u64 seed, u32 count
+    count * { i32 x, i32 z, u32 size, size bytes of snapshot }
+  in native byte order.
+ */
+bool chunkstore_write(const char* filename, uint64_t seed)
+{
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return false;
+	uint32_t header[2] = { SAVE_MAGIC, SAVE_VERSION };
+	uint32_t count = (uint32_t)store_count;
+	bool ok = fwrite(header, sizeof(header), 1, f) == 1 &&
+		fwrite(&seed, sizeof(seed), 1, f) == 1 &&
+		fwrite(&count, sizeof(count), 1, f) == 1;
+	for (int i = 0; ok && i < CHUNKSTORE_BUCKETS; ++i) {
+		for (struct chunkstore_entry* e = store_buckets[i]; ok && e != NULL; e = e->next) {
+			int32_t xz[2] = { (int32_t)e->x, (int32_t)e->z }; // see chunk_snapshot()
+			uint32_t size = (uint32_t)e->size;
+			ok = fwrite(xz, sizeof(xz), 1, f) == 1 &&
+				fwrite(&size, sizeof(size), 1, f) == 1 &&
+				fwrite(e->data, e->size, 1, f) == 1;
+		}
+	}
+	fclose(f);
+	return ok;
+}
+
+bool chunkstore_read(const char* filename, uint64_t* seed)
+{
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+	uint32_t header[2];
+	uint32_t count;
+	bool ok = fread(header, sizeof(header), 1, f) == 1 &&
+		header[0] == SAVE_MAGIC && header[1] == SAVE_VERSION &&
+		fread(seed, sizeof(*seed), 1, f) == 1 &&
+		fread(&count, sizeof(count), 1, f) == 1;
+	if (ok)
+		chunkstore_clear();
+	for (uint32_t i = 0; ok && i < count; ++i) {
+		int32_t xz[2];
+		uint32_t size;
+		ok = fread(xz, sizeof(xz), 1, f) == 1 &&
+			fread(&size, sizeof(size), 1, f) == 1;
+		if (!ok)
+			break;
+		uint8_t* data = mem_alloc(MEM_MAP, size);
+		ok = fread(data, size, 1, f) == 1;
+		if (ok)
+			put_owned(xz[0], xz[1], data, size);
+		else
+			mem_free(data);
+	}
+	fclose(f);
+	return ok;
+}
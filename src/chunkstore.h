@@ -0,0 +1,25 @@
+#pragma once
+#include "common.h"
+
+/*
+  Backing store for chunks that have been edited and then evicted
+  from the map ring buffer. Holds chunk snapshots (see
+  chunk_snapshot()) keyed by chunk coordinate, and can write/read
+  them as a save file.
+ */
+
+void chunkstore_init(void);
+void chunkstore_exit(void);
+void chunkstore_clear(void);
+
+// copies data, replaces any existing snapshot for (x, z)
+void chunkstore_put(int64_t x, int64_t z, const uint8_t* data, size_t size);
+
+// removes and returns the snapshot for (x, z), release it with mem_free()
+uint8_t* chunkstore_take(int64_t x, int64_t z, size_t* size);
+
+size_t chunkstore_count(void);
+size_t chunkstore_bytes(void);
+
+bool chunkstore_write(const char* filename, uint64_t seed);
+bool chunkstore_read(const char* filename, uint64_t* seed);
@@ -0,0 +1,196 @@
+#include "common.h"
+#include "math3d.h"
+#include "map.h"
+#include "game.h"
+#include "script.h"
+#include "ui.h"
+#include "chunkviz.h"
+
+#define CHUNKVIZ_CELL 5.f // minimap pixels per chunk
+#define CHUNKVIZ_FLASH_FRAMES 30
+
+enum ChunkvizMode {
+	CHUNKVIZ_OFF,
+	CHUNKVIZ_STATE,
+	CHUNKVIZ_LOAD,
+	CHUNKVIZ_MESH,
+	CHUNKVIZ_VERTS,
+	CHUNKVIZ_SOURCE,
+	NUM_CHUNKVIZ_MODES
+};
+
+static const char* chunkviz_modes[NUM_CHUNKVIZ_MODES] = {
+	"off", "state", "load", "mesh", "verts", "source"
+};
+
+static const char* chunkviz_state_names[NUM_CHUNK_STATES] = {
+	"empty", "queued", "meshed", "dirty"
+};
+
+static const uint32_t chunkviz_state_colors[NUM_CHUNK_STATES] = {
+	0xff7f8c8d, // empty
+	0xfff39c12, // queued
+	0xff27ae60, // meshed
+	0xffe74c3c, // dirty
+};
+
+static const char* chunkviz_source_names[NUM_CHUNK_SOURCES] = {
+	"gen", "cache", "store"
+};
+
+static const uint32_t chunkviz_source_colors[NUM_CHUNK_SOURCES] = {
+	0xffe67e22, // generator
+	0xff3498db, // gencache
+	0xff9b59b6, // store
+};
+
+static int chunkviz_mode = CHUNKVIZ_OFF;
+
+static
+uint32_t clr_lerp(uint32_t a, uint32_t b, float t)
+{
+	uint32_t c = 0;
+	for (int shift = 0; shift < 32; shift += 8) {
+		float ca = (float)((a >> shift) & 0xff);
+		float cb = (float)((b >> shift) & 0xff);
+		c |= (uint32_t)(ca + (cb - ca) * t + 0.5f) << shift;
+	}
+	return c;
+}
+
+static
+float chunkviz_value(const game_chunk* chunk)
+{
+	switch (chunkviz_mode) {
+	case CHUNKVIZ_LOAD: return chunk->load_ms;
+	case CHUNKVIZ_MESH: return chunk->mesh_ms;
+	case CHUNKVIZ_VERTS: return (float)chunk->mesh_verts;
+	default: return 0.f;
+	}
+}
+
+static
+uint32_t chunkviz_color(const game_chunk* chunk, float maxval)
+{
+	uint32_t clr;
+	if (chunkviz_mode == CHUNKVIZ_STATE || chunk->state == CHUNK_EMPTY) {
+		clr = chunkviz_state_colors[chunk->state];
+	} else if (chunkviz_mode == CHUNKVIZ_SOURCE) {
+		clr = chunkviz_source_colors[chunk->source];
+	} else {
+		float t = (maxval > 0.f) ? chunkviz_value(chunk) / maxval : 0.f;
+		clr = (t < 0.5f) ? clr_lerp(0xff2ecc71, 0xfff1c40f, t * 2.f)
+		                 : clr_lerp(0xfff1c40f, 0xffe74c3c, t * 2.f - 1.f);
+	}
+	uint64_t age = game.stats.frames - chunk->state_frame;
+	if (age < CHUNKVIZ_FLASH_FRAMES)
+		clr = clr_lerp(clr, 0xffffffff, 1.f - (float)age / (float)CHUNKVIZ_FLASH_FRAMES);
+	return clr;
+}
+
+// subchunks up to the highest one with any faces
+static
+int chunkviz_height(const game_chunk* chunk)
+{
+	for (int y = MAP_CHUNK_HEIGHT - 1; y > 0; --y)
+		if (chunk->faces[y][MAP_FACE_DIRS] > 0 || (chunk->alpha_mask & (1u << y)))
+			return y + 1;
+	return 1;
+}
+
+static
+void chunkviz_cmd(int argc, char** argv)
+{
+	if (argc == 0) {
+		chunkviz_mode = (chunkviz_mode == CHUNKVIZ_OFF) ? CHUNKVIZ_STATE : CHUNKVIZ_OFF;
+		ui_console_printf("chunkviz: %s", chunkviz_modes[chunkviz_mode]);
+		return;
+	}
+	for (int i = 0; i < NUM_CHUNKVIZ_MODES; ++i) {
+		if (strcmp(argv[1], chunkviz_modes[i]) == 0) {
+			chunkviz_mode = i;
+			return;
+		}
+	}
+	ui_console_printf("usage: chunkviz [state|load|mesh|verts|source|off]");
+}
+
+void chunkviz_init()
+{
+	script_defun("chunkviz", chunkviz_cmd);
+}
+
+void chunkviz_draw(SDL_Point* viewport)
+{
+	if (chunkviz_mode == CHUNKVIZ_OFF)
+		return;
+
+	chunkpos_t center = player_chunk();
+	game_chunk* chunks = game.map.chunks;
+	size_t counts[NUM_CHUNK_STATES] = { 0 };
+	size_t sources[NUM_CHUNK_SOURCES] = { 0 };
+	float maxval = 0.f;
+	game_chunk* worst = NULL;
+	for (int i = 0; i < MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH; ++i) {
+		counts[chunks[i].state]++;
+		if (chunks[i].state != CHUNK_EMPTY)
+			sources[chunks[i].source]++;
+		if (chunks[i].state != CHUNK_EMPTY && chunkviz_value(chunks + i) > maxval) {
+			maxval = chunkviz_value(chunks + i);
+			worst = chunks + i;
+		}
+	}
+
+	const float size = CHUNKVIZ_CELL * (float)MAP_CHUNK_WIDTH;
+	float x0 = (float)viewport->x - size - 8.f;
+	float y0 = 8.f;
+	ui_rect(x0 - 2.f, y0 - 2.f, size + 4.f, size + 4.f, 0x7f2c3e50);
+	for (int dz = -VIEW_DISTANCE; dz < VIEW_DISTANCE; ++dz) {
+		for (int dx = -VIEW_DISTANCE; dx < VIEW_DISTANCE; ++dx) {
+			int bx = chunk_slot(center.x + dx);
+			int bz = chunk_slot(center.z + dz);
+			game_chunk* chunk = chunks + (bz*MAP_CHUNK_WIDTH + bx);
+			uint32_t clr = chunkviz_color(chunk, maxval);
+
+			// north (-z) is up on the map
+			float cx = x0 + (float)(dx + VIEW_DISTANCE) * CHUNKVIZ_CELL;
+			float cy = y0 + (float)(VIEW_DISTANCE - 1 - dz) * CHUNKVIZ_CELL;
+			ui_rect(cx, cy, CHUNKVIZ_CELL - 1.f, CHUNKVIZ_CELL - 1.f, clr);
+			if (dx == 0 && dz == 0) {
+				ui_rect(cx - 1.f, cy - 1.f, CHUNKVIZ_CELL + 1.f, 1.f, 0xffffffff);
+				ui_rect(cx - 1.f, cy + CHUNKVIZ_CELL - 1.f, CHUNKVIZ_CELL + 1.f, 1.f, 0xffffffff);
+				ui_rect(cx - 1.f, cy, 1.f, CHUNKVIZ_CELL - 1.f, 0xffffffff);
+				ui_rect(cx + CHUNKVIZ_CELL - 1.f, cy, 1.f, CHUNKVIZ_CELL - 1.f, 0xffffffff);
+			}
+			if (chunk->state == CHUNK_EMPTY)
+				continue;
+
+			// settled chunks fade into the background in the state view
+			if (chunkviz_mode == CHUNKVIZ_STATE && chunk->state == CHUNK_MESHED &&
+			    game.stats.frames - chunk->state_frame >= CHUNKVIZ_FLASH_FRAMES)
+				clr = (clr & 0x00ffffff) | 0x40000000;
+			float h = (float)(chunkviz_height(chunk) * CHUNK_SIZE) * 0.5f;
+			vec3_t extent = { CHUNK_SIZE*0.5f, h, CHUNK_SIZE*0.5f };
+			ui_debug_aabb(m_vec3add(render_chunk(chunk->x, chunk->z), extent), extent, clr);
+		}
+	}
+
+	float y = y0 + size + 6.f;
+	if (chunkviz_mode == CHUNKVIZ_SOURCE) {
+		for (int s = 0; s < NUM_CHUNK_SOURCES; ++s) {
+			ui_text(x0, y, chunkviz_source_colors[s], "%-7s %zu", chunkviz_source_names[s], sources[s]);
+			y += 16.f;
+		}
+		return;
+	}
+	if (chunkviz_mode != CHUNKVIZ_STATE && worst != NULL) {
+		ui_text(x0, y, 0xffffffff, "max %s %.*f at [%lld, %lld]",
+		        chunkviz_modes[chunkviz_mode], chunkviz_mode == CHUNKVIZ_VERTS ? 0 : 2,
+		        (double)maxval, (long long)worst->x, (long long)worst->z);
+		y += 16.f;
+	}
+	for (int s = NUM_CHUNK_STATES - 1; s >= 0; --s) {
+		ui_text(x0, y, chunkviz_state_colors[s], "%-7s %zu", chunkviz_state_names[s], counts[s]);
+		y += 16.f;
+	}
+}
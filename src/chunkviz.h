@@ -0,0 +1,16 @@
+#pragma once
+#include "common.h"
+
+/*
+  Chunk pipeline overlay. "chunkviz [state|load|mesh|verts|source|off]"
+  draws a minimap of the loaded area in the lower right corner and
+  the bounds of every chunk in the world, colored by the chunk state,
+  by where its blocks came from (generator, gencache or store) or by
+  a heat scale of the last load time, mesh time or vertex count. Chunks that changed state in the last half second flash
+  towards white, so streaming and remeshing hot spots show up as
+  they happen. Without arguments it toggles the state view.
+ */
+
+void chunkviz_init(void);
+// queues the overlay with the other UI and debug geometry
+void chunkviz_draw(SDL_Point* viewport);
@@ -25,8 +25,23 @@
 char*    sys_readfile(const char* filename);
 char*   sys_readfile_realloc(const char* filename, char* buffer, size_t* len);
 int      sys_isfile(const char* filename);
+bool     sys_filestat(const char* filename, uint64_t* size, int64_t* mtime);
+// read-only mapping of a whole file, NULL if missing or empty
+const char* sys_mapfile(const char* filename, size_t* len);
+void     sys_unmapfile(const char* data, size_t len);
 uint64_t sys_urandom(void);
 int64_t sys_timems(void);
+int64_t sys_timens(void); // monotonic
+
+// TCP sockets, blocking with timeouts. Listening sockets are bound to
+// the loopback interface only.
+typedef intptr_t sys_socket_t;
+#define SYS_NO_SOCKET ((sys_socket_t)-1)
+sys_socket_t sys_tcp_listen(int port);
+sys_socket_t sys_tcp_accept(sys_socket_t s, int timeout_ms); // SYS_NO_SOCKET on timeout
+int     sys_tcp_recv(sys_socket_t s, void* buf, size_t len, int timeout_ms); // 0 on close, -1 on error/timeout
+bool    sys_tcp_send(sys_socket_t s, const void* buf, size_t len);
+void    sys_tcp_close(sys_socket_t s);
 
 
 // Common utility functions
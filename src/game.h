@@ -7,12 +7,14 @@
 
 
 #define DAY_LENGTH 1200.0 /* seconds */
+#define RENDER_ORIGIN_DISTANCE 4 /* chunks the camera may stray from the render origin */
 
 
 enum Materials {
 	MAT_BASIC,
 	MAT_UI,
 	MAT_DEBUG,
+	MAT_DEBUG_INSTANCED,
 	MAT_CHUNK,
 	MAT_CHUNK_ALPHA,
 	MAT_SKY,
@@ -67,6 +69,7 @@ struct game {
 	mtxstack_t projection;
 	mtxstack_t modelview;
 	struct game_map map;
+	chunkpos_t origin; // of render space, see render_origin_update()
 
 	int day; // increases after every day/night cycle
 	double time_of_day;
@@ -84,6 +87,7 @@ struct game {
 	bool game_active;
 	bool collisions_on;
 	bool wireframe;
+	bool headless; // no window or GL context, meshes are built but not uploaded
 };
 
 
@@ -95,8 +99,8 @@ static inline
 chunkpos_t camera_chunk()
 {
 	chunkpos_t c = {
-		floor(round(game.camera.pos.x) / CHUNK_SIZE),
-		floor(round(game.camera.pos.z) / CHUNK_SIZE)
+		block_to_chunk(llround(game.camera.pos.x)),
+		block_to_chunk(llround(game.camera.pos.z))
 	};
 	return c;
 }
@@ -116,8 +120,8 @@ static inline
 chunkpos_t player_chunk()
 {
 	chunkpos_t c = {
-		floor(round(game.player.pos.x) / CHUNK_SIZE),
-		floor(round(game.player.pos.z) / CHUNK_SIZE)
+		block_to_chunk(llround(game.player.pos.x)),
+		block_to_chunk(llround(game.player.pos.z))
 	};
 	return c;
 }
@@ -139,11 +143,57 @@ bool block_eq(ivec3_t a, ivec3_t b)
 	return (a.x == b.x && a.y == b.y && a.z == b.z);
 }
 
+/*
+  Render space: everything handed to the GPU (the view matrix, chunk
+  offsets, debug geometry) is relative to game.origin, the corner of
+  a chunk near the camera, so floats stay small no matter how far
+  from spawn the camera is. World positions are doubles and chunk
+  coordinates 64-bit; conversion subtracts the origin before going
+  to float. The origin re-bases once the camera is more than
+  RENDER_ORIGIN_DISTANCE chunks away, not on every chunk crossing.
+ */
+static inline
+bool render_origin_update()
+{
+	chunkpos_t c = camera_chunk();
+	if (llabs(c.x - game.origin.x) <= RENDER_ORIGIN_DISTANCE &&
+	    llabs(c.z - game.origin.z) <= RENDER_ORIGIN_DISTANCE)
+		return false;
+	game.origin = c;
+	return true;
+}
+
+static inline
+vec3_t render_pos(dvec3_t world)
+{
+	return m_vec3(world.x - (double)chunk_to_block(game.origin.x),
+	              world.y,
+	              world.z - (double)chunk_to_block(game.origin.z));
+}
+
+// center of a block
+static inline
+vec3_t render_block(ivec3_t block)
+{
+	return m_vec3((float)((int64_t)block.x - chunk_to_block(game.origin.x)),
+	              (float)block.y,
+	              (float)((int64_t)block.z - chunk_to_block(game.origin.z)));
+}
+
+// where block (0, 0, 0) of a chunk is drawn. Blocks are centered on
+// their integer coordinates, so the chunk mesh starts half a block
+// lower.
+static inline
+vec3_t render_chunk(int64_t x, int64_t z)
+{
+	return m_vec3((float)chunk_to_block(x - game.origin.x) - 0.5f,
+	              -0.5f,
+	              (float)chunk_to_block(z - game.origin.z) - 0.5f);
+}
+
+// the eye in render space
 static inline
 vec3_t camera_offset()
 {
-	chunkpos_t c = player_chunk();
-	return m_vec3(game.camera.pos.x - (double)(c.x * CHUNK_SIZE),
-	              game.camera.pos.y,
-	              game.camera.pos.z - (double)(c.z * CHUNK_SIZE));
+	return render_pos(game.camera.pos);
 }
@@ -5,14 +5,24 @@
 #include "rnd.h"
 #include "noise.h"
 #include "map.h"
+#include "script.h"
+
+// terrain shape for gen_floating, tunable through the gen.* variables
+static struct gen_params {
+	float ground_base;
+	float ground_amplitude;
+	int water_level;
+	float density_scale;
+	float density_threshold;
+} genparams;
 
 static
 void gen_testmap(game_chunk* chunk)
 {
 	int x, z, blockx, blockz, fillx, filly, fillz;
 	uint32_t* blocks;
-	x = chunk->x;
-	z = chunk->z;
+	x = (int)chunk->x;
+	z = (int)chunk->z;
 	blocks = map_blocks;
 
 	if (abs(x) >= 2 || abs(z) >= 2)
@@ -49,8 +59,8 @@ void gen_noisemap(game_chunk* chunk)
 {
 	int x, z, blockx, blockz, fillx, filly, fillz;
 	uint32_t* blocks;
-	x = chunk->x;
-	z = chunk->z;
+	x = (int)chunk->x;
+	z = (int)chunk->z;
 	blocks = map_blocks;
 
 	blockx = x * CHUNK_SIZE;
@@ -133,8 +143,8 @@ void gen_floating(struct game_map* map, game_chunk* chunk) {
 	int x, z, blockx, blockz, fillx, filly, fillz;
 	uint32_t* blocks;
 
-	x = chunk->x;
-	z = chunk->z;
+	x = (int)chunk->x;
+	z = (int)chunk->z;
 	blocks = map_blocks;
 	blockx = x * CHUNK_SIZE;
 	blockz = z * CHUNK_SIZE;
@@ -145,9 +155,9 @@ void gen_floating(struct game_map* map, game_chunk* chunk) {
 			double noise2d = fbm_simplex_2d((double)fillx / MAP_BLOCK_HEIGHT, (double)fillz / MAP_BLOCK_HEIGHT,
 							0.45, 0.8, 2.0, 5);
 			noise2d = (noise2d + 1.0) * 0.5;
-			int groundy = (int)(40.0 * noise2d) + 40;
+			int groundy = (int)(genparams.ground_amplitude * noise2d + genparams.ground_base);
 
-			int watery = 50;
+			int watery = genparams.water_level;
 
 			uint32_t p = BLOCK_AIR;
 			uint32_t sunlight = 0xf;
@@ -161,13 +171,13 @@ void gen_floating(struct game_map* map, game_chunk* chunk) {
 				if (filly > 16.0 && filly < groundy) {
 					double gradient = (double)filly / (double)MAP_BLOCK_HEIGHT;
 					double density = opensimplex_noise_3d(
-						(double)fillx / (double)MAP_BLOCK_HEIGHT * 15.0,
-						(double)filly / (double)MAP_BLOCK_HEIGHT * 15.0,
-						(double)fillz / (double)MAP_BLOCK_HEIGHT * 15.0);
+						(double)fillx / (double)MAP_BLOCK_HEIGHT * genparams.density_scale,
+						(double)filly / (double)MAP_BLOCK_HEIGHT * genparams.density_scale,
+						(double)fillz / (double)MAP_BLOCK_HEIGHT * genparams.density_scale);
 
 					double density01 = (density * 0.5) + 0.5;
 
-					if (density01 + (1.0 - gradient) < 0.8) {
+					if (density01 + (1.0 - gradient) < genparams.density_threshold) {
 					} else if (filly < groundy) {
 						int dirt_depth = 2 + (rand64(fillx ^ filly ^ fillz) % 5);
 						if (sunlight && (fabs(filly - watery - (density * 3.0)) < 1.5)) {
@@ -235,6 +245,24 @@ void process_light_propagation()
 {
 }
 
+void gen_init()
+{
+	script_bind_float("gen.ground_base", &genparams.ground_base, 40.f, NULL, NULL);
+	script_bind_float("gen.ground_amplitude", &genparams.ground_amplitude, 40.f, NULL, NULL);
+	script_bind_int("gen.water_level", &genparams.water_level, 50, NULL, NULL);
+	script_bind_float("gen.density_scale", &genparams.density_scale, 15.f, NULL, NULL);
+	script_bind_float("gen.density_threshold", &genparams.density_threshold, 0.8f, NULL, NULL);
+}
+
+uint32_t gen_params_hash()
+{
+	uint64_t h = 0;
+	const uint32_t* words = (const uint32_t*)&genparams;
+	for (size_t i = 0; i < sizeof(genparams) / sizeof(uint32_t); ++i)
+		h = rand64(h ^ words[i]);
+	return (uint32_t)h;
+}
+
 void gen_loadchunk(struct game_map* map, game_chunk* chunk)
 {
 	//gen_testmap(chunk);
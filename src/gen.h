@@ -1,4 +1,11 @@
 #pragma once
 #include "game.h"
 
+// bump whenever generated terrain changes, invalidates cached chunks
+#define GEN_VERSION 1
+
+// binds the gen.* terrain variables, call before generating
+void gen_init(void);
+// changes whenever a gen.* variable does, mixed into the cache version
+uint32_t gen_params_hash(void);
 void gen_loadchunk(struct game_map* map, game_chunk* chunk);
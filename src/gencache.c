@@ -0,0 +1,202 @@
+#include "common.h"
+#include "math3d.h"
+#include "game.h"
+#include "map.h"
+#include "gen.h"
+#include "gencache.h"
+#include "rle.h"
+#include "mem.h"
+#include "rnd.h"
+#include "ui.h"
+#include "script.h"
+
+#define GENCACHE_BUCKETS 1024
+
+struct gencache_entry {
+	uint64_t seed;
+	int64_t x;
+	int64_t z;
+	uint32_t version;
+	double gen_ms; // what it cost to generate this chunk
+	size_t size;
+	uint8_t* data;
+	struct gencache_entry* hnext; // hash chain
+	struct gencache_entry* prev; // LRU list, head is most recent
+	struct gencache_entry* next;
+};
+
+static struct gencache_entry* buckets[GENCACHE_BUCKETS];
+static struct gencache_entry* lru_head;
+static struct gencache_entry* lru_tail;
+static struct gencache_stats stats;
+
+static uint8_t pack_buffer[CHUNK_SIZE*CHUNK_SIZE*RLE_MAX_BYTES(MAP_BLOCK_HEIGHT)];
+
+
+static inline
+uint32_t gencache_hash(uint64_t seed, int64_t x, int64_t z, uint32_t version)
+{
+	uint64_t key = rand64((uint64_t)x) ^ (uint64_t)z;
+	uint64_t h = rand64(seed ^ key ^ ((uint64_t)version << 16));
+	return (uint32_t)(h >> 32) & (GENCACHE_BUCKETS - 1);
+}
+
+static inline
+double elapsed_ms(Uint64 start)
+{
+	return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static
+void lru_unlink(struct gencache_entry* e)
+{
+	if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+	if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+	e->prev = e->next = NULL;
+}
+
+static
+void lru_push_front(struct gencache_entry* e)
+{
+	e->prev = NULL;
+	e->next = lru_head;
+	if (lru_head) lru_head->prev = e;
+	lru_head = e;
+	if (lru_tail == NULL) lru_tail = e;
+}
+
+static
+void entry_free(struct gencache_entry* e)
+{
+	struct gencache_entry** pp = &buckets[gencache_hash(e->seed, e->x, e->z, e->version)];
+	while (*pp != e)
+		pp = &(*pp)->hnext;
+	*pp = e->hnext;
+	lru_unlink(e);
+	stats.bytes -= e->size;
+	stats.entries--;
+	mem_free(e->data);
+	mem_free(e);
+}
+
+static
+void evict_to(size_t capacity)
+{
+	while (lru_tail != NULL && stats.bytes > capacity) {
+		entry_free(lru_tail);
+		stats.evictions++;
+	}
+}
+
+static
+struct gencache_entry* lookup(uint64_t seed, int64_t x, int64_t z, uint32_t version)
+{
+	struct gencache_entry* e = buckets[gencache_hash(seed, x, z, version)];
+	for (; e != NULL; e = e->hnext)
+		if (e->x == x && e->z == z && e->seed == seed && e->version == version)
+			return e;
+	return NULL;
+}
+
+static
+void insert(uint64_t seed, game_chunk* chunk, uint32_t version, double gen_ms)
+{
+	size_t size = 0;
+	for (int z = 0; z < CHUNK_SIZE; ++z)
+		for (int x = 0; x < CHUNK_SIZE; ++x)
+			size += rle_encode(block_column((int)chunk_to_block(chunk->x) + x, (int)chunk_to_block(chunk->z) + z),
+			                   MAP_BLOCK_HEIGHT, pack_buffer + size);
+	if (size > stats.capacity)
+		return;
+	evict_to(stats.capacity - size);
+
+	struct gencache_entry* e = mem_alloc(MEM_CACHE, sizeof(struct gencache_entry));
+	e->seed = seed;
+	e->x = chunk->x;
+	e->z = chunk->z;
+	e->version = version;
+	e->gen_ms = gen_ms;
+	e->size = size;
+	e->data = mem_alloc(MEM_CACHE, size);
+	memcpy(e->data, pack_buffer, size);
+	uint32_t h = gencache_hash(seed, chunk->x, chunk->z, version);
+	e->hnext = buckets[h];
+	buckets[h] = e;
+	lru_push_front(e);
+	stats.bytes += size;
+	stats.entries++;
+}
+
+static
+void gencache_cmd(int argc, char** argv)
+{
+	if (argc > 0 && strcmp(argv[1], "clear") == 0)
+		gencache_clear();
+	else if (argc > 0)
+		gencache_set_capacity((size_t)(atof(argv[1]) * 1024.0 * 1024.0));
+	uint64_t lookups = stats.hits + stats.misses;
+	ui_console_printf("gencache: %zu chunks, %zu/%zu kB, %.1f%% hits, %llu evictions, %.0f ms saved",
+	                  stats.entries, stats.bytes / 1024, stats.capacity / 1024,
+	                  lookups ? (double)stats.hits * 100.0 / (double)lookups : 0.0,
+	                  (unsigned long long)stats.evictions, stats.saved_ms);
+}
+
+void gencache_init(size_t capacity)
+{
+	memset(buckets, 0, sizeof(buckets));
+	memset(&stats, 0, sizeof(stats));
+	lru_head = lru_tail = NULL;
+	stats.capacity = capacity;
+	script_defun("gencache", gencache_cmd);
+}
+
+void gencache_exit()
+{
+	gencache_clear();
+}
+
+void gencache_clear()
+{
+	while (lru_tail != NULL)
+		entry_free(lru_tail);
+}
+
+void gencache_set_capacity(size_t capacity)
+{
+	stats.capacity = capacity;
+	evict_to(capacity);
+}
+
+bool gencache_load(struct game_map* map, game_chunk* chunk)
+{
+	uint64_t seed = map->seed;
+	uint32_t version = GEN_VERSION ^ gen_params_hash();
+	Uint64 start = SDL_GetPerformanceCounter();
+	struct gencache_entry* e = (stats.capacity > 0) ? lookup(seed, chunk->x, chunk->z, version) : NULL;
+	if (e != NULL) {
+		size_t offset = 0;
+		for (int z = 0; z < CHUNK_SIZE; ++z)
+			for (int x = 0; x < CHUNK_SIZE; ++x)
+				offset += rle_decode(e->data + offset, e->size - offset,
+				                     block_column((int)chunk_to_block(chunk->x) + x, (int)chunk_to_block(chunk->z) + z),
+				                     MAP_BLOCK_HEIGHT);
+		lru_unlink(e);
+		lru_push_front(e);
+		stats.hits++;
+		stats.saved_ms += ML_MAX(0.0, e->gen_ms - elapsed_ms(start));
+		return true;
+	}
+
+	gen_loadchunk(map, chunk);
+	double gen_ms = elapsed_ms(start);
+	stats.misses++;
+	stats.gen_ms += gen_ms;
+	if (stats.capacity > 0)
+		insert(seed, chunk, version, gen_ms);
+	return false;
+}
+
+const struct gencache_stats* gencache_stats()
+{
+	return &stats;
+}
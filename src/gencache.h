@@ -0,0 +1,27 @@
+#pragma once
+#include "map.h"
+
+/*
+  Bounded LRU cache of generated chunks, sitting between
+  chunk_load() and gen_loadchunk(). Entries are keyed by
+  (seed, x, z, generator version) and stored compressed.
+ */
+
+struct gencache_stats {
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+	double gen_ms; // time spent generating on misses
+	double saved_ms; // generation time avoided by hits
+	size_t entries;
+	size_t bytes; // compressed size of all entries
+	size_t capacity; // memory cap in bytes, 0 disables the cache
+};
+
+void gencache_init(size_t capacity);
+void gencache_exit(void);
+void gencache_clear(void);
+void gencache_set_capacity(size_t capacity);
+// true if the chunk came from the cache rather than the generator
+bool gencache_load(struct game_map* map, game_chunk* chunk);
+const struct gencache_stats* gencache_stats(void);
@@ -0,0 +1,432 @@
+#include <ctype.h>
+#include "common.h"
+#include "math3d.h"
+#include "game.h"
+#include "http.h"
+#include "script.h"
+#include "prof.h"
+#include "mem.h"
+#include "arena.h"
+#include "gencache.h"
+#include "ui.h"
+
+#define HTTP_MAX_REQUEST 16384
+#define HTTP_IO_TIMEOUT 1000 // ms, per recv
+#define HTTP_POLL_INTERVAL 100 // ms, how often the thread checks for shutdown
+
+struct http_request {
+	char method[8];
+	char path[256];
+	const char* body;
+	size_t body_len;
+	// filled in by the main thread
+	int status;
+	char* response;
+	size_t response_len;
+	bool done;
+};
+
+// growable response buffer
+struct http_buf {
+	char* data;
+	size_t len;
+	size_t cap;
+};
+
+static SDL_Thread* http_thread;
+static SDL_atomic_t http_running;
+static sys_socket_t http_socket = SYS_NO_SOCKET;
+static int http_port;
+static int http_port_var; // http.port script variable
+static bool http_port_dirty;
+static SDL_mutex* http_lock;
+static SDL_cond* http_cond;
+static struct http_request* http_pending; // waiting for the main thread
+static char http_inbuf[HTTP_MAX_REQUEST + 1]; // server thread only
+
+
+static
+void buf_printf(struct http_buf* b, const char* fmt, ...)
+{
+	va_list va_args;
+	for (;;) {
+		size_t room = b->cap - b->len;
+		va_start(va_args, fmt);
+		int n = vsnprintf(b->data + b->len, room, fmt, va_args);
+		va_end(va_args);
+		if (n < 0)
+			return;
+		if ((size_t)n < room) {
+			b->len += (size_t)n;
+			return;
+		}
+		b->cap = ML_MAX(b->cap * 2, b->len + (size_t)n + 1);
+		b->data = mem_realloc(MEM_MISC, b->data, b->cap);
+	}
+}
+
+static
+void buf_string(struct http_buf* b, const char* str)
+{
+	buf_printf(b, "\"");
+	for (const char* p = str; *p; ++p) {
+		unsigned char c = (unsigned char)*p;
+		if (c == '"' || c == '\\')
+			buf_printf(b, "\\%c", c);
+		else if (c < 0x20)
+			buf_printf(b, "\\u%04x", c);
+		else
+			buf_printf(b, "%c", c);
+	}
+	buf_printf(b, "\"");
+}
+
+// numbers go out as JSON numbers, anything else as a string
+static
+void buf_value(struct http_buf* b, const char* value)
+{
+	char* end;
+	double d = strtod(value, &end);
+	if (end != value && *end == '\0' && isfinite(d))
+		buf_printf(b, "%.9g", d);
+	else
+		buf_string(b, value);
+}
+
+static
+void vars_cb(const char* name, const char* value, void* data)
+{
+	struct http_buf* b = data;
+	if (b->data[b->len - 1] != '{')
+		buf_printf(b, ",");
+	buf_printf(b, "\n  ");
+	buf_string(b, name);
+	buf_printf(b, ": ");
+	buf_value(b, value);
+}
+
+static
+bool valid_var_name(const char* name)
+{
+	if (*name == '\0')
+		return false;
+	for (; *name; ++name)
+		if (!isalnum((unsigned char)*name) && *name != '.' && *name != '_' && *name != '-')
+			return false;
+	return true;
+}
+
+static
+void stats_json(struct http_buf* b)
+{
+	const struct map_stats* ms = map_stats();
+	const struct gencache_stats* gc = gencache_stats();
+
+	buf_printf(b, "{\n  \"frame\": {\"frames\": %llu, \"frametime_ms\": %lld, \"cpu_ms\": {",
+	           (unsigned long long)game.stats.frames, (long long)game.stats.frametime);
+	for (int i = 0; i < NUM_PROF_TIMERS; ++i)
+		buf_printf(b, "%s\"%s\": %.3f", i ? ", " : "", prof_name(i), prof_ms(i));
+	buf_printf(b, "}, \"gpu_ms\": {");
+	for (int i = 0; i < NUM_PROF_GPU_PASSES; ++i)
+		buf_printf(b, "%s\"%s\": %.3f", i ? ", " : "", prof_gpu_name(i), ML_MAX(prof_gpu_ms(i), 0.0));
+	buf_printf(b, "}},\n");
+
+	buf_printf(b, "  \"map\": {\"dirty_chunks\": %zu, \"chunks_loaded\": %llu, \"chunks_meshed\": %llu, "
+	           "\"subchunks_meshed\": %llu, \"verts\": %llu, \"verts_drawn\": %llu, \"verts_culled\": %llu},\n",
+	           map_dirty_chunks(),
+	           (unsigned long long)ms->chunks_loaded, (unsigned long long)ms->chunks_meshed,
+	           (unsigned long long)ms->subchunks_meshed, (unsigned long long)ms->verts,
+	           (unsigned long long)ms->verts_drawn, (unsigned long long)ms->verts_culled);
+	buf_printf(b, "  \"gencache\": {\"hits\": %llu, \"misses\": %llu, \"entries\": %zu, \"bytes\": %zu},\n",
+	           (unsigned long long)gc->hits, (unsigned long long)gc->misses, gc->entries, gc->bytes);
+	buf_printf(b, "  \"arena_peak\": {\"frame\": %zu, \"job\": %zu},\n",
+	           arena_frame.last_peak, arena_job.last_peak);
+
+	buf_printf(b, "  \"memory\": {");
+	for (int i = 0; i < NUM_MEM_TAGS; ++i) {
+		const struct mem_stats* m = mem_stats(i);
+		buf_printf(b, "%s\n    \"%s\": {\"current\": %zu, \"peak\": %zu, \"count\": %zu}",
+		           i ? "," : "", mem_tag_name(i), m->current, m->peak, m->count);
+	}
+	buf_printf(b, "\n  },\n");
+	buf_printf(b, "  \"player\": {\"x\": %.3f, \"y\": %.3f, \"z\": %.3f}\n}\n",
+	           game.player.pos.x, game.player.pos.y, game.player.pos.z);
+}
+
+// main thread
+static
+void http_handle(struct http_request* req)
+{
+	struct http_buf b = { mem_alloc(MEM_MISC, 1024), 0, 1024 };
+	b.data[0] = '\0';
+	bool get = strcmp(req->method, "GET") == 0;
+	bool put = strcmp(req->method, "PUT") == 0;
+	const char* name = (strncmp(req->path, "/vars/", 6) == 0) ? req->path + 6 : NULL;
+
+	req->status = 200;
+	if (get && strcmp(req->path, "/stats") == 0) {
+		stats_json(&b);
+	} else if (get && strcmp(req->path, "/vars") == 0) {
+		buf_printf(&b, "{");
+		script_foreach(vars_cb, &b);
+		buf_printf(&b, "\n}\n");
+	} else if (name != NULL && !valid_var_name(name)) {
+		req->status = 400;
+		buf_printf(&b, "{\"error\": \"bad variable name\"}\n");
+	} else if (name != NULL && get) {
+		const char* value = script_get_string(name);
+		if (value == NULL) {
+			req->status = 404;
+			buf_printf(&b, "{\"error\": \"no such variable\"}\n");
+		} else {
+			buf_printf(&b, "{");
+			vars_cb(name, value, &b);
+			buf_printf(&b, "\n}\n");
+		}
+	} else if (name != NULL && put) {
+		// the body is the value, optionally as a JSON string
+		char value[256];
+		const char* p = req->body;
+		const char* end = req->body + req->body_len;
+		while (p < end && isspace((unsigned char)*p)) ++p;
+		while (end > p && isspace((unsigned char)end[-1])) --end;
+		if (end - p >= 2 && *p == '"' && end[-1] == '"') {
+			++p;
+			--end;
+		}
+		if (p == end || (size_t)(end - p) >= sizeof(value)) {
+			req->status = 400;
+			buf_printf(&b, "{\"error\": \"bad value\"}\n");
+		} else {
+			memcpy(value, p, (size_t)(end - p));
+			value[end - p] = '\0';
+			script_set(name, value);
+			buf_printf(&b, "{");
+			vars_cb(name, value, &b);
+			buf_printf(&b, "\n}\n");
+		}
+	} else if (get || put) {
+		req->status = 404;
+		buf_printf(&b, "{\"error\": \"not found\"}\n");
+	} else {
+		req->status = 405;
+		buf_printf(&b, "{\"error\": \"method not allowed\"}\n");
+	}
+	req->response = b.data;
+	req->response_len = b.len;
+}
+
+static void http_cmd_start(int port);
+
+void http_tick()
+{
+	if (http_lock == NULL)
+		return;
+	SDL_LockMutex(http_lock);
+	if (http_pending != NULL) {
+		http_handle(http_pending);
+		http_pending->done = true;
+		http_pending = NULL;
+		SDL_CondSignal(http_cond);
+	}
+	SDL_UnlockMutex(http_lock);
+
+	if (http_port_dirty) {
+		http_port_dirty = false;
+		if (http_port_var <= 0)
+			http_stop();
+		else if (http_port_var != http_port || http_thread == NULL)
+			http_cmd_start(http_port_var);
+	}
+}
+
+static
+const char* status_text(int status)
+{
+	switch (status) {
+	case 200: return "OK";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 413: return "Payload Too Large";
+	default: return "Service Unavailable";
+	}
+}
+
+static
+void http_reply(sys_socket_t c, int status, const char* body, size_t len)
+{
+	char header[256];
+	int n = snprintf(header, sizeof(header),
+	                 "HTTP/1.0 %d %s\r\n"
+	                 "Content-Type: application/json\r\n"
+	                 "Content-Length: %zu\r\n"
+	                 "Connection: close\r\n\r\n",
+	                 status, status_text(status), len);
+	if (sys_tcp_send(c, header, (size_t)n) && len > 0)
+		sys_tcp_send(c, body, len);
+}
+
+// returns the value of a header (case insensitive name including
+// the colon), or NULL
+static
+const char* find_header(const char* buf, const char* end, const char* name)
+{
+	size_t n = strlen(name);
+	for (const char* line = strstr(buf, "\r\n"); line != NULL && line < end; line = strstr(line + 2, "\r\n")) {
+		const char* p = line + 2;
+		size_t i = 0;
+		while (i < n && p[i] && tolower((unsigned char)p[i]) == name[i])
+			++i;
+		if (i == n)
+			return p + n;
+	}
+	return NULL;
+}
+
+// server thread: read one request, wait for the main thread to
+// answer it
+static
+void http_serve(sys_socket_t c)
+{
+	char* buf = http_inbuf;
+	size_t len = 0;
+	char* body = NULL;
+	size_t content_length = 0;
+	for (;;) {
+		if (len >= HTTP_MAX_REQUEST) {
+			static const char msg[] = "{\"error\": \"request too large\"}\n";
+			http_reply(c, 413, msg, sizeof(msg) - 1);
+			return;
+		}
+		int n = sys_tcp_recv(c, buf + len, HTTP_MAX_REQUEST - len, HTTP_IO_TIMEOUT);
+		if (n <= 0)
+			return;
+		len += (size_t)n;
+		buf[len] = '\0';
+		if (body == NULL && (body = strstr(buf, "\r\n\r\n")) != NULL) {
+			body += 4;
+			const char* cl = find_header(buf, body, "content-length:");
+			if (cl != NULL)
+				content_length = strtoul(cl, NULL, 10);
+		}
+		if (body != NULL && (size_t)(buf + len - body) >= content_length)
+			break;
+	}
+
+	struct http_request req;
+	memset(&req, 0, sizeof(req));
+	if (sscanf(buf, "%7s %255s", req.method, req.path) != 2) {
+		http_reply(c, 400, NULL, 0);
+		return;
+	}
+	req.body = body;
+	req.body_len = content_length;
+
+	SDL_LockMutex(http_lock);
+	http_pending = &req;
+	while (!req.done && SDL_AtomicGet(&http_running))
+		SDL_CondWaitTimeout(http_cond, http_lock, HTTP_POLL_INTERVAL);
+	if (!req.done)
+		http_pending = NULL;
+	SDL_UnlockMutex(http_lock);
+
+	if (req.done)
+		http_reply(c, req.status, req.response, req.response_len);
+	else
+		http_reply(c, 503, NULL, 0);
+	mem_free(req.response);
+}
+
+static
+int http_main(void* data)
+{
+	while (SDL_AtomicGet(&http_running)) {
+		sys_socket_t c = sys_tcp_accept(http_socket, HTTP_POLL_INTERVAL);
+		if (c == SYS_NO_SOCKET)
+			continue;
+		http_serve(c);
+		sys_tcp_close(c);
+	}
+	return 0;
+}
+
+bool http_start(int port)
+{
+	http_stop();
+	http_socket = sys_tcp_listen(port);
+	if (http_socket == SYS_NO_SOCKET)
+		return false;
+	http_port = port;
+	SDL_AtomicSet(&http_running, 1);
+	http_thread = SDL_CreateThread(http_main, "http", NULL);
+	if (http_thread == NULL) {
+		SDL_AtomicSet(&http_running, 0);
+		sys_tcp_close(http_socket);
+		http_socket = SYS_NO_SOCKET;
+		return false;
+	}
+	return true;
+}
+
+void http_stop()
+{
+	if (http_thread == NULL)
+		return;
+	SDL_AtomicSet(&http_running, 0);
+	SDL_WaitThread(http_thread, NULL);
+	http_thread = NULL;
+	sys_tcp_close(http_socket);
+	http_socket = SYS_NO_SOCKET;
+}
+
+static
+void http_cmd_start(int port)
+{
+	if (port <= 0 || port > 65535 || !http_start(port))
+		ui_console_printf("http: can't listen on port %d", port);
+	else
+		ui_console_printf("http: listening on http://127.0.0.1:%d/", http_port);
+}
+
+static
+void http_cmd(int argc, char** argv)
+{
+	if (argc > 0 && strcmp(argv[1], "off") == 0) {
+		http_stop();
+	} else if (argc > 0) {
+		http_cmd_start(atoi(argv[1]));
+		return;
+	}
+	if (http_thread != NULL)
+		ui_console_printf("http: listening on http://127.0.0.1:%d/", http_port);
+	else
+		ui_console_printf("http: off");
+}
+
+// applied in http_tick: the change may come in through a request,
+// and the server can't be restarted while it waits for the answer
+static
+void http_port_changed(const char* name, void* data)
+{
+	http_port_dirty = true;
+}
+
+void http_init()
+{
+	http_lock = SDL_CreateMutex();
+	http_cond = SDL_CreateCond();
+	script_defun("http", http_cmd);
+	script_bind_int("http.port", &http_port_var, 0, http_port_changed, NULL);
+	if (http_port_var > 0)
+		http_cmd_start(http_port_var);
+}
+
+void http_exit()
+{
+	http_stop();
+	SDL_DestroyCond(http_cond);
+	SDL_DestroyMutex(http_lock);
+	http_cond = NULL;
+	http_lock = NULL;
+}
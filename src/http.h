@@ -0,0 +1,26 @@
+#pragma once
+#include "common.h"
+
+/*
+  Tweak and telemetry server: a minimal HTTP/1.0 server on a
+  background thread, bound to localhost.
+
+    GET /vars          all script variables as a JSON object
+    GET /vars/NAME     one variable
+    PUT /vars/NAME     set a variable, the request body is the value
+    GET /stats         frame timings, chunk and memory stats
+
+  The server thread only does socket I/O. Each request is handed to
+  the main thread and answered in http_tick(), so variables change
+  and stats are read at a safe point in the tick. One connection is
+  served at a time.
+
+  Started with the "http [port|off]" console command, or through the
+  http.port variable (0 = off).
+ */
+
+void http_init(void);
+void http_exit(void);
+bool http_start(int port);
+void http_stop(void);
+void http_tick(void); // main thread, once per game tick
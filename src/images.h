@@ -3,8 +3,6 @@
 #define IMG_TEXW 8
 #define IMG_ATLAS_TEXW 128
 #define IMG_ATLAS_ROW (IMG_ATLAS_TEXW / IMG_TEXW)
-#define IMG_TCW ((double)IMG_TEXW / (double)IMG_ATLAS_TEXW)
-#define IMG_TC_BIAS (1.0/4000.0)
 #define IMG_AT(c, r) (IMG_ATLAS_ROW*(r) + (c + 1))
 
 enum ImageTypes {
@@ -96,9 +94,7 @@ enum ImageTypes {
 	NUM_IMG_TYPES
 };
 
-static inline vec2_t imgTC(int idx) {
-	vec2_t tc;
-	tc.x = (float)((idx-1) % IMG_ATLAS_ROW) * IMG_TCW;
-	tc.y = (float)((idx-1) / IMG_ATLAS_ROW) * IMG_TCW;
-	return tc;
+// image n is layer n-1 of the block texture array
+static inline int img_layer(int idx) {
+	return (idx > 0) ? idx - 1 : 0;
 }
@@ -4,8 +4,11 @@
 #include "shaders.h"
 #include "ui.h"
 #include "objfile.h"
+#include "meshopt.h"
+#include "mathtest.h"
 #include "noise.h"
 #include "map.h"
+#include "images.h"
 #include "game.h"
 #include "geometry.h"
 #include "u8.h"
@@ -13,6 +16,15 @@
 #include "stb.h"
 #include "easing.h"
 #include "script.h"
+#include "scriptvm.h"
+#include "gencache.h"
+#include "prof.h"
+#include "mem.h"
+#include "arena.h"
+#include "replay.h"
+#include "http.h"
+#include "capture.h"
+#include "chunkviz.h"
 
 
 static SDL_Window* window;
@@ -42,9 +54,14 @@ void vsync_onoff(int argc, char** argv)
 
 
 static
-void game_init()
+void game_init(uint64_t seed)
 {
+	mem_init();
 	script_init();
+	mem_init_commands();
+	arena_init(&arena_frame, MEM_UI, 256*1024);
+	arena_init(&arena_job, MEM_MESH, 1024*1024);
+	prof_init();
 	script_defun("vsync", vsync_onoff);
 	game.camera.pitch = 0;
 	game.camera.yaw = 0;
@@ -75,23 +92,29 @@ void game_init()
 
 	memset(&game.input, 0, sizeof(struct inputstate));
 
-	printf("* Load materials + UI\n");
-	m_create_material(&game.materials[MAT_BASIC], basic_vshader, basic_fshader);
-	m_create_material(&game.materials[MAT_UI], ui_vshader, ui_fshader);
-	m_create_material(&game.materials[MAT_DEBUG], debug_vshader, debug_fshader);
-	m_create_material(&game.materials[MAT_CHUNK], chunk_vshader, chunk_fshader);
-	m_create_material(&game.materials[MAT_CHUNK_ALPHA], chunk_vshader, chunkalpha_fshader);
-	m_create_material(&game.materials[MAT_SKY], sky_vshader, sky_fshader);
-	ui_init(game.materials + MAT_UI, game.materials + MAT_DEBUG);
-	m_tex2d_load(&blocks_texture, "data/blocks8-v1.png");
+	if (!game.headless) {
+		printf("* Load materials + UI\n");
+		m_create_material(&game.materials[MAT_BASIC], basic_vshader, basic_fshader);
+		m_create_material(&game.materials[MAT_UI], ui_vshader, ui_fshader);
+		m_create_material(&game.materials[MAT_DEBUG], debug_vshader, debug_fshader);
+		m_create_material(&game.materials[MAT_DEBUG_INSTANCED], debug_instanced_vshader, debug_fshader);
+		m_create_material(&game.materials[MAT_CHUNK], chunk_vshader, chunk_fshader);
+		m_create_material(&game.materials[MAT_CHUNK_ALPHA], chunk_vshader, chunkalpha_fshader);
+		m_create_material(&game.materials[MAT_SKY], sky_vshader, sky_fshader);
+		ui_init(game.materials + MAT_UI, game.materials + MAT_DEBUG, game.materials + MAT_DEBUG_INSTANCED);
+		m_tex2d_load_array(&blocks_texture, "data/blocks8-v1.png", IMG_TEXW);
+		capture_init();
+	}
 
 	game.day = 0;
 	game.time_of_day = 0;
 
 	sky_init();
 	player_init();
-	map_init();
+	map_init(seed);
+	chunkviz_init();
 	player_move_to_spawn();
+	http_init();
 
 	mouse_captured = false;
 }
@@ -100,15 +123,27 @@ void game_init()
 static
 void game_exit()
 {
+	http_exit();
+	replay_close();
 	map_exit();
 	sky_exit();
-	ui_exit();
-	for (int i = 0; i < MAX_MATERIALS; ++i)
-		m_destroy_material(game.materials + i);
-	m_mtxstack_destroy(&game.projection);
-	m_mtxstack_destroy(&game.modelview);
-	m_tex2d_destroy(&blocks_texture);
+	if (!game.headless) {
+		capture_exit();
+		ui_exit();
+		prof_gpu_exit();
+	}
+	prof_exit();
+	if (!game.headless) {
+		for (int i = 0; i < MAX_MATERIALS; ++i)
+			m_destroy_material(game.materials + i);
+		m_mtxstack_destroy(&game.projection);
+		m_mtxstack_destroy(&game.modelview);
+		m_tex2d_destroy(&blocks_texture);
+	}
 	script_exit();
+	arena_destroy(&arena_job);
+	arena_destroy(&arena_frame);
+	mem_exit();
 }
 
 
@@ -154,7 +189,7 @@ bool handle_event(SDL_Event* event)
 			ui_add_console_line(stb_sprintf("sort chunks: %d", alpha_sort_chunks));
 		}
 		else if (sym == SDLK_F10) {
-			char name[512];
+			char name[CAPTURE_FILENAME];
 			char date[64];
 			static int cnt = 0;
 			time_t t;
@@ -166,8 +201,7 @@ bool handle_event(SDL_Event* event)
 				snprintf(name, sizeof(name), "roam-%s-%d.png", date, cnt);
 				++cnt;
 			} while (sys_isfile(name));
-			m_save_screenshot(name);
-			ui_add_console_line(stb_sprintf("Saved %s.", name));
+			capture_screenshot(name); // reports when written
 		}
 		else if (sym == SDLK_BACKQUOTE)
 			ui_console_toggle(true);
@@ -214,31 +248,11 @@ bool handle_event(SDL_Event* event)
 				printf("focus gained\n");
 				capture_mouse(true);
 			} else {
-				printf("deleting picked block (%d, %d, %d)\n",
-				       game.input.picked_block.x,
-				       game.input.picked_block.y,
-				       game.input.picked_block.z);
-				if (blocktype_by_coord(game.input.picked_block) != BLOCK_AIR) {
-					printf("can delete.\n");
-					map_update_block(game.input.picked_block, BLOCK_AIR);
-				}
+				game.input.primary_action = true;
 			}
 		} break;
 		case SDL_BUTTON_RIGHT: {
-			printf("creating block (%d, %d, %d)\n",
-				game.input.prepicked_block.x,
-				game.input.prepicked_block.y,
-				game.input.prepicked_block.z);
-
-			ivec3_t feet = player_block();
-			ivec3_t head = feet;
-			head.y += 1;
-			if (blocktype_by_coord(game.input.prepicked_block) == BLOCK_AIR &&
-			    !block_eq(head, game.input.prepicked_block) &&
-			    !block_eq(feet, game.input.prepicked_block)) {
-				printf("can create.\n");
-				map_update_block(game.input.prepicked_block, BLOCK_TEST_ALPHA);
-			}
+			game.input.secondary_action = true;
 		} break;
 		} break;
 	case SDL_MOUSEMOTION: {
@@ -282,14 +296,46 @@ void camera_tick(float dt)
 }
 
 
+// clicks are applied here rather than in handle_event so that
+// they go through the input recorder with everything else
+static
+void player_actions()
+{
+	struct inputstate* in = &game.input;
+	if (in->primary_action) {
+		if (blocktype_by_coord(in->picked_block) != BLOCK_AIR) {
+			map_update_block(in->picked_block, BLOCK_AIR);
+		}
+	}
+	if (in->secondary_action) {
+		ivec3_t feet = player_block();
+		ivec3_t head = feet;
+		head.y += 1;
+		if (blocktype_by_coord(in->prepicked_block) == BLOCK_AIR &&
+		    !block_eq(head, in->prepicked_block) &&
+		    !block_eq(feet, in->prepicked_block)) {
+			map_update_block(in->prepicked_block, BLOCK_TEST_ALPHA);
+		}
+	}
+	in->primary_action = false;
+	in->secondary_action = false;
+}
+
 static
 void game_tick(float dt)
 {
+	http_tick();
+	player_actions();
+	prof_begin(PROF_PLAYER);
 	player_tick(dt);
+	prof_end(PROF_PLAYER);
 	script_tick();
 	camera_tick(dt);
 	ui_tick(dt);
+	prof_begin(PROF_MAP_TICK);
+	map_apply_edits();
 	map_tick();
+	prof_end(PROF_MAP_TICK);
 	sky_tick(dt);
 	// update player/input
 	// update blocks
@@ -448,6 +494,7 @@ void game_draw(SDL_Point* viewport)
 	if (game.wireframe)
 		M_CHECKGL(glPolygonMode(GL_FRONT_AND_BACK, GL_LINE));
 
+	render_origin_update();
 	chunkpos_t camera = player_chunk();
 	vec3_t viewcenter = camera_offset();
 
@@ -468,19 +515,31 @@ void game_draw(SDL_Point* viewport)
 	ui_rect((float)viewport->x/2. - 1., (float)viewport->y/2. - 5., 2, 10, 0x4fffffff);
 	ui_rect((float)viewport->x/2. - 5., (float)viewport->y/2. - 1., 10, 2, 0x4fffffff);
 
+	prof_begin(PROF_MAP_DRAW);
+	prof_gpu_begin(PROF_GPU_MAP);
 	if (game.enable_ground)
 		map_draw(&frustum);
+	prof_gpu_end(PROF_GPU_MAP);
+	prof_end(PROF_MAP_DRAW);
 
 	if (game.wireframe)
 		M_CHECKGL(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
 
+	prof_begin(PROF_SKY);
+	prof_gpu_begin(PROF_GPU_SKY);
 	sky_draw();
+	prof_gpu_end(PROF_GPU_SKY);
+	prof_end(PROF_SKY);
 
 	if (game.wireframe)
 		M_CHECKGL(glPolygonMode(GL_FRONT_AND_BACK, GL_LINE));
 
+	prof_begin(PROF_ALPHA);
+	prof_gpu_begin(PROF_GPU_ALPHA);
 	if (game.enable_ground)
 		map_draw_alphapass();
+	prof_gpu_end(PROF_GPU_ALPHA);
+	prof_end(PROF_ALPHA);
 
 	if (game.wireframe)
 		M_CHECKGL(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
@@ -501,9 +560,8 @@ void game_draw(SDL_Point* viewport)
 		struct playervars* pv = player_vars();
 		float ext = (game.player.crouching ? pv->crouchheight : pv->height) * 0.5f;
 		float offs = (game.player.crouching ? CROUCHCENTEROFFSET : CENTEROFFSET);
-		vec3_t center = { game.player.pos.x - camera.x*CHUNK_SIZE,
-		                   game.player.pos.y + offs,
-		                   game.player.pos.z - camera.z*CHUNK_SIZE };
+		vec3_t center = render_pos(game.player.pos);
+		center.y += offs;
 		vec3_t extent = { 0.4f, ext, 0.4f };
 		ui_debug_aabb(center, extent, 0xffffffff);
 	}
@@ -527,28 +585,45 @@ void game_draw(SDL_Point* viewport)
 		for (int fi = 0; fi < 4; ++fi)
 			fps += ft[fi] * 0.25;
 
+		const struct gencache_stats* gc = gencache_stats();
+		uint64_t gclookups = gc->hits + gc->misses;
+
 		ui_text(4, viewport->y - 20, 0xffffffff,
 			"pos: (%+4.4g, %+4.4g, %+4.4g)\n"
 			"cam: (%+4.4g, %+4.4g, %+4.4g) p: %+.3g, y: %.3g\n"
 			"vel: (%+4.4f, %+4.4f, %+4.4f)\n"
-			"chunk: (%d, %d)\n"
+			"chunk: (%lld, %lld) origin: (%lld, %lld)\n"
 			"%s%s%s\n"
+			"gencache: %.0f%% hit, %.0f ms saved, %zu/%zu kB\n"
+			"arena peak: frame %zu kB, job %zu kB\n"
 			"fps: %g, t: %4.4f",
 			game.player.pos.x, game.player.pos.y, game.player.pos.z,
 			game.camera.pos.x, game.camera.pos.y, game.camera.pos.z,
 			ML_RAD2DEG(game.camera.pitch), ML_RAD2DEG(game.camera.yaw),
 			game.player.vel.x, game.player.vel.y, game.player.vel.z,
-			camera.x, camera.z,
+			(long long)camera.x, (long long)camera.z,
+			(long long)game.origin.x, (long long)game.origin.z,
 			game.player.walking ? "+walk " : "",
 			game.player.crouching ? "+crouch " : "",
 		        game.input.move_sprint ? "+sprint " : "",
+			gclookups ? (double)gc->hits * 100.0 / (double)gclookups : 0.0,
+			gc->saved_ms, gc->bytes / 1024, gc->capacity / 1024,
+			arena_frame.last_peak / 1024, arena_job.last_peak / 1024,
 		        round(fps), game.time_of_day);
+
+		prof_draw(viewport->x - 370, viewport->y - 24);
 	}
+	chunkviz_draw(viewport);
+	prof_begin(PROF_UI);
+	prof_gpu_begin(PROF_GPU_UI);
 	ui_draw_debug(&game.projection, &game.modelview);
 	ui_draw(viewport);
+	prof_gpu_end(PROF_GPU_UI);
+	prof_end(PROF_UI);
 
 	M_CHECKGL(glBindFramebuffer(GL_FRAMEBUFFER, 0));
 
+	prof_gpu_begin(PROF_GPU_POSTPROC);
 	//M_CHECKGL(glDisable(GL_CULL_FACE));
 
 	glClearColor(1.0, 0.0, 0.0, 1.0);
@@ -562,7 +637,9 @@ void game_draw(SDL_Point* viewport)
 	M_CHECKGL(glBindVertexArray(vao_quad));
 
 	glDrawArrays(GL_TRIANGLES, 0, 6);
+	prof_gpu_end(PROF_GPU_POSTPROC);
 
+	capture_frame(viewport->x, viewport->y);
 	SDL_GL_SwapWindow(window);
 }
 
@@ -608,25 +685,291 @@ void game_loop(int64_t dt)
 		}
 	}
 
+	if (!replay_tick())
+		printf("* Replay finished, back to live input\n");
+
 	float frametime = (float)dt / 1000.f;
 	game_tick(frametime);
 }
 
 
+static
+int cmp_double(const void* a, const void* b)
+{
+	double da = *(const double*)a, db = *(const double*)b;
+	return (da > db) - (da < db);
+}
+
+/*
+  Plays back a recording without a window: game_tick and meshing run
+  on the CPU as fast as possible, and the report lists tick times and
+  chunk throughput. Meant for comparing builds, so keep the output
+  stable.
+ */
+static
+int game_benchmark(uint64_t seed, int64_t dt)
+{
+	if (SDL_Init(SDL_INIT_TIMER) < 0)
+		return 1;
+	game.headless = true;
+
+	int64_t init_start = sys_timens();
+	game_init(seed);
+	double init_ms = (double)(sys_timens() - init_start) / 1e6;
+
+	size_t n = replay_frames();
+	double* ticks = mem_alloc(MEM_MISC, sizeof(double) * ML_MAX(n, (size_t)1));
+	struct map_stats start = *map_stats();
+	size_t count = 0;
+	int64_t run_start = sys_timens();
+	game.game_active = true;
+	while (game.game_active && count < n && replay_tick()) {
+		int64_t t0 = sys_timens();
+		game_tick((float)dt / 1000.f);
+		ticks[count++] = (double)(sys_timens() - t0) / 1e6;
+		prof_frame();
+		arena_end_frame(&arena_job);
+		arena_end_frame(&arena_frame);
+		arena_reset(&arena_frame);
+		game.stats.frames++;
+	}
+	double run_s = (double)(sys_timens() - run_start) / 1e9;
+	const struct map_stats* end = map_stats();
+	uint64_t loaded = end->chunks_loaded - start.chunks_loaded;
+	uint64_t meshed = end->chunks_meshed - start.chunks_meshed;
+	uint64_t subchunks = end->subchunks_meshed - start.subchunks_meshed;
+	uint64_t verts = end->verts - start.verts;
+
+	printf("benchmark: seed %lx, %zu ticks of %d ms (%.1f s simulated) in %.2f s, init %.1f ms\n",
+	       game.map.seed, count, (int)dt, (double)(count * dt) / 1000.0, run_s, init_ms);
+	if (count > 0) {
+		double sum = 0.0;
+		for (size_t i = 0; i < count; ++i)
+			sum += ticks[i];
+		qsort(ticks, count, sizeof(double), cmp_double);
+		printf("tick ms: mean %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f\n",
+		       sum / (double)count,
+		       ticks[(size_t)((count - 1) * 0.50)],
+		       ticks[(size_t)((count - 1) * 0.95)],
+		       ticks[(size_t)((count - 1) * 0.99)],
+		       ticks[count - 1]);
+	}
+	if (run_s > 0.0)
+		printf("chunks: %llu loaded (%.1f/s), %llu meshed (%.1f/s), %llu subchunks, %llu verts\n",
+		       (unsigned long long)loaded, (double)loaded / run_s,
+		       (unsigned long long)meshed, (double)meshed / run_s,
+		       (unsigned long long)subchunks, (unsigned long long)verts);
+	mem_free(ticks);
+	game_exit();
+	return 0;
+}
+
+struct tick_window {
+	int64_t start; // ms
+	uint64_t ticks;
+	uint64_t late; // ticks dropped because we fell behind
+	double sum_ms;
+	double max_ms;
+	struct map_stats map;
+};
+
+static
+void tick_window_reset(struct tick_window* w, int64_t now)
+{
+	memset(w, 0, sizeof(*w));
+	w->start = now;
+	w->map = *map_stats();
+}
+
+static
+void tick_window_print(const struct tick_window* w, int64_t now, uint64_t total_ticks)
+{
+	const struct map_stats* ms = map_stats();
+	double secs = ML_MAX((double)(now - w->start) / 1000.0, 0.001);
+	size_t mem = 0;
+	for (int i = 0; i < NUM_MEM_TAGS; ++i)
+		if (i != MEM_GPU)
+			mem += mem_stats(i)->current;
+	printf("[%llu] %.1f ticks/s (%llu late), tick ms avg %.2f max %.2f, "
+	       "chunks %.1f loaded/s %.1f meshed/s, pos (%.0f, %.0f, %.0f), mem %.1f MB\n",
+	       (unsigned long long)total_ticks,
+	       (double)w->ticks / secs, (unsigned long long)w->late,
+	       w->ticks ? w->sum_ms / (double)w->ticks : 0.0, w->max_ms,
+	       (double)(ms->chunks_loaded - w->map.chunks_loaded) / secs,
+	       (double)(ms->chunks_meshed - w->map.chunks_meshed) / secs,
+	       game.player.pos.x, game.player.pos.y, game.player.pos.z,
+	       (double)mem / (1024.0 * 1024.0));
+	fflush(stdout);
+}
+
+/*
+  Runs the world, script and simulation without SDL video or GL,
+  ticking at the fixed timestep in real time. Input comes from a
+  recording (--replay) or script commands (--exec), otherwise the
+  player stays at the spawn point. A status line goes to stdout every
+  stats_ms. Stops after max_ticks (0 = never) or on the quit command.
+ */
+static
+int game_headless(uint64_t seed, int64_t dt, uint64_t max_ticks, const char* exec_file, int64_t stats_ms)
+{
+	if (SDL_Init(SDL_INIT_TIMER) < 0)
+		return 1;
+	game.headless = true;
+	game_init(seed);
+	if (exec_file != NULL)
+		script_dofile(exec_file);
+
+	struct tick_window window;
+	uint64_t ticks = 0;
+	int64_t next = sys_timems();
+	tick_window_reset(&window, next);
+	game.game_active = true;
+	while (game.game_active && (max_ticks == 0 || ticks < max_ticks)) {
+		int64_t now = sys_timems();
+		if (now < next) {
+			SDL_Delay((Uint32)(next - now));
+			continue;
+		}
+		// same 250 ms clamp as the windowed loop
+		if (now - next > 250) {
+			window.late += (uint64_t)((now - next) / dt);
+			next = now;
+		}
+		next += dt;
+
+		if (!replay_tick())
+			printf("* Replay finished\n");
+		int64_t t0 = sys_timens();
+		game_tick((float)dt / 1000.f);
+		double tick_ms = (double)(sys_timens() - t0) / 1e6;
+		prof_frame();
+		arena_end_frame(&arena_job);
+		arena_end_frame(&arena_frame);
+		arena_reset(&arena_frame);
+		game.stats.frames++;
+		game.stats.frametime = dt;
+
+		ticks++;
+		window.ticks++;
+		window.sum_ms += tick_ms;
+		window.max_ms = ML_MAX(window.max_ms, tick_ms);
+		if (now - window.start >= stats_ms) {
+			tick_window_print(&window, now, ticks);
+			tick_window_reset(&window, now);
+		}
+	}
+	if (window.ticks > 0)
+		tick_window_print(&window, sys_timems(), ticks);
+	game_exit();
+	return 0;
+}
+
 int roam_main(int argc, char* argv[])
 {
 	GLenum rc;
+	uint64_t seed = 0;
+	bool seed_set = false;
+	const char* record_file = NULL;
+	const char* replay_file = NULL;
+	bool benchmark = false;
+	bool headless = false;
+	uint64_t max_ticks = 0;
+	const char* exec_file = NULL;
+	int64_t stats_ms = 5000;
+	int64_t dt = 15;
 
 	if (argc == 3 && strcmp(argv[1], "objtest") == 0) {
-		char* fdata = sys_readfile(argv[2]);
 		obj_t obj;
-		obj_load(&obj, fdata, 0.1f);
-		printf("loaded %s: %zu verts, %zu faces\n", argv[2], obj.nverts / 3, obj.nindices / 3);
-		free(fdata);
+		size_t len;
+		const char* data = sys_mapfile(argv[2], &len);
+		if (data == NULL)
+			fatal_error("objtest: can't read %s", argv[2]);
+		int64_t start = sys_timens();
+		obj_load(&obj, data, len, 0.1f);
+		double parse_ms = (double)(sys_timens() - start) / 1e6;
+		sys_unmapfile(data, len);
+		size_t nv = obj.nverts / 3;
+		double acmr16 = meshopt_acmr(obj.indices, obj.nindices, nv, 16);
+		double acmr32 = meshopt_acmr(obj.indices, obj.nindices, nv, 32);
+		start = sys_timens();
+		obj_optimize(&obj);
+		double opt_ms = (double)(sys_timens() - start) / 1e6;
+		printf("parsed %s: %zu verts, %zu faces in %.2f ms%s%s\n", argv[2], nv, obj.nindices / 3, parse_ms,
+		       obj.texcoords ? ", texcoords" : "", obj.normals ? ", normals" : "");
+		printf("optimized in %.2f ms, ACMR fifo16 %.3f -> %.3f, fifo32 %.3f -> %.3f, %s indices\n", opt_ms,
+		       acmr16, meshopt_acmr(obj.indices, obj.nindices, obj.nverts / 3, 16),
+		       acmr32, meshopt_acmr(obj.indices, obj.nindices, obj.nverts / 3, 32),
+		       (obj.nverts / 3 <= 0x10000) ? "16-bit" : "32-bit");
+		obj_free(&obj);
+
+		start = sys_timens();
+		if (!obj_loadfile(&obj, argv[2], 0.1f))
+			fatal_error("objtest: can't read %s", argv[2]);
+		printf("obj_loadfile: %.2f ms\n", (double)(sys_timens() - start) / 1e6);
 		obj_free(&obj);
 		exit(0);
 	}
 
+	if (argc == 2 && strcmp(argv[1], "culltest") == 0)
+		return mathtest_cull();
+	if (argc == 2 && strcmp(argv[1], "mathtest") == 0)
+		return mathtest_simd() | mathtest_cull();
+	if (argc == 2 && strcmp(argv[1], "scripttest") == 0)
+		return scriptvm_selftest();
+
+	for (int i = 1; i < argc; ++i) {
+		bool more = (i + 1 < argc);
+		if (strcmp(argv[i], "--seed") == 0 && more) {
+			seed = strtoull(argv[++i], NULL, 0);
+			seed_set = true;
+		} else if (strcmp(argv[i], "--record") == 0 && more) {
+			record_file = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && more) {
+			replay_file = argv[++i];
+		} else if (strcmp(argv[i], "--benchmark") == 0 && more) {
+			replay_file = argv[++i];
+			benchmark = true;
+		} else if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if (strcmp(argv[i], "--ticks") == 0 && more) {
+			max_ticks = strtoull(argv[++i], NULL, 0);
+		} else if (strcmp(argv[i], "--exec") == 0 && more) {
+			exec_file = argv[++i];
+		} else if (strcmp(argv[i], "--stats") == 0 && more) {
+			stats_ms = (int64_t)(atof(argv[++i]) * 1000.0);
+		} else {
+			fprintf(stderr, "usage: roam [--seed N] [--record FILE] [--replay FILE] [--benchmark FILE]\n"
+			        "            [--headless] [--ticks N] [--exec FILE] [--stats SECONDS]\n"
+			        "       roam objtest FILE\n"
+			        "       roam culltest\n"
+			        "       roam mathtest\n"
+			        "       roam scripttest\n");
+			return 1;
+		}
+	}
+
+	if (replay_file != NULL) {
+		int replay_dt;
+		if (!replay_open(replay_file, &seed, &replay_dt)) {
+			fprintf(stderr, "%s: not a recording\n", replay_file);
+			return 1;
+		}
+		if (seed_set || record_file != NULL)
+			fprintf(stderr, "--seed and --record are ignored when replaying\n");
+		record_file = NULL;
+		dt = replay_dt;
+	} else if (!seed_set) {
+		seed = sys_urandom();
+	}
+
+	if (benchmark)
+		return game_benchmark(seed, dt);
+	if (headless) {
+		if (record_file != NULL)
+			fprintf(stderr, "--record needs a window, ignored\n");
+		return game_headless(seed, dt, max_ticks, exec_file, ML_MAX(stats_ms, dt));
+	}
+
 	if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
 		return 1;
 
@@ -684,15 +1027,20 @@ int roam_main(int argc, char* argv[])
 	              (float)game_viewport.x / (float)game_viewport.y,
 	              0.1f, 1024.f);
 
-	game_init();
+	game_init(seed);
 	init_fbo_resources();
+	prof_gpu_init();
+	if (exec_file != NULL)
+		script_dofile(exec_file);
+
+	if (record_file != NULL && !replay_record(record_file, seed, (int)dt))
+		fprintf(stderr, "%s: can't open for recording\n", record_file);
 
 	int64_t currenttime, newtime, frametime;
-	int64_t t, dt, accumulator ;
+	int64_t t, accumulator;
 	game.stats.frametime = (int64_t)((1.0 / 60.0) * 1000.0);
 
 	t = 0;
-	dt = 15;
 	accumulator = 0;
 	currenttime = sys_timems();
 	game.game_active = true;
@@ -711,8 +1059,13 @@ int roam_main(int argc, char* argv[])
 			accumulator -= dt;
 		}
 		game_draw(&game_viewport);
+		prof_frame();
+		arena_end_frame(&arena_job);
+		arena_end_frame(&arena_frame);
+		arena_reset(&arena_frame);
 		game.stats.frames++;
 		game.stats.frametime = frametime;
 	}
+	game_exit();
 	return 0;
 }
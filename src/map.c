@@ -7,21 +7,18 @@
 #include "blocks.h"
 #include "ui.h"
 #include "gen.h"
+#include "gencache.h"
+#include "chunkstore.h"
+#include "rle.h"
+#include "prof.h"
+#include "mem.h"
+#include "arena.h"
+#include "script.h"
 #include "easing.h"
 
 #define SUNLIGHT_MASK 0xf0000000
 #define NOSUNLIGHT_MASK 0x0fffffff
 
-static inline
-tc2us_t make_tc2us(vec2_t tc)
-{
-	tc2us_t to = {
-		(uint16_t)(tc.x * (double)0xffff),
-		(uint16_t)(tc.y * (double)0xffff)
-	};
-	return to;
-}
-
 uint32_t block_at(int x, int y, int z)
 {
 	if (y < 0 || y >= MAP_BLOCK_HEIGHT)
@@ -34,23 +31,36 @@ uint32_t block_at(int x, int y, int z)
 
 void chunk_mark_dirty_ptr(game_chunk* chunk);
 void chunk_destroy_mesh_ptr(game_chunk* chunk);
+static void alpha_sort_exit(void);
+
+#define MESH_QUAD_VERTS 6 // every block face is two triangles
+
+static inline
+void chunk_set_state(game_chunk* chunk, int state)
+{
+	if (chunk->state != state) {
+		chunk->state = (uint8_t)state;
+		chunk->state_frame = game.stats.frames;
+	}
+}
 
 /*
   Set up a lookup table used for the texcoords of all regular blocks.
+  The layer is the atlas tile, the corners are in the order the faces
+  are emitted.
   Things with different dimensions need a different system..
  */
-static tc2us_t block_texcoords[NUM_BLOCKTYPES * 6 * 4];
+static tclayer_t block_texcoords[NUM_BLOCKTYPES * 6 * 4];
 #define BLOCKTC(t, f, i) block_texcoords[(t)*(6*4) + (f)*4 + (i)]
 static
 void gen_block_tcs()
 {
-	float bw = IMG_TCW - IMG_TC_BIAS*2.0;
-	vec2_t tcoffs[4] = {{0, bw}, {bw, bw}, {bw, 0}, {0, 0} };
 	for (int t = 0; t < NUM_BLOCKTYPES; ++t) {
 		for (int i = 0; i < 6; ++i) {
-			vec2_t tl = m_vec2addf(imgTC(blockinfo[t].img[i]), IMG_TC_BIAS);
-			for (int j = 0; j < 4; ++j)
-				BLOCKTC(t, i, j) = make_tc2us(m_vec2add(tl, tcoffs[j]));
+			for (int j = 0; j < 4; ++j) {
+				tclayer_t tc = { (uint8_t)img_layer(blockinfo[t].img[i]), (uint8_t)j, 0 };
+				BLOCKTC(t, i, j) = tc;
+			}
 		}
 	}
 }
@@ -58,6 +68,7 @@ void gen_block_tcs()
 extern tex2d_t blocks_texture;
 uint32_t* map_blocks = NULL;
 static chunkpos_t map_chunk;
+static struct map_stats mapstats;
 
 static uint32_t lightlut[256];
 
@@ -73,7 +84,27 @@ void lightlut_init(void)
 	printf("\n");
 }
 
-void map_init()
+static float gencache_mb;
+
+// skip solid face ranges that point away from the camera
+static bool face_culling;
+
+static
+void gencache_mb_changed(const char* name, void* data)
+{
+	gencache_set_capacity((size_t)(ML_MAX(gencache_mb, 0.f) * 1024.0 * 1024.0));
+}
+
+static void map_save_cmd(int argc, char** argv);
+static void map_load_cmd(int argc, char** argv);
+static void map_rlebench_cmd(int argc, char** argv);
+static void edit_queue_init(void);
+static void map_fill_cmd(int argc, char** argv);
+static void map_copy_cmd(int argc, char** argv);
+static void map_replace_cmd(int argc, char** argv);
+static void map_natives_init(void);
+
+void map_init(uint64_t seed)
 {
 	blocks_init();
 	gen_block_tcs();
@@ -81,13 +112,26 @@ void map_init()
 
 	printf("* Allocate and build initial map...\n");
 	memset(&game.map, 0, sizeof(struct game_map));
-	map_blocks = (uint32_t*)malloc(sizeof(uint32_t)*MAP_BUFFER_SIZE);
-	memset(map_blocks, 0, sizeof(uint32_t)*MAP_BUFFER_SIZE);
+	memset(&mapstats, 0, sizeof(mapstats));
+	map_blocks = (uint32_t*)mem_calloc(MEM_MAP, MAP_BUFFER_SIZE, sizeof(uint32_t));
 
-	game.map.seed = sys_urandom();
+	game.map.seed = seed;
 	printf("* Seed: %lx\n", game.map.seed);
 	simplex_init(game.map.seed);
 	opensimplex_init(game.map.seed);
+	gen_init();
+	script_bind_float("map.gencache", &gencache_mb, 32.f, gencache_mb_changed, NULL);
+	script_bind_bool("map.facecull", &face_culling, true, NULL, NULL);
+	gencache_init((size_t)(gencache_mb * 1024.0 * 1024.0));
+	chunkstore_init();
+	edit_queue_init();
+	script_defun("save", map_save_cmd);
+	script_defun("load", map_load_cmd);
+	script_defun("rlebench", map_rlebench_cmd);
+	script_defun("fill", map_fill_cmd);
+	script_defun("copy", map_copy_cmd);
+	script_defun("replace", map_replace_cmd);
+	map_natives_init();
 
 	chunkpos_t camera = player_chunk();
 	for (int z = -VIEW_DISTANCE; z < VIEW_DISTANCE; ++z)
@@ -104,15 +148,18 @@ void map_exit()
 {
 	for (size_t i = 0; i < MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH; ++i)
 		chunk_destroy_mesh_ptr(game.map.chunks + i);
+	alpha_sort_exit();
 
-	free(map_blocks);
+	gencache_exit();
+	chunkstore_exit();
+	mem_free(map_blocks);
 	map_blocks = NULL;
 }
 
-static inline game_chunk* cached_chunk_at(int x, int z)
+static inline game_chunk* cached_chunk_at(int64_t x, int64_t z)
 {
-	int bufx = mod(x, MAP_CHUNK_WIDTH);
-	int bufz = mod(z, MAP_CHUNK_WIDTH);
+	int bufx = chunk_slot(x);
+	int bufz = chunk_slot(z);
 	game_chunk* chunk = game.map.chunks + (bufz*MAP_CHUNK_WIDTH + bufx);
 	if (chunk->x == x && chunk->z == z)
 		return chunk;
@@ -134,23 +181,25 @@ void map_tick()
 	chunkpos_t nc = player_chunk();
 	if (nc.x != map_chunk.x || nc.z != map_chunk.z) {
 		game_chunk* chunks = game.map.chunks;
-		int cx = nc.x;
-		int cz = nc.z;
-		printf("[%d, %d] -> [%d, %d] (%g, %g)\n",
-		       map_chunk.x, map_chunk.z, cx, cz,
+		int64_t cx = nc.x;
+		int64_t cz = nc.z;
+		printf("[%lld, %lld] -> [%lld, %lld] (%g, %g)\n",
+		       (long long)map_chunk.x, (long long)map_chunk.z, (long long)cx, (long long)cz,
 		       game.camera.pos.x, game.camera.pos.z);
 		map_chunk = nc;
 
 		for (int dz = -VIEW_DISTANCE; dz < VIEW_DISTANCE; ++dz) {
-			int bz = mod(cz + dz, MAP_CHUNK_WIDTH);
+			int bz = chunk_slot(cz + dz);
  			game_chunk* chunk_row = chunks + (bz*MAP_CHUNK_WIDTH);
 			for (int dx = -VIEW_DISTANCE; dx < VIEW_DISTANCE; ++dx) {
-				int bx = mod(cx + dx, MAP_CHUNK_WIDTH);
+				int bx = chunk_slot(cx + dx);
 				game_chunk* chunk = chunk_row + bx;
 				if (chunk->x != cx + dx ||
 				    chunk->z != cz + dz) {
 					chunk_mark_dirty_ptr(chunk);
+					prof_begin(PROF_MAP_GEN);
 					chunk_load(cx + dx, cz + dz);
+					prof_end(PROF_MAP_GEN);
 					chunk = chunks + (bz*MAP_CHUNK_WIDTH + bx);
 					assert(chunk->x == (cx + dx) && chunk->z == (cz + dz));
 
@@ -177,17 +226,23 @@ void map_tick()
 		Uint32 max_per_frame = 10; // milliseconds
 		Uint32 start_ticks = SDL_GetTicks();
 		Uint32 curr_ticks = start_ticks;
-		int cx = nc.x;
-		int cz = nc.z;
+		int64_t cx = nc.x;
+		int64_t cz = nc.z;
 		game_chunk* chunks = game.map.chunks;
 		for (int dz = -VIEW_DISTANCE; dz < VIEW_DISTANCE; ++dz) {
-			int bz = mod(cz + dz, MAP_CHUNK_WIDTH);
+			int bz = chunk_slot(cz + dz);
 			game_chunk* chunk_row = chunks + (bz*MAP_CHUNK_WIDTH);
 			for (int dx = -VIEW_DISTANCE; dx < VIEW_DISTANCE; ++dx) {
-				int bx = mod(cx + dx, MAP_CHUNK_WIDTH);
+				int bx = chunk_slot(cx + dx);
 				game_chunk* chunk = chunk_row + bx;
-				if (chunk->dirty) {
+				if (chunk->dirty || chunk->dirty_mask) {
+					prof_begin(PROF_MAP_MESH);
 					chunk_build_mesh_ptr(bx, bz, chunk);
+					prof_end(PROF_MAP_MESH);
+					// headless runs mesh everything so that replays
+					// do the same work regardless of machine speed
+					if (game.headless)
+						continue;
 					curr_ticks = SDL_GetTicks();
 					if (curr_ticks < start_ticks || ((curr_ticks - start_ticks) > max_per_frame))
 						goto escape;
@@ -209,6 +264,69 @@ struct alpha_t {
 static struct alpha_t alphas[MAX_ALPHAS];
 static size_t nalphas;
 
+/*
+  Culling runs over every subchunk mesh in one batch. Each loaded
+  column adds a box per non-empty subchunk, plus one full height box
+  when it has an alpha mesh. cull_items says what each box stands
+  for, in the same order as the column loop.
+ */
+#define MAX_CULL_BOXES (MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH*(MAP_CHUNK_HEIGHT + 1))
+#define CULL_ALPHA -1
+
+struct cull_item {
+	game_chunk* chunk;
+	int sub; // subchunk, or CULL_ALPHA
+};
+
+static float cull_soa[6][MAX_CULL_BOXES];
+static struct cull_item cull_items[MAX_CULL_BOXES];
+static uint32_t cull_visible[MAX_CULL_BOXES];
+
+// the loaded ring is centered on map_chunk, offsets are in render space
+static
+size_t map_cull(frustum_t* frustum)
+{
+	const float chunk_radius = (float)CHUNK_SIZE*0.5f;
+	aabb_soa_t boxes = {
+		cull_soa[0], cull_soa[1], cull_soa[2],
+		cull_soa[3], cull_soa[4], cull_soa[5],
+		0
+	};
+	game_chunk* chunks = game.map.chunks;
+	for (int dz = -VIEW_DISTANCE; dz < VIEW_DISTANCE; ++dz) {
+		for (int dx = -VIEW_DISTANCE; dx < VIEW_DISTANCE; ++dx) {
+			int bx = chunk_slot(map_chunk.x + dx);
+			int bz = chunk_slot(map_chunk.z + dz);
+			game_chunk* chunk = chunks + (bz*MAP_CHUNK_WIDTH + bx);
+			vec3_t offset = render_chunk(chunk->x, chunk->z);
+			float cx = offset.x + chunk_radius;
+			float cz = offset.z + chunk_radius;
+			for (int j = 0; j < MAP_CHUNK_HEIGHT; ++j) {
+				if (chunk->solid[j].vbo == 0)
+					continue;
+				size_t n = boxes.n++;
+				boxes.cx[n] = cx;
+				boxes.cy[n] = (float)(CHUNK_SIZE*j) - 0.5f + chunk_radius;
+				boxes.cz[n] = cz;
+				boxes.ex[n] = boxes.ey[n] = boxes.ez[n] = chunk_radius;
+				cull_items[n].chunk = chunk;
+				cull_items[n].sub = j;
+			}
+			if (chunk->alpha.vbo != 0) {
+				size_t n = boxes.n++;
+				boxes.cx[n] = cx;
+				boxes.cy[n] = MAP_BLOCK_HEIGHT*0.5f;
+				boxes.cz[n] = cz;
+				boxes.ex[n] = boxes.ez[n] = chunk_radius;
+				boxes.ey[n] = MAP_BLOCK_HEIGHT*0.5f;
+				cull_items[n].chunk = chunk;
+				cull_items[n].sub = CULL_ALPHA;
+			}
+		}
+	}
+	return collide_frustum_aabb_batch(frustum, &boxes, cull_visible);
+}
+
 void map_draw(frustum_t* frustum)
 {
 	// for each visible chunk...
@@ -226,57 +344,66 @@ void map_draw(frustum_t* frustum)
 	m_uniform_vec3(material->amb_light, &game.amb_light);
 	m_uniform_vec4(material->fog_color, &game.fog_color);
 
-	float chunk_radius = (float)CHUNK_SIZE*0.5f;
-	vec3_t offset, center, extent;
-	game_chunk* chunks = game.map.chunks;
-	chunkpos_t camera = player_chunk();
-
-	int dx, dz, bx, bz, x, z, j;
-	game_chunk* chunk;
-	mesh_t* mesh;
+	vec3_t eye = camera_offset();
+	size_t nvisible = map_cull(frustum);
+	game_chunk* current = NULL;
 
 	nalphas = 0;
 
-	for (dz = -VIEW_DISTANCE; dz < VIEW_DISTANCE; ++dz) {
-		for (dx = -VIEW_DISTANCE; dx < VIEW_DISTANCE; ++dx) {
-			bx = mod(camera.x + dx, MAP_CHUNK_WIDTH);
-			bz = mod(camera.z + dz, MAP_CHUNK_WIDTH);
-			chunk = chunks + (bz*MAP_CHUNK_WIDTH + bx);
-			x = chunk->x - camera.x;
-			z = chunk->z - camera.z;
-
-			m_setvec3(offset, (float)(x*CHUNK_SIZE) - 0.5f, -0.5f, (float)(z*CHUNK_SIZE) - 0.5f);
-			m_setvec3(center, offset.x + chunk_radius, MAP_BLOCK_HEIGHT*0.5f, offset.z + chunk_radius);
-			m_setvec3(extent, chunk_radius, MAP_BLOCK_HEIGHT*0.5f, chunk_radius);
-			if (collide_frustum_aabb_xz(frustum, center, extent) == ML_OUTSIDE)
-				continue;
-
-			if (chunk->dirty) {
-				//if (game.debug_mode)
-				//	ui_debug_aabb(center, extent, 0x44ff2222);
-				//continue;
-			}
-
-			extent.y = chunk_radius;
-
-			m_uniform_vec3(material->chunk_offset, &offset);
-
-			if (chunk->alpha.vbo != 0 && nalphas < MAX_ALPHAS) {
+	for (size_t i = 0; i < nvisible; ++i) {
+		const struct cull_item* item = cull_items + cull_visible[i];
+		game_chunk* chunk = item->chunk;
+		vec3_t offset = render_chunk(chunk->x, chunk->z);
+		if (item->sub == CULL_ALPHA) {
+			if (nalphas < MAX_ALPHAS) {
 				alphas[nalphas].chunk = chunk;
 				alphas[nalphas].offset = offset;
 				nalphas++;
 			}
-
-			for (j = 0; j < MAP_CHUNK_HEIGHT; ++j) {
-				mesh = chunk->solid + j;
-				if (mesh->vbo == 0)
-					continue;
-				center.y = (float)(CHUNK_SIZE*j) - 0.5f + chunk_radius;
-				if (collide_frustum_aabb_y(frustum, center, extent) == ML_OUTSIDE)
-					continue;
-				m_draw(mesh);
+			continue;
+		}
+		if (chunk != current) {
+			m_uniform_vec3(material->chunk_offset, &offset);
+			current = chunk;
+		}
+		const uint32_t* faces = chunk->faces[item->sub];
+		if (!face_culling) {
+			m_draw(chunk->solid + item->sub);
+			mapstats.verts_drawn += faces[MAP_FACE_DIRS];
+			continue;
+		}
+		// a face range can only face the camera if the eye is past the
+		// nearest face plane in the subchunk, one block in from the box
+		vec3_t lo = { offset.x, offset.y + (float)(item->sub*CHUNK_SIZE), offset.z };
+		bool facing[MAP_FACE_DIRS];
+		facing[BLOCK_TEX_TOP] = eye.y > lo.y + 1.f;
+		facing[BLOCK_TEX_BOTTOM] = eye.y < lo.y + (float)(CHUNK_SIZE - 1);
+		facing[BLOCK_TEX_LEFT] = eye.x < lo.x + (float)(CHUNK_SIZE - 1);
+		facing[BLOCK_TEX_RIGHT] = eye.x > lo.x + 1.f;
+		facing[BLOCK_TEX_FRONT] = eye.z > lo.z + 1.f;
+		facing[BLOCK_TEX_BACK] = eye.z < lo.z + (float)(CHUNK_SIZE - 1);
+		GLint first[MAP_FACE_DIRS];
+		GLsizei count[MAP_FACE_DIRS];
+		GLsizei nranges = 0;
+		for (int d = 0; d < MAP_FACE_DIRS; ++d) {
+			GLsizei n = (GLsizei)(faces[d + 1] - faces[d]);
+			if (n == 0)
+				continue;
+			if (!facing[d]) {
+				mapstats.verts_culled += (uint64_t)n;
+				continue;
+			}
+			mapstats.verts_drawn += (uint64_t)n;
+			if (nranges > 0 && first[nranges - 1] + count[nranges - 1] == (GLint)faces[d]) {
+				count[nranges - 1] += n;
+			} else {
+				first[nranges] = (GLint)faces[d];
+				count[nranges] = n;
+				nranges++;
 			}
 		}
+		if (nranges > 0)
+			m_draw_ranges(chunk->solid + item->sub, first, count, nranges);
 	}
 
 	m_use(NULL);
@@ -284,19 +411,135 @@ void map_draw(frustum_t* frustum)
 	glDepthMask(GL_TRUE);
 }
 
-// sort back to front
+/*
+  Back to front ordering for the alpha pass. Chunks are ordered by
+  distance every frame, and the faces inside each drawn chunk are
+  ordered by the distance of their centers whenever the eye has moved
+  to another block since the last sort. Both use an LSD radix sort on
+  inverted float bits, so the farthest comes first, and the face order
+  only rewrites the index buffer of the chunk.
+ */
+
+static uint32_t* sort_keys;
+static uint32_t* sort_vals;
+static size_t sort_capacity;
+static void* sort_indices;
+static size_t sort_indices_bytes;
+static struct alpha_t sorted_alphas[MAX_ALPHAS];
 
 static
-int cmp_alpha_chunks(struct alpha_t *a, struct alpha_t *b)
+void alpha_sort_exit()
 {
-	int ret = 0;
-	float da = (a->offset.x*a->offset.x) + (a->offset.z*a->offset.z);
-	float db = (b->offset.x*b->offset.x) + (b->offset.z*b->offset.z);
-	if (da > db)
-		ret = -1;
-	if (da < db)
-		ret = 1;
-	return ret;
+	mem_free(sort_keys);
+	mem_free(sort_vals);
+	mem_free(sort_indices);
+	sort_keys = sort_vals = NULL;
+	sort_indices = NULL;
+	sort_capacity = sort_indices_bytes = 0;
+}
+
+static
+void alpha_sort_reserve(size_t n)
+{
+	if (n <= sort_capacity)
+		return;
+	sort_capacity = ML_MAX(n, sort_capacity * 2);
+	// keys and values, each followed by its ping-pong half
+	sort_keys = mem_realloc(MEM_MESH, sort_keys, sort_capacity * 2 * sizeof(uint32_t));
+	sort_vals = mem_realloc(MEM_MESH, sort_vals, sort_capacity * 2 * sizeof(uint32_t));
+}
+
+static inline
+uint32_t far_first_key(float dist2)
+{
+	uint32_t bits;
+	memcpy(&bits, &dist2, sizeof(bits));
+	return ~bits; // dist2 >= 0, so the bits order like the value
+}
+
+// sorts sort_keys[0..n) ascending together with sort_vals and returns
+// the sorted values, which are either sort_vals or its second half
+static
+const uint32_t* alpha_radix_sort(size_t n)
+{
+	uint32_t* keys = sort_keys;
+	uint32_t* vals = sort_vals;
+	uint32_t* tkeys = sort_keys + sort_capacity;
+	uint32_t* tvals = sort_vals + sort_capacity;
+	for (int shift = 0; shift < 32; shift += 8) {
+		size_t counts[256] = {0};
+		for (size_t i = 0; i < n; ++i)
+			counts[(keys[i] >> shift) & 0xff]++;
+		if (counts[(keys[0] >> shift) & 0xff] == n)
+			continue; // same digit everywhere, nothing moves
+		size_t sum = 0;
+		for (int d = 0; d < 256; ++d) {
+			size_t c = counts[d];
+			counts[d] = sum;
+			sum += c;
+		}
+		for (size_t i = 0; i < n; ++i) {
+			size_t j = counts[(keys[i] >> shift) & 0xff]++;
+			tkeys[j] = keys[i];
+			tvals[j] = vals[i];
+		}
+		uint32_t* t = keys; keys = tkeys; tkeys = t;
+		t = vals; vals = tvals; tvals = t;
+	}
+	return vals;
+}
+
+static
+void alpha_sort_faces(game_chunk* chunk, vec3_t eye)
+{
+	size_t n = chunk->alpha_quads;
+	const float* c = chunk->alpha_centers;
+	if (n < 2)
+		return;
+	alpha_sort_reserve(n);
+	for (size_t q = 0; q < n; ++q) {
+		float dx = c[q*3] - eye.x;
+		float dy = c[q*3 + 1] - eye.y;
+		float dz = c[q*3 + 2] - eye.z;
+		sort_keys[q] = far_first_key(dx*dx + dy*dy + dz*dz);
+		sort_vals[q] = (uint32_t)q;
+	}
+	const uint32_t* order = alpha_radix_sort(n);
+
+	size_t isize = (chunk->alpha.ibotype == GL_UNSIGNED_SHORT) ? 2 : 4;
+	size_t bytes = n * MESH_QUAD_VERTS * isize;
+	if (bytes > sort_indices_bytes) {
+		sort_indices_bytes = ML_MAX(bytes, sort_indices_bytes * 2);
+		sort_indices = mem_realloc(MEM_MESH, sort_indices, sort_indices_bytes);
+	}
+	if (isize == 2) {
+		uint16_t* idx = sort_indices;
+		for (size_t i = 0; i < n; ++i)
+			for (int k = 0; k < MESH_QUAD_VERTS; ++k)
+				*idx++ = (uint16_t)(order[i]*MESH_QUAD_VERTS + k);
+	} else {
+		uint32_t* idx = sort_indices;
+		for (size_t i = 0; i < n; ++i)
+			for (int k = 0; k < MESH_QUAD_VERTS; ++k)
+				*idx++ = order[i]*MESH_QUAD_VERTS + k;
+	}
+	m_update_indices(&chunk->alpha, 0, (GLsizeiptr)bytes, sort_indices);
+}
+
+static
+void alpha_sort_chunks_by_distance(vec3_t eye)
+{
+	alpha_sort_reserve(nalphas);
+	for (size_t i = 0; i < nalphas; ++i) {
+		float dx = alphas[i].offset.x + (float)CHUNK_SIZE*0.5f - eye.x;
+		float dz = alphas[i].offset.z + (float)CHUNK_SIZE*0.5f - eye.z;
+		sort_keys[i] = far_first_key(dx*dx + dz*dz);
+		sort_vals[i] = (uint32_t)i;
+	}
+	const uint32_t* order = alpha_radix_sort(nalphas);
+	for (size_t i = 0; i < nalphas; ++i)
+		sorted_alphas[i] = alphas[order[i]];
+	memcpy(alphas, sorted_alphas, nalphas * sizeof(struct alpha_t));
 }
 
 bool alpha_sort_chunks = true;
@@ -309,8 +552,10 @@ void map_draw_alphapass()
 	if (nalphas == 0)
 		return;
 
+	vec3_t eye = camera_offset();
+	ivec3_t cell = camera_block();
 	if (alpha_sort_chunks)
-		qsort(alphas, nalphas, sizeof(struct alpha_t), (int(*)(const void*, const void*))cmp_alpha_chunks);
+		alpha_sort_chunks_by_distance(eye);
 
 	material = game.materials + MAT_CHUNK_ALPHA;
 	m_tex2d_bind(&blocks_texture, 0);
@@ -330,6 +575,12 @@ void map_draw_alphapass()
 	for (i = 0, alpha = alphas; i < nalphas; ++i, ++alpha) {
 		game_chunk* chunk = alpha->chunk;
 		mesh_t* mesh = &(chunk->alpha);
+		if (!block_eq(chunk->alpha_cell, cell)) {
+			vec3_t local;
+			m_setvec3(local, eye.x - alpha->offset.x, eye.y - alpha->offset.y, eye.z - alpha->offset.z);
+			alpha_sort_faces(chunk, local);
+			chunk->alpha_cell = cell;
+		}
 		m_uniform_vec3(material->chunk_offset, &alpha->offset);
 		m_draw(mesh);
 	}
@@ -339,69 +590,638 @@ void map_draw_alphapass()
 	glDepthMask(GL_TRUE);
 }
 
+/*
+  Block edits go through a bounded lock-free MPSC queue (Vyukov's
+  ring with per-cell sequence numbers) so that any thread can submit
+  them. The main thread drains the queue once per tick in
+  map_apply_edits(): blocks are written, each touched column is
+  relit once, and dirty subchunks are collected in the chunk
+  dirty_mask so that a batch of edits costs one remesh per subchunk.
+ */
+
+#define EDIT_QUEUE_SIZE 65536 // power of two
+
+struct map_edit {
+	ivec3_t block;
+	uint32_t value;
+};
+
+struct edit_cell {
+	SDL_atomic_t seq;
+	struct map_edit edit;
+};
+
+static struct edit_cell edit_queue[EDIT_QUEUE_SIZE];
+static SDL_atomic_t edit_enqueue_pos;
+static unsigned int edit_dequeue_pos; // consumer (main thread) only
+
+// columns touched while applying a batch, relit once each
+static uint32_t edit_column_bits[MAP_BLOCK_WIDTH*MAP_BLOCK_WIDTH/32];
+static int edit_columns[EDIT_QUEUE_SIZE][2];
+static size_t edit_ncolumns;
+
+static
+void edit_queue_init()
+{
+	for (unsigned int i = 0; i < EDIT_QUEUE_SIZE; ++i)
+		SDL_AtomicSet(&edit_queue[i].seq, (int)i);
+	SDL_AtomicSet(&edit_enqueue_pos, 0);
+	edit_dequeue_pos = 0;
+	edit_ncolumns = 0;
+	memset(edit_column_bits, 0, sizeof(edit_column_bits));
+}
+
+bool map_queue_edit(ivec3_t block, uint32_t value)
+{
+	struct edit_cell* cell;
+	unsigned int pos = (unsigned int)SDL_AtomicGet(&edit_enqueue_pos);
+	for (;;) {
+		cell = edit_queue + (pos & (EDIT_QUEUE_SIZE - 1));
+		int diff = (int)((unsigned int)SDL_AtomicGet(&cell->seq) - pos);
+		if (diff == 0) {
+			if (SDL_AtomicCAS(&edit_enqueue_pos, (int)pos, (int)(pos + 1)))
+				break;
+			pos = (unsigned int)SDL_AtomicGet(&edit_enqueue_pos);
+		} else if (diff < 0) {
+			return false; // full
+		} else {
+			pos = (unsigned int)SDL_AtomicGet(&edit_enqueue_pos);
+		}
+	}
+	cell->edit.block = block;
+	cell->edit.value = value;
+	SDL_AtomicSet(&cell->seq, (int)(pos + 1));
+	return true;
+}
+
+static
+bool edit_dequeue(struct map_edit* edit)
+{
+	struct edit_cell* cell = edit_queue + (edit_dequeue_pos & (EDIT_QUEUE_SIZE - 1));
+	if ((unsigned int)SDL_AtomicGet(&cell->seq) != edit_dequeue_pos + 1)
+		return false;
+	*edit = cell->edit;
+	SDL_AtomicSet(&cell->seq, (int)(edit_dequeue_pos + EDIT_QUEUE_SIZE));
+	edit_dequeue_pos++;
+	return true;
+}
+
+// main thread convenience: flushes the queue if it is full
 void map_update_block(ivec3_t block, uint32_t value)
 {
-	size_t idx = block_by_coord(block);
+	while (!map_queue_edit(block, value))
+		map_apply_edits();
+}
+
+// mark the subchunks covering blocks y0..y1 of column (x, z) dirty,
+// including neighbours that sample these blocks for faces and light
+static
+void mark_blocks_dirty(int x, int z, int y0, int y1)
+{
+	int mx = block_in_chunk(x);
+	int mz = block_in_chunk(z);
+	int64_t cx = block_to_chunk(x);
+	int64_t cz = block_to_chunk(z);
+	int sy0 = ML_MAX(y0 - 1, 0) / CHUNK_SIZE;
+	int sy1 = ML_MIN(y1 + 1, MAP_BLOCK_HEIGHT - 1) / CHUNK_SIZE;
+	uint32_t bits = ((1u << (sy1 + 1)) - 1) & ~((1u << sy0) - 1);
+	int dx0 = (mx == 0) ? -1 : 0, dx1 = (mx == CHUNK_SIZE-1) ? 1 : 0;
+	int dz0 = (mz == 0) ? -1 : 0, dz1 = (mz == CHUNK_SIZE-1) ? 1 : 0;
+	for (int dz = dz0; dz <= dz1; ++dz) {
+		for (int dx = dx0; dx <= dx1; ++dx) {
+			game_chunk* chunk = cached_chunk_at(cx + dx, cz + dz);
+			if (chunk != NULL) {
+				chunk->dirty_mask |= bits;
+				if (chunk->state == CHUNK_MESHED)
+					chunk_set_state(chunk, CHUNK_DIRTY);
+			}
+		}
+	}
+}
 
-	// relight column down (fixes sunlight)
+// recompute sunlight down a column, returns false if nothing changed
+static
+bool relight_column(int x, int z, int* y0, int* y1)
+{
+	uint32_t* col = block_column(x, z);
 	uint32_t sunlight = SUNLIGHT_MASK;
-	map_blocks[idx] = value;
-	idx -= block.y;
-	for (int dy = MAP_BLOCK_HEIGHT-1; dy >= 0; --dy) {
-		uint32_t t = map_blocks[idx + dy];
+	int lo = MAP_BLOCK_HEIGHT, hi = -1;
+	for (int y = MAP_BLOCK_HEIGHT-1; y >= 0; --y) {
+		uint32_t t = col[y];
 		if ((t & 0xff) != BLOCK_AIR)
 			sunlight = 0;
-		map_blocks[idx + dy] = (t & NOSUNLIGHT_MASK) | sunlight;
+		uint32_t lit = (t & NOSUNLIGHT_MASK) | sunlight;
+		if (lit != t) {
+			col[y] = lit;
+			lo = y;
+			if (hi < 0)
+				hi = y;
+		}
 	}
 	// TODO: need to re-propagate light from lightsources affected by this change
+	*y0 = lo;
+	*y1 = hi;
+	return hi >= 0;
+}
 
-	chunkpos_t chunk = block_chunk(block);
-	bool tess[4] = { false, false, false, false };
-	int mx = block.x % CHUNK_SIZE;
-	int mz = block.z % CHUNK_SIZE;
-	if (mx == 0 || mx == -CHUNK_SIZE-1) {
-		tess[0] = true;
-	} else if (mx == -1 || mx == CHUNK_SIZE-1) {
-		tess[1] = true;
+size_t map_apply_edits()
+{
+	struct map_edit e;
+	size_t nedits = 0;
+
+	while (edit_ncolumns < EDIT_QUEUE_SIZE && edit_dequeue(&e)) {
+		chunkpos_t cp = block_chunk(e.block);
+		game_chunk* chunk = cached_chunk_at(cp.x, cp.z);
+		// outside the loaded area, the ring buffer holds some other chunk
+		if (chunk == NULL || e.block.y < 0 || e.block.y >= MAP_BLOCK_HEIGHT)
+			continue;
+		map_blocks[block_by_coord(e.block)] = e.value;
+		chunk->modified = true;
+		mark_blocks_dirty(e.block.x, e.block.z, e.block.y, e.block.y);
+		nedits++;
+
+		size_t bit = (size_t)(e.block.z & MAP_BLOCK_MASK) * MAP_BLOCK_WIDTH + (size_t)(e.block.x & MAP_BLOCK_MASK);
+		if ((edit_column_bits[bit >> 5] & (1u << (bit & 31))) == 0) {
+			edit_column_bits[bit >> 5] |= 1u << (bit & 31);
+			edit_columns[edit_ncolumns][0] = e.block.x;
+			edit_columns[edit_ncolumns][1] = e.block.z;
+			edit_ncolumns++;
+		}
 	}
-	if (mz == 0 || mz == -CHUNK_SIZE-1) {
-		tess[2] = true;
-	} else if (mz == -1 || mz == CHUNK_SIZE-1) {
-		tess[3] = true;
+
+	for (size_t i = 0; i < edit_ncolumns; ++i) {
+		int x = edit_columns[i][0], z = edit_columns[i][1], y0, y1;
+		if (relight_column(x, z, &y0, &y1))
+			mark_blocks_dirty(x, z, y0, y1);
+		size_t bit = (size_t)(z & MAP_BLOCK_MASK) * MAP_BLOCK_WIDTH + (size_t)(x & MAP_BLOCK_MASK);
+		edit_column_bits[bit >> 5] &= ~(1u << (bit & 31));
 	}
-	printf("reload chunk [%d, %d] [%d, %d]\n", chunk.x, chunk.z, mx, mz);
-	chunk_mark_dirty(chunk.x, chunk.z);
-	if (tess[0]) {
-		printf("reload chunk [%d, %d]\n", chunk.x-1, chunk.z);
-		chunk_mark_dirty(chunk.x-1, chunk.z);
+	edit_ncolumns = 0;
+	return nedits;
+}
+
+/*
+  Bulk edits: these write straight into the column spans of the ring
+  buffer, then relight each touched column once and dirty the
+  affected subchunks. Columns outside the loaded area are skipped.
+  Pending queued edits are applied first so they are ordered before
+  the bulk edit.
+ */
+
+// sort the corners of a box and clip it to the loaded ring around
+// map_chunk, so that work is bounded by the map and not by the box.
+// (ox, oy, oz) shifts the box to where it is written, which has to be
+// inside the map too. False if nothing is left.
+static
+bool normalize_box(ivec3_t* a, ivec3_t* b, int64_t ox, int64_t oy, int64_t oz)
+{
+	int64_t x0 = chunk_to_block(map_chunk.x - VIEW_DISTANCE);
+	int64_t x1 = chunk_to_block(map_chunk.x + VIEW_DISTANCE) - 1;
+	int64_t z0 = chunk_to_block(map_chunk.z - VIEW_DISTANCE);
+	int64_t z1 = chunk_to_block(map_chunk.z + VIEW_DISTANCE) - 1;
+	int64_t lo[3] = {
+		ML_MAX((int64_t)ML_MIN(a->x, b->x), ML_MAX(x0, x0 - ox)),
+		ML_MAX((int64_t)ML_MIN(a->y, b->y), ML_MAX(0, -oy)),
+		ML_MAX((int64_t)ML_MIN(a->z, b->z), ML_MAX(z0, z0 - oz))
+	};
+	int64_t hi[3] = {
+		ML_MIN((int64_t)ML_MAX(a->x, b->x), ML_MIN(x1, x1 - ox)),
+		ML_MIN((int64_t)ML_MAX(a->y, b->y), ML_MIN(MAP_BLOCK_HEIGHT-1, MAP_BLOCK_HEIGHT-1 - oy)),
+		ML_MIN((int64_t)ML_MAX(a->z, b->z), ML_MIN(z1, z1 - oz))
+	};
+	if (lo[0] > hi[0] || lo[1] > hi[1] || lo[2] > hi[2])
+		return false;
+	// inside the ring, so back in int range
+	a->x = (int)lo[0]; a->y = (int)lo[1]; a->z = (int)lo[2];
+	b->x = (int)hi[0]; b->y = (int)hi[1]; b->z = (int)hi[2];
+	return true;
+}
+
+static inline
+game_chunk* column_chunk(int x, int z)
+{
+	return cached_chunk_at(block_to_chunk(x), block_to_chunk(z));
+}
+
+// column (x, z) was written between y0 and y1
+static
+void finish_column(game_chunk* chunk, int x, int z, int y0, int y1)
+{
+	int ly0, ly1;
+	chunk->modified = true;
+	if (relight_column(x, z, &ly0, &ly1)) {
+		y0 = ML_MIN(y0, ly0);
+		y1 = ML_MAX(y1, ly1);
 	}
-	if (tess[1]) {
-		printf("reload chunk [%d, %d]\n", chunk.x+1, chunk.z);
-		chunk_mark_dirty(chunk.x+1, chunk.z);
+	mark_blocks_dirty(x, z, y0, y1);
+}
+
+size_t map_fill_box(ivec3_t a, ivec3_t b, uint32_t value)
+{
+	size_t count = 0;
+	map_apply_edits();
+	if (!normalize_box(&a, &b, 0, 0, 0))
+		return 0;
+	for (int z = a.z; z <= b.z; ++z) {
+		for (int x = a.x; x <= b.x; ++x) {
+			game_chunk* chunk = column_chunk(x, z);
+			if (chunk == NULL)
+				continue;
+			uint32_t* col = block_column(x, z);
+			for (int y = a.y; y <= b.y; ++y)
+				col[y] = value;
+			finish_column(chunk, x, z, a.y, b.y);
+			count += b.y - a.y + 1;
+		}
 	}
-	if (tess[2]) {
-		printf("reload chunk [%d, %d]\n", chunk.x, chunk.z-1);
-		chunk_mark_dirty(chunk.x, chunk.z-1);
+	return count;
+}
+
+// copy the box a-b so that its minimum corner lands on dst. The
+// source and destination may overlap.
+size_t map_copy_region(ivec3_t a, ivec3_t b, ivec3_t dst)
+{
+	size_t count = 0;
+	map_apply_edits();
+	int64_t dx = (int64_t)dst.x - ML_MIN(a.x, b.x);
+	int64_t dy = (int64_t)dst.y - ML_MIN(a.y, b.y);
+	int64_t dz = (int64_t)dst.z - ML_MIN(a.z, b.z);
+	// clipped against the destination as well, so the offsets fit in int
+	if (!normalize_box(&a, &b, dx, dy, dz))
+		return 0;
+	int ox = (int)dx, oy = (int)dy, oz = (int)dz;
+	int y0 = a.y, y1 = b.y;
+	// walk columns away from the destination so overlapping
+	// source columns are read before they are overwritten
+	int sx = (ox > 0) ? -1 : 1, sz = (oz > 0) ? -1 : 1;
+	int x0 = (sx > 0) ? a.x : b.x, z0 = (sz > 0) ? a.z : b.z;
+	int nx = b.x - a.x + 1, nz = b.z - a.z + 1;
+	for (int iz = 0; iz < nz; ++iz) {
+		int z = z0 + iz*sz;
+		for (int ix = 0; ix < nx; ++ix) {
+			int x = x0 + ix*sx;
+			game_chunk* chunk = column_chunk(x + ox, z + oz);
+			if (chunk == NULL || column_chunk(x, z) == NULL)
+				continue;
+			memmove(block_column(x + ox, z + oz) + y0 + oy, block_column(x, z) + y0,
+			        sizeof(uint32_t) * (y1 - y0 + 1));
+			finish_column(chunk, x + ox, z + oz, y0 + oy, y1 + oy);
+			count += y1 - y0 + 1;
+		}
 	}
-	if (tess[3]) {
-		printf("reload chunk [%d, %d]\n", chunk.x, chunk.z+1);
-		chunk_mark_dirty(chunk.x, chunk.z+1);
+	return count;
+}
+
+// replace every block of blocktype `from` in the box with value
+size_t map_replace_where(ivec3_t a, ivec3_t b, uint32_t from, uint32_t value)
+{
+	size_t count = 0;
+	map_apply_edits();
+	if (!normalize_box(&a, &b, 0, 0, 0))
+		return 0;
+	for (int z = a.z; z <= b.z; ++z) {
+		for (int x = a.x; x <= b.x; ++x) {
+			game_chunk* chunk = column_chunk(x, z);
+			if (chunk == NULL)
+				continue;
+			uint32_t* col = block_column(x, z);
+			int lo = MAP_BLOCK_HEIGHT, hi = -1;
+			for (int y = a.y; y <= b.y; ++y) {
+				if ((col[y] & 0xff) == from) {
+					col[y] = value;
+					lo = ML_MIN(lo, y);
+					hi = y;
+					count++;
+				}
+			}
+			if (hi >= 0)
+				finish_column(chunk, x, z, lo, hi);
+		}
 	}
+	return count;
+}
+
+static
+void parse_box(char** argv, ivec3_t* a, ivec3_t* b)
+{
+	a->x = atoi(argv[1]); a->y = atoi(argv[2]); a->z = atoi(argv[3]);
+	b->x = atoi(argv[4]); b->y = atoi(argv[5]); b->z = atoi(argv[6]);
+}
+
+static inline
+double ms_since(Uint64 start)
+{
+	return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static
+void map_fill_cmd(int argc, char** argv)
+{
+	ivec3_t a, b;
+	int type;
+	if (argc != 7 || (type = blocks_find(argv[7])) < 0) {
+		ui_console_printf("usage: fill x0 y0 z0 x1 y1 z1 <block>");
+		return;
+	}
+	parse_box(argv, &a, &b);
+	Uint64 start = SDL_GetPerformanceCounter();
+	size_t n = map_fill_box(a, b, (uint32_t)type);
+	ui_console_printf("filled %zu blocks in %.1f ms", n, ms_since(start));
+}
+
+static
+void map_copy_cmd(int argc, char** argv)
+{
+	ivec3_t a, b, dst;
+	if (argc != 9) {
+		ui_console_printf("usage: copy x0 y0 z0 x1 y1 z1 dx dy dz");
+		return;
+	}
+	parse_box(argv, &a, &b);
+	dst.x = atoi(argv[7]); dst.y = atoi(argv[8]); dst.z = atoi(argv[9]);
+	Uint64 start = SDL_GetPerformanceCounter();
+	size_t n = map_copy_region(a, b, dst);
+	ui_console_printf("copied %zu blocks in %.1f ms", n, ms_since(start));
+}
+
+static
+void map_replace_cmd(int argc, char** argv)
+{
+	ivec3_t a, b;
+	int from, to;
+	if (argc != 8 || (from = blocks_find(argv[7])) < 0 || (to = blocks_find(argv[8])) < 0) {
+		ui_console_printf("usage: replace x0 y0 z0 x1 y1 z1 <from> <to>");
+		return;
+	}
+	parse_box(argv, &a, &b);
+	Uint64 start = SDL_GetPerformanceCounter();
+	size_t n = map_replace_where(a, b, (uint32_t)from, (uint32_t)to);
+	ui_console_printf("replaced %zu blocks in %.1f ms", n, ms_since(start));
+}
+
+static inline
+ivec3_t native_pos(const struct script_value* argv)
+{
+	ivec3_t p = {
+		(int)floor(script_tonum(argv)),
+		(int)floor(script_tonum(argv + 1)),
+		(int)floor(script_tonum(argv + 2))
+	};
+	return p;
+}
+
+// block(x, y, z): block type at x, y, z
+static
+double map_block_native(int argc, const struct script_value* argv)
+{
+	ivec3_t p = native_pos(argv);
+	return blocktype(p.x, p.y, p.z);
+}
+
+// setblock(x, y, z, type)
+static
+double map_setblock_native(int argc, const struct script_value* argv)
+{
+	ivec3_t p = native_pos(argv);
+	double type = script_tonum(argv + 3);
+	if (type < 0 || type >= NUM_BLOCKTYPES || p.y < 0 || p.y >= MAP_BLOCK_HEIGHT)
+		return 0.0;
+	map_update_block(p, (uint32_t)type);
+	return 1.0;
+}
+
+// fillbox(x0, y0, z0, x1, y1, z1, type): number of blocks changed
+static
+double map_fillbox_native(int argc, const struct script_value* argv)
+{
+	double type = script_tonum(argv + 6);
+	if (type < 0 || type >= NUM_BLOCKTYPES)
+		return 0.0;
+	return (double)map_fill_box(native_pos(argv), native_pos(argv + 3), (uint32_t)type);
+}
+
+// blockid("stone"): block type by name, -1 if unknown
+static
+double map_blockid_native(int argc, const struct script_value* argv)
+{
+	char buf[32];
+	if (argv->type == SCRIPT_NUM) {
+		snprintf(buf, sizeof(buf), "%d", (int)argv->num);
+		return blocks_find(buf);
+	}
+	return blocks_find(argv->str);
+}
+
+static
+void map_natives_init()
+{
+	script_defnative("block", 3, map_block_native);
+	script_defnative("setblock", 4, map_setblock_native);
+	script_defnative("fillbox", 7, map_fillbox_native);
+	script_defnative("blockid", 1, map_blockid_native);
+}
+
+static uint8_t snapshot_buffer[CHUNK_SNAPSHOT_MAX_BYTES];
+
+// stash an edited chunk in the chunk store before its slot is reused
+static
+void chunk_store_ptr(game_chunk* chunk)
+{
+	size_t size = chunk_snapshot(chunk, snapshot_buffer);
+	chunkstore_put(chunk->x, chunk->z, snapshot_buffer, size);
+	chunk->modified = false;
 }
 
-// TODO: chunk saving/loading
 // TODO: asynchronous
-// as a test, just fill in the designated chunk
-// and tesselate the whole thing
+// edited chunks come back from the chunk store, everything
+// else from the generator (via the gencache)
 
-void chunk_load(int x, int z) {
-	int bufx = mod(x, MAP_CHUNK_WIDTH);
-	int bufz = mod(z, MAP_CHUNK_WIDTH);
+void chunk_load(int64_t x, int64_t z) {
+	int bufx = chunk_slot(x);
+	int bufz = chunk_slot(z);
 	game_chunk* chunk = game.map.chunks + (bufz*MAP_CHUNK_WIDTH + bufx);
+	if (chunk->modified)
+		chunk_store_ptr(chunk);
 	chunk->x = x;
 	chunk->z = z;
 	chunk_destroy_mesh_ptr(chunk);
-	gen_loadchunk(&game.map, chunk);
+	chunk_set_state(chunk, CHUNK_QUEUED);
+	chunk->mesh_verts = 0;
+	mapstats.chunks_loaded++;
+
+	Uint64 start = SDL_GetPerformanceCounter();
+	size_t size;
+	uint8_t* stored = chunkstore_take(x, z, &size);
+	if (stored != NULL) {
+		chunk->modified = chunk_restore(chunk, stored, size);
+		mem_free(stored);
+		if (chunk->modified) {
+			chunk->source = CHUNK_FROM_STORE;
+			chunk->load_ms = (float)ms_since(start);
+			return;
+		}
+		printf("chunk [%lld, %lld]: corrupt snapshot, regenerating\n", (long long)x, (long long)z);
+	}
+	chunk->source = gencache_load(&game.map, chunk) ? CHUNK_FROM_GENCACHE : CHUNK_FROM_GENERATOR;
+	chunk->load_ms = (float)ms_since(start);
+}
+
+size_t chunk_snapshot(game_chunk* chunk, uint8_t* dst)
+{
+	struct chunk_snapshot_header header;
+	uint8_t* p = dst + sizeof(header);
+	for (int z = 0; z < CHUNK_SIZE; ++z)
+		for (int x = 0; x < CHUNK_SIZE; ++x)
+			p += rle_encode(block_column((int)chunk_to_block(chunk->x) + x, (int)chunk_to_block(chunk->z) + z),
+			                MAP_BLOCK_HEIGHT, p);
+	header.magic = CHUNK_SNAPSHOT_MAGIC;
+	header.version = CHUNK_SNAPSHOT_VERSION;
+	header.height = MAP_BLOCK_HEIGHT;
+	header.x = (int32_t)chunk->x; // block coordinates are int, so chunks fit in 32 bits
+	header.z = (int32_t)chunk->z;
+	header.size = (uint32_t)(p - dst - sizeof(header));
+	memcpy(dst, &header, sizeof(header));
+	return p - dst;
+}
+
+bool chunk_restore(game_chunk* chunk, const uint8_t* src, size_t len)
+{
+	struct chunk_snapshot_header header;
+	if (len < sizeof(header))
+		return false;
+	memcpy(&header, src, sizeof(header));
+	if (header.magic != CHUNK_SNAPSHOT_MAGIC ||
+	    header.version != CHUNK_SNAPSHOT_VERSION ||
+	    header.height != MAP_BLOCK_HEIGHT ||
+	    header.x != chunk->x || header.z != chunk->z ||
+	    header.size > len - sizeof(header))
+		return false;
+
+	const uint8_t* p = src + sizeof(header);
+	const uint8_t* end = p + header.size;
+	for (int z = 0; z < CHUNK_SIZE; ++z) {
+		for (int x = 0; x < CHUNK_SIZE; ++x) {
+			size_t n = rle_decode(p, end - p,
+			                      block_column((int)chunk_to_block(chunk->x) + x, (int)chunk_to_block(chunk->z) + z),
+			                      MAP_BLOCK_HEIGHT);
+			if (n == 0)
+				return false;
+			p += n;
+		}
+	}
+	return true;
+}
+
+bool map_save(const char* filename)
+{
+	map_apply_edits();
+	for (size_t i = 0; i < MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH; ++i) {
+		game_chunk* chunk = game.map.chunks + i;
+		if (chunk->modified) {
+			size_t size = chunk_snapshot(chunk, snapshot_buffer);
+			chunkstore_put(chunk->x, chunk->z, snapshot_buffer, size);
+		}
+	}
+	return chunkstore_write(filename, game.map.seed);
+}
+
+bool map_load(const char* filename)
+{
+	uint64_t seed;
+	map_apply_edits();
+	if (!chunkstore_read(filename, &seed))
+		return false;
+	if (seed != game.map.seed) {
+		game.map.seed = seed;
+		simplex_init(seed);
+		opensimplex_init(seed);
+	}
+	for (size_t i = 0; i < MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH; ++i) {
+		game_chunk* chunk = game.map.chunks + i;
+		chunk->modified = false; // the loaded store replaces live edits
+		chunk_load(chunk->x, chunk->z);
+	}
+	return true;
+}
+
+static
+void map_save_cmd(int argc, char** argv)
+{
+	if (argc < 1) {
+		ui_console_printf("usage: save <file>");
+		return;
+	}
+	if (map_save(argv[1]))
+		ui_console_printf("saved %zu chunks (%zu kB) to %s",
+		                  chunkstore_count(), chunkstore_bytes() / 1024, argv[1]);
+	else
+		ui_console_printf("failed to save %s", argv[1]);
+}
+
+static
+void map_load_cmd(int argc, char** argv)
+{
+	if (argc < 1) {
+		ui_console_printf("usage: load <file>");
+		return;
+	}
+	if (map_load(argv[1]))
+		ui_console_printf("loaded %s, seed %llx", argv[1], (unsigned long long)game.map.seed);
+	else
+		ui_console_printf("failed to load %s", argv[1]);
+}
+
+// compression ratio and codec throughput over the chunks currently loaded
+static
+void map_rlebench_cmd(int argc, char** argv)
+{
+	static uint32_t columns[CHUNK_SIZE*CHUNK_SIZE*MAP_BLOCK_HEIGHT];
+	int rounds = (argc > 0) ? ML_MAX(1, atoi(argv[1])) : 4;
+	Uint64 enc_ticks = 0, dec_ticks = 0, start;
+	size_t raw = 0, packed = 0, mismatches = 0;
+
+	for (int r = 0; r < rounds; ++r) {
+		for (size_t i = 0; i < MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH; ++i) {
+			game_chunk* chunk = game.map.chunks + i;
+			size_t sizes[CHUNK_SIZE*CHUNK_SIZE];
+			uint8_t* p = snapshot_buffer;
+
+			start = SDL_GetPerformanceCounter();
+			for (int z = 0; z < CHUNK_SIZE; ++z)
+				for (int x = 0; x < CHUNK_SIZE; ++x) {
+					sizes[z*CHUNK_SIZE + x] = rle_encode(block_column((int)chunk_to_block(chunk->x) + x, (int)chunk_to_block(chunk->z) + z),
+					                                     MAP_BLOCK_HEIGHT, p);
+					p += sizes[z*CHUNK_SIZE + x];
+				}
+			enc_ticks += SDL_GetPerformanceCounter() - start;
+			raw += CHUNK_SIZE*CHUNK_SIZE*MAP_BLOCK_HEIGHT*sizeof(uint32_t);
+			packed += p - snapshot_buffer;
+
+			p = snapshot_buffer;
+			start = SDL_GetPerformanceCounter();
+			for (int c = 0; c < CHUNK_SIZE*CHUNK_SIZE; ++c) {
+				rle_decode(p, sizes[c], columns + c*MAP_BLOCK_HEIGHT, MAP_BLOCK_HEIGHT);
+				p += sizes[c];
+			}
+			dec_ticks += SDL_GetPerformanceCounter() - start;
+
+			for (int z = 0; z < CHUNK_SIZE; ++z)
+				for (int x = 0; x < CHUNK_SIZE; ++x)
+					if (memcmp(columns + (z*CHUNK_SIZE + x)*MAP_BLOCK_HEIGHT,
+					           block_column((int)chunk_to_block(chunk->x) + x, (int)chunk_to_block(chunk->z) + z),
+					           MAP_BLOCK_HEIGHT*sizeof(uint32_t)) != 0)
+						mismatches++;
+		}
+	}
+
+	double freq = (double)SDL_GetPerformanceFrequency();
+	double enc_s = (double)enc_ticks / freq;
+	double dec_s = (double)dec_ticks / freq;
+	ui_console_printf("rle: %.1f:1 (%zu -> %zu kB), encode %.2f GB/s, decode %.2f GB/s, %zu mismatches",
+	                  packed ? (double)raw / (double)packed : 0.0, raw / 1024, packed / 1024,
+	                  enc_s > 0.0 ? (double)raw / enc_s / 1e9 : 0.0,
+	                  dec_s > 0.0 ? (double)raw / dec_s / 1e9 : 0.0,
+	                  mismatches);
 }
 
 void chunk_destroy_mesh_ptr(game_chunk* chunk)
@@ -409,18 +1229,23 @@ void chunk_destroy_mesh_ptr(game_chunk* chunk)
 	for (int i = 0; i < MAP_CHUNK_HEIGHT; ++i)
 		m_destroy_mesh(chunk->solid + i);
 	m_destroy_mesh(&chunk->alpha);
+	mem_free(chunk->alpha_centers);
+	chunk->alpha_centers = NULL;
+	chunk->alpha_quads = 0;
 	chunk->dirty = true;
 }
 
 void chunk_mark_dirty_ptr(game_chunk* chunk)
 {
 	chunk->dirty = true;
+	if (chunk->state == CHUNK_MESHED)
+		chunk_set_state(chunk, CHUNK_DIRTY);
 }
 
-void chunk_mark_dirty(int x, int z)
+void chunk_mark_dirty(int64_t x, int64_t z)
 {
-	int bufx = mod(x, MAP_CHUNK_WIDTH);
-	int bufz = mod(z, MAP_CHUNK_WIDTH);
+	int bufx = chunk_slot(x);
+	int bufz = chunk_slot(z);
 	game_chunk* chunk = game.map.chunks + (bufz*MAP_CHUNK_WIDTH + bufx);
 	if (chunk->x != x || chunk->z != z)
 		return;
@@ -433,68 +1258,175 @@ void chunk_mark_dirty(int x, int z)
 //   3: fill vertices
 //   returns num verts in chunk
 
-#define ALPHA_BUFFER_SIZE (CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE*36)
-static block_vtx_t alpha_buffer[ALPHA_BUFFER_SIZE];
+// all buffers live in arena_job, which is reset for every chunk.
+// Solid faces go to one buffer per direction and are joined into
+// tesselation_buffer when the subchunk is done.
+static block_vtx_t* alpha_buffer;
+static size_t alpha_capacity;
+static block_vtx_t* tesselation_buffer;
+static size_t tesselation_capacity;
+static block_vtx_t* face_buffer[MAP_FACE_DIRS];
+static size_t face_capacity[MAP_FACE_DIRS];
+static size_t face_count[MAP_FACE_DIRS];
 
-#define TESSELATION_BUFFER_SIZE (CHUNK_SIZE*CHUNK_SIZE*CHUNK_SIZE*36)
-static block_vtx_t tesselation_buffer[TESSELATION_BUFFER_SIZE];
+static
+bool mesh_subchunk(mesh_t* mesh, uint32_t* faces, int bufx, int bufz, int cy, size_t* alphai);
 
 static
-bool mesh_subchunk(mesh_t* mesh, int bufx, int bufz, int cy, size_t* alphai);
+void mesh_job_begin()
+{
+	arena_reset(&arena_job);
+	alpha_buffer = tesselation_buffer = NULL;
+	alpha_capacity = tesselation_capacity = 0;
+	memset(face_buffer, 0, sizeof(face_buffer));
+	memset(face_capacity, 0, sizeof(face_capacity));
+}
 
 static
-vec3_t avg3(vec3_t a, vec3_t b, vec3_t c) {
-	vec3_t r = {
-		(a.x + b.x + c.x) * (1.f / 3.f),
-		(a.y + b.y + c.y) * (1.f / 3.f),
-		(a.z + b.z + c.z) * (1.f / 3.f)
-	};
-	return r;
-}
-
-static
-int cmp_alpha_faces(block_face_t* a, block_face_t* b)
-{
-	vec3_t ca = avg3(a->vtx[0].pos, a->vtx[1].pos, a->vtx[2].pos);
-	vec3_t cb = avg3(b->vtx[0].pos, b->vtx[1].pos, b->vtx[2].pos);
-	if (ca.y < cb.y)
-		return -1;
-	if (ca.y > cb.y)
-		return 1;
-	if (ca.x < cb.x)
-		return -1;
-	if (ca.x > cb.x)
-		return 1;
-	if (ca.z < cb.z)
-		return -1;
-	if (ca.z > cb.z)
-		return 1;
-	return 0;
+block_vtx_t* mesh_reserve(block_vtx_t** buffer, size_t* capacity, size_t n)
+{
+	if (n > *capacity) {
+		size_t cap = ML_MAX(n, ML_MAX(*capacity * 2, 8192));
+		*buffer = (block_vtx_t*)arena_grow(&arena_job, *buffer,
+		                                   *capacity * sizeof(block_vtx_t), cap * sizeof(block_vtx_t));
+		*capacity = cap;
+	}
+	return *buffer;
+}
+
+// room for one more quad facing dir, in the alpha buffer for alpha blocks
+static inline
+block_vtx_t* face_reserve(int dir, bool alpha, size_t* alphai)
+{
+	block_vtx_t* v;
+	if (alpha) {
+		v = mesh_reserve(&alpha_buffer, &alpha_capacity, *alphai + MESH_QUAD_VERTS) + *alphai;
+		*alphai += MESH_QUAD_VERTS;
+	} else {
+		v = mesh_reserve(face_buffer + dir, face_capacity + dir, face_count[dir] + MESH_QUAD_VERTS) + face_count[dir];
+		face_count[dir] += MESH_QUAD_VERTS;
+	}
+	return v;
+}
+
+static
+void chunk_build_alpha(game_chunk* chunk, size_t alphai)
+{
+	chunk->alpha_quads = 0;
+	if (alphai > 0) {
+		mesh_t* alpha = &(chunk->alpha);
+		size_t nquads = alphai / MESH_QUAD_VERTS;
+		mapstats.verts += alphai;
+		if (game.headless)
+			return;
+
+		// a quad is two triangles over a rectangle, so the mean of its six
+		// vertices is its center
+		chunk->alpha_quads = (uint32_t)nquads;
+		chunk->alpha_centers = mem_realloc(MEM_MESH, chunk->alpha_centers, nquads * 3 * sizeof(float));
+		for (size_t q = 0; q < nquads; ++q) {
+			const block_vtx_t* v = alpha_buffer + q*MESH_QUAD_VERTS;
+			vec3_t sum = { 0, 0, 0 };
+			for (int k = 0; k < MESH_QUAD_VERTS; ++k)
+				sum = m_vec3add(sum, v[k].pos);
+			chunk->alpha_centers[q*3] = sum.x / (float)MESH_QUAD_VERTS;
+			chunk->alpha_centers[q*3 + 1] = sum.y / (float)MESH_QUAD_VERTS;
+			chunk->alpha_centers[q*3 + 2] = sum.z / (float)MESH_QUAD_VERTS;
+		}
+
+		// emission order for now, the alpha pass sorts before the first draw
+		GLenum itype = (alphai <= 65536) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		void* indices = arena_alloc(&arena_job, alphai * (itype == GL_UNSIGNED_SHORT ? 2 : 4));
+		for (size_t i = 0; i < alphai; ++i) {
+			if (itype == GL_UNSIGNED_SHORT)
+				((uint16_t*)indices)[i] = (uint16_t)i;
+			else
+				((uint32_t*)indices)[i] = (uint32_t)i;
+		}
+		chunk->alpha_cell.x = INT32_MIN;
+
+		prof_begin(PROF_MAP_UPLOAD);
+		// the index buffer is re-sorted as the eye moves
+		m_create_indexed_mesh(alpha, alphai, alpha_buffer, alphai, itype, indices, ML_POS_3F | ML_TC_2UB | ML_CLR_4UB, GL_DYNAMIC_DRAW);
+		prof_end(PROF_MAP_UPLOAD);
+		m_set_material(alpha, game.materials + MAT_CHUNK_ALPHA);
+	}
+}
+
+static
+void chunk_mesh_done(game_chunk* chunk, size_t alphai, Uint64 start)
+{
+	uint32_t verts = (uint32_t)alphai;
+	for (int y = 0; y < MAP_CHUNK_HEIGHT; ++y)
+		verts += chunk->faces[y][MAP_FACE_DIRS];
+	chunk->mesh_verts = verts;
+	chunk->mesh_ms = (float)ms_since(start);
+	chunk_set_state(chunk, CHUNK_MESHED);
+}
+
+// remesh only the subchunks in dirty_mask. The alpha mesh covers the
+// whole chunk, so alpha faces from clean subchunks are regenerated
+// too (without rebuilding their solid meshes).
+static
+void chunk_update_mesh_ptr(int bufx, int bufz, game_chunk* chunk)
+{
+	Uint64 start = SDL_GetPerformanceCounter();
+	uint32_t dirty = chunk->dirty_mask;
+	bool alpha = (dirty & chunk->alpha_mask) != 0;
+	size_t alphai = 0;
+	chunk->dirty_mask = 0;
+	mapstats.chunks_meshed++;
+	mesh_job_begin();
+	for (int y = 0; y < MAP_CHUNK_HEIGHT; ++y) {
+		size_t prev = alphai;
+		if (dirty & (1u << y)) {
+			m_destroy_mesh(chunk->solid + y);
+			mesh_subchunk(chunk->solid + y, chunk->faces[y], bufx, bufz, y, &alphai);
+		} else if (chunk->alpha_mask & (1u << y)) {
+			mesh_subchunk(NULL, NULL, bufx, bufz, y, &alphai);
+		}
+		if (alphai > prev)
+			chunk->alpha_mask |= 1u << y;
+		else if (dirty & (1u << y))
+			chunk->alpha_mask &= ~(1u << y);
+	}
+	if (alpha || alphai > 0) {
+		m_destroy_mesh(&chunk->alpha);
+		chunk_build_alpha(chunk, alphai);
+	}
+	chunk_mesh_done(chunk, alphai, start);
 }
 
 void chunk_build_mesh_ptr(int bufx, int bufz, game_chunk* chunk)
 {
-	if (!chunk->dirty)
+	if (!chunk->dirty) {
+		if (chunk->dirty_mask)
+			chunk_update_mesh_ptr(bufx, bufz, chunk);
 		return;
+	}
+	Uint64 start = SDL_GetPerformanceCounter();
 	chunk_destroy_mesh_ptr(chunk);
 	chunk->dirty = false;
+	chunk->dirty_mask = 0;
+	chunk->alpha_mask = 0;
 	size_t alphai = 0;
 	mesh_t* mesh = chunk->solid;
-	for (int y = 0; y < MAP_CHUNK_HEIGHT; ++y)
-		mesh_subchunk(mesh + y, bufx, bufz, y, &alphai);
-	if (alphai > 0) {
-		mesh_t* alpha = &(chunk->alpha);
-		size_t nalphafaces = (alphai/3);
-		qsort(alpha_buffer, nalphafaces, sizeof(block_face_t), (int(*)(const void*, const void*))cmp_alpha_faces);
-		m_create_mesh(alpha, alphai, alpha_buffer, ML_POS_3F | ML_TC_2US | ML_CLR_4UB, GL_DYNAMIC_DRAW);
-		m_set_material(alpha, game.materials + MAT_CHUNK_ALPHA);
+	mapstats.chunks_meshed++;
+	mesh_job_begin();
+	for (int y = 0; y < MAP_CHUNK_HEIGHT; ++y) {
+		size_t prev = alphai;
+		mesh_subchunk(mesh + y, chunk->faces[y], bufx, bufz, y, &alphai);
+		if (alphai > prev)
+			chunk->alpha_mask |= 1u << y;
 	}
+	chunk_build_alpha(chunk, alphai);
+	chunk_mesh_done(chunk, alphai, start);
 }
 
-void chunk_build_mesh(int x, int z)
+void chunk_build_mesh(int64_t x, int64_t z)
 {
-	int bufx = mod(x, MAP_CHUNK_WIDTH);
-	int bufz = mod(z, MAP_CHUNK_WIDTH);
+	int bufx = chunk_slot(x);
+	int bufz = chunk_slot(z);
 	game_chunk* chunk = game.map.chunks + bufz*MAP_CHUNK_WIDTH + bufx;
 	if (chunk->x != x || chunk->z != z)
 		return;
@@ -556,6 +1488,27 @@ uint32_t avglight(uint32_t b0, uint32_t b1, uint32_t b2, uint32_t b3)
 #define GETCOL(np, ng, x, y, z) memcpy(n + (np), map_blocks + block_index(bx + (x), by + (y), bz + (z)), sizeof(uint32_t) * (ng))
 #define FLIPCHECK() ((corners[0].clr>>24) + (corners[2].clr>>24) > (corners[1].clr>>24) + (corners[3].clr>>24))
 
+// two triangles, split along the diagonal that interpolates light best
+static inline
+void emit_quad(block_vtx_t* verts, const block_vtx_t* corners)
+{
+	if (FLIPCHECK()) {
+		verts[0] = corners[0];
+		verts[1] = corners[1];
+		verts[2] = corners[2];
+		verts[3] = corners[2];
+		verts[4] = corners[3];
+		verts[5] = corners[0];
+	} else {
+		verts[0] = corners[0];
+		verts[1] = corners[1];
+		verts[2] = corners[3];
+		verts[3] = corners[3];
+		verts[4] = corners[1];
+		verts[5] = corners[2];
+	}
+}
+
 // n array layout:
 //+y       +y       +y
 // \ 02 05 08  | 11 14 17  | 20 23 26
@@ -565,15 +1518,15 @@ uint32_t avglight(uint32_t b0, uint32_t b1, uint32_t b2, uint32_t b3)
 //  (iz-1)   (iz)     (iz+1)
 
 
-bool mesh_subchunk(mesh_t* mesh, int bufx, int bufz, int cy, size_t* alphai)
+bool mesh_subchunk(mesh_t* mesh, uint32_t* faces, int bufx, int bufz, int cy, size_t* alphai)
 {
 	int ix, iy, iz;
 	int bx, by, bz;
 	size_t vi;
 	block_vtx_t* verts;
+	bool alpha;
 
-	verts = tesselation_buffer;
-	vi = 0;
+	memset(face_count, 0, sizeof(face_count));
 	bx = bufx*CHUNK_SIZE;
 	by = cy*CHUNK_SIZE;
 	bz = bufz*CHUNK_SIZE;
@@ -583,7 +1536,6 @@ bool mesh_subchunk(mesh_t* mesh, int bufx, int bufz, int cy, size_t* alphai)
 	uint32_t t;
 	uint32_t n[27]; // blocktypes for a 3x3 cube around this block
 	int density;
-	size_t save_vi = 0;
 
 	// fill in verts
 	for (iz = 0; iz < CHUNK_SIZE; ++iz) {
@@ -601,11 +1553,7 @@ bool mesh_subchunk(mesh_t* mesh, int bufx, int bufz, int cy, size_t* alphai)
 						continue;
 				}
 
-				if (blockinfo[t].flags & BLOCK_ALPHA) {
-					save_vi = vi;
-					verts = alpha_buffer;
-					vi = *alphai;
-				}
+				alpha = (blockinfo[t].flags & BLOCK_ALPHA) != 0;
 
 				if (by+iy+1 >= MAP_BLOCK_HEIGHT) {
 					n[2] = n[5] = n[8] = n[11] = n[14] = n[17] = n[20] = n[23] = n[26] = (SUNLIGHT_MASK|BLOCK_AIR);
@@ -643,167 +1591,107 @@ bool mesh_subchunk(mesh_t* mesh, int bufx, int bufz, int cy, size_t* alphai)
 
 				if (BNONSOLID(14)) {
 					assert((n[14]&0xff) != (n[13]&0xff));
-					const tc2us_t* tc = &BLOCKTC(t, BLOCK_TEX_TOP, 0);
+					const tclayer_t* tc = &BLOCKTC(t, BLOCK_TEX_TOP, 0);
 					block_vtx_t corners[4];
 					corners[0].pos = POS(  ix, by+iy+1, iz+1), corners[0].tc = tc[0], corners[0].clr = BLOCKLIGHT(20,23,11,14,10,19,22);
 					corners[1].pos = POS(ix+1, by+iy+1, iz+1), corners[1].tc = tc[1], corners[1].clr = BLOCKLIGHT(23,26,14,17,16,22,25);
 					corners[2].pos = POS(ix+1, by+iy+1,   iz), corners[2].tc = tc[2], corners[2].clr = BLOCKLIGHT( 5, 8,14,17,4,7,16);
 					corners[3].pos = POS(  ix, by+iy+1,   iz), corners[3].tc = tc[3], corners[3].clr = BLOCKLIGHT( 2, 5,11,14,1,4,10);
-					if (FLIPCHECK()) {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[0];
-					} else {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-					}
+					emit_quad(face_reserve(BLOCK_TEX_TOP, alpha, alphai), corners);
 				}
 				if (BNONSOLID(12)) {
-					const tc2us_t* tc = &BLOCKTC(t, BLOCK_TEX_BOTTOM, 0);
+					const tclayer_t* tc = &BLOCKTC(t, BLOCK_TEX_BOTTOM, 0);
 					block_vtx_t corners[4];
 					corners[0].pos = POS(  ix, by+iy,   iz), corners[0].tc = tc[0], corners[0].clr = BLOCKLIGHT( 0, 3, 9,12,1,4,10);
 					corners[1].pos = POS(ix+1, by+iy,   iz), corners[1].tc = tc[1], corners[1].clr = BLOCKLIGHT( 3, 6,12,15,4,7,16);
 					corners[2].pos = POS(ix+1, by+iy, iz+1), corners[2].tc = tc[2], corners[2].clr = BLOCKLIGHT(12,15,21,24,16,22,25);
 					corners[3].pos = POS(  ix, by+iy, iz+1), corners[3].tc = tc[3], corners[3].clr = BLOCKLIGHT( 9,12,18,21,10,19,22);
-					if (FLIPCHECK()) {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[0];
-					} else {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-					}
+					emit_quad(face_reserve(BLOCK_TEX_BOTTOM, alpha, alphai), corners);
 				}
 				if (BNONSOLID(10)) {
-					const tc2us_t* tc = &BLOCKTC(t, BLOCK_TEX_LEFT, 0);
+					const tclayer_t* tc = &BLOCKTC(t, BLOCK_TEX_LEFT, 0);
 					block_vtx_t corners[4];
 					corners[0].pos = POS(ix,   by+iy,   iz), corners[0].tc = tc[0], corners[0].clr = BLOCKLIGHT( 0, 1, 9,10,3,4,12);
 					corners[1].pos = POS(ix,   by+iy, iz+1), corners[1].tc = tc[1], corners[1].clr = BLOCKLIGHT( 9,10,18,19,12,21,22);
 					corners[2].pos = POS(ix, by+iy+1, iz+1), corners[2].tc = tc[2], corners[2].clr = BLOCKLIGHT(10,11,19,20,14,22,23);
 					corners[3].pos = POS(ix, by+iy+1,   iz), corners[3].tc = tc[3], corners[3].clr = BLOCKLIGHT( 1, 2,10,11,4,5,14);
-					if (FLIPCHECK()) {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[0];
-					} else {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-					}
+					emit_quad(face_reserve(BLOCK_TEX_LEFT, alpha, alphai), corners);
 				}
 				if (BNONSOLID(16)) {
-					const tc2us_t* tc = &BLOCKTC(t, BLOCK_TEX_RIGHT, 0);
+					const tclayer_t* tc = &BLOCKTC(t, BLOCK_TEX_RIGHT, 0);
 					block_vtx_t corners[4];
 					corners[0].pos = POS(ix+1,   by+iy, iz+1), corners[0].tc = tc[0], corners[0].clr = BLOCKLIGHT(15,16,24,25,12,21,22);
 					corners[1].pos = POS(ix+1,   by+iy,   iz), corners[1].tc = tc[1], corners[1].clr = BLOCKLIGHT( 6, 7,15,16,3,4,12);
 					corners[2].pos = POS(ix+1, by+iy+1,   iz), corners[2].tc = tc[2], corners[2].clr = BLOCKLIGHT( 7, 8,16,17,4,5,14);
 					corners[3].pos = POS(ix+1, by+iy+1, iz+1), corners[3].tc = tc[3], corners[3].clr = BLOCKLIGHT(16,17,25,26,14,22,23);
-					if (FLIPCHECK()) {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[0];
-					} else {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-					}
+					emit_quad(face_reserve(BLOCK_TEX_RIGHT, alpha, alphai), corners);
 				}
 				if (BNONSOLID(22)) {
-					tc2us_t* tc = &BLOCKTC(t, BLOCK_TEX_FRONT, 0);
+					const tclayer_t* tc = &BLOCKTC(t, BLOCK_TEX_FRONT, 0);
 					block_vtx_t corners[4];
 					corners[0].pos = POS(  ix,   by+iy, iz+1), corners[0].tc = tc[0], corners[0].clr = BLOCKLIGHT(18,19,21,22,9,10,12);
 					corners[1].pos = POS(ix+1,   by+iy, iz+1), corners[1].tc = tc[1], corners[1].clr = BLOCKLIGHT(21,22,24,25,12,15,16);
 					corners[2].pos = POS(ix+1, by+iy+1, iz+1), corners[2].tc = tc[2], corners[2].clr = BLOCKLIGHT(22,23,25,26,14,16,17);
 					corners[3].pos = POS(  ix, by+iy+1, iz+1), corners[3].tc = tc[3], corners[3].clr = BLOCKLIGHT(19,20,22,23,10,11,14);
-					if (FLIPCHECK()) {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[0];
-					} else {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-					}
+					emit_quad(face_reserve(BLOCK_TEX_FRONT, alpha, alphai), corners);
 				}
 				if (BNONSOLID(4)) {
-					const tc2us_t* tc = &BLOCKTC(t, BLOCK_TEX_BACK, 0);
+					const tclayer_t* tc = &BLOCKTC(t, BLOCK_TEX_BACK, 0);
 					block_vtx_t corners[4];
 					corners[0].pos = POS(ix+1,   by+iy, iz), corners[0].tc = tc[0], corners[0].clr = BLOCKLIGHT( 3, 4, 6, 7,12,15,16);
 					corners[1].pos = POS(  ix,   by+iy, iz), corners[1].tc = tc[1], corners[1].clr = BLOCKLIGHT( 0, 1, 3, 4,9,10,12);
 					corners[2].pos = POS(  ix, by+iy+1, iz), corners[2].tc = tc[2], corners[2].clr = BLOCKLIGHT( 1, 2, 4, 5,10,11,14);
 					corners[3].pos = POS(ix+1, by+iy+1, iz), corners[3].tc = tc[3], corners[3].clr = BLOCKLIGHT( 4, 5, 7, 8,14,16,17);
-					if (FLIPCHECK()) {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[2];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[0];
-					} else {
-						verts[vi++] = corners[0];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[3];
-						verts[vi++] = corners[1];
-						verts[vi++] = corners[2];
-					}
-				}
-
-				if (blockinfo[t].flags & BLOCK_ALPHA) {
-					if (vi > ALPHA_BUFFER_SIZE)
-						fatal_error("Alpha buffer too small for chunk (%d, %d, %d): %zu verts, %zu blocks processed", bufx, cy, bufz, vi, nprocessed);
-					*alphai = vi;
-					vi = save_vi;
-					verts = tesselation_buffer;
+					emit_quad(face_reserve(BLOCK_TEX_BACK, alpha, alphai), corners);
 				}
 
 				++nprocessed;
-
-				if (vi > TESSELATION_BUFFER_SIZE)
-					fatal_error("Tesselation buffer too small for chunk (%d, %d, %d): %zu verts, %zu blocks processed", bufx, cy, bufz, vi, nprocessed);
 			}
 		}
 	}
 
-	if (vi > 0) {
-		m_create_mesh(mesh, vi, verts, ML_POS_3F | ML_TC_2US | ML_CLR_4UB, GL_STATIC_DRAW);
+	if (mesh == NULL)
+		return false;
+
+	// one buffer with the direction ranges back to back
+	vi = 0;
+	for (int d = 0; d < MAP_FACE_DIRS; ++d)
+		vi += face_count[d];
+	verts = mesh_reserve(&tesselation_buffer, &tesselation_capacity, ML_MAX(vi, 1));
+	vi = 0;
+	for (int d = 0; d < MAP_FACE_DIRS; ++d) {
+		faces[d] = (uint32_t)vi;
+		if (face_count[d] > 0)
+			memcpy(verts + vi, face_buffer[d], face_count[d] * sizeof(block_vtx_t));
+		vi += face_count[d];
+	}
+	faces[MAP_FACE_DIRS] = (uint32_t)vi;
+
+	mapstats.subchunks_meshed++;
+	mapstats.verts += vi;
+	if (vi > 0 && !game.headless) {
+		prof_begin(PROF_MAP_UPLOAD);
+		m_create_mesh(mesh, vi, verts, ML_POS_3F | ML_TC_2UB | ML_CLR_4UB, GL_STATIC_DRAW);
+		prof_end(PROF_MAP_UPLOAD);
 		m_set_material(mesh, game.materials + MAT_CHUNK);
 	}
 	return (vi > 0);
 }
 
+const struct map_stats* map_stats()
+{
+	return &mapstats;
+}
+
+size_t map_dirty_chunks()
+{
+	size_t n = 0;
+	for (size_t i = 0; i < MAP_CHUNK_WIDTH*MAP_CHUNK_WIDTH; ++i)
+		if (game.map.chunks[i].dirty || game.map.chunks[i].dirty_mask)
+			++n;
+	return n;
+}
+
 bool map_raycast(dvec3_t origin, vec3_t dir, int len, ivec3_t* hit, ivec3_t* prehit)
 {
 	dvec3_t blockf = { origin.x, origin.y, origin.z };
@@ -9,8 +9,11 @@
  */
 
 #include "blocks.h"
+#include "rle.h"
 
 #define CHUNK_SIZE 16
+#define CHUNK_SHIFT 4 // log2(CHUNK_SIZE)
+#define CHUNK_MASK (CHUNK_SIZE - 1)
 #define MAX_SUBCHUNKS 64 // allow chunks populated across 1km (!)
 #define CHUNK_SIZE_STR(s) CHUNK_SIZE_STR_2(s)
 #define CHUNK_SIZE_STR_2(s) #s
@@ -21,18 +24,32 @@
 #define MAP_BLOCK_WIDTH (MAP_CHUNK_WIDTH*CHUNK_SIZE)
 #define MAP_BLOCK_HEIGHT (MAP_CHUNK_HEIGHT*CHUNK_SIZE)
 #define MAP_BUFFER_SIZE (MAP_BLOCK_WIDTH*MAP_BLOCK_WIDTH*MAP_BLOCK_HEIGHT)
+#define MAP_CHUNK_MASK (MAP_CHUNK_WIDTH - 1)
+#define MAP_BLOCK_MASK (MAP_BLOCK_WIDTH - 1)
+#define CHUNK_SNAPSHOT_MAX_BYTES (sizeof(struct chunk_snapshot_header) + \
+                                  CHUNK_SIZE*CHUNK_SIZE*RLE_MAX_BYTES(MAP_BLOCK_HEIGHT))
+
+#if (1 << CHUNK_SHIFT) != CHUNK_SIZE
+#error "CHUNK_SHIFT does not match CHUNK_SIZE"
+#endif
+#if (MAP_CHUNK_WIDTH & MAP_CHUNK_MASK) != 0
+#error "the map ring buffer is indexed by masking, MAP_CHUNK_WIDTH must be a power of two"
+#endif
 
 #pragma pack(push, 1)
 
-typedef struct tc2us_t {
-	uint16_t u;
-	uint16_t v;
-} tc2us_t;
+// blocks sample a texture array: the layer is the tile, the corner
+// (0-3) picks the uv in the shader
+typedef struct tclayer_t {
+	uint8_t layer;
+	uint8_t corner;
+	uint16_t unused; // keeps clr 4-byte aligned
+} tclayer_t;
 
 typedef struct block_vtx_t {
 	vec3_t pos;
 //	uint32_t n; // normal + extra uint8 value (water depth?)
-	tc2us_t tc;
+	tclayer_t tc;
 	uint32_t clr;
 } block_vtx_t;
 
@@ -42,6 +59,21 @@ typedef struct block_face_t {
 
 #pragma pack(pop)
 
+// chunk snapshot: header followed by the RLE-encoded columns of the
+// chunk, z-major. Used for the chunk store, save files and anything
+// else that needs to move a chunk around.
+#define CHUNK_SNAPSHOT_MAGIC 0x4b434d52 // "RMCK"
+#define CHUNK_SNAPSHOT_VERSION 1
+
+struct chunk_snapshot_header {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t height;
+	int32_t x;
+	int32_t z;
+	uint32_t size; // bytes of column data following the header
+};
+
 enum ChunkGenState {
 	CHUNK_GEN_S0, /* no blocks generated for this chunk yet */
 	CHUNK_GEN_S1, /* base terrain blocks generated */
@@ -56,6 +88,27 @@ enum ChunkMeshState {
 	CHUNK_MESH_S3
 };
 
+// where a chunk is in the load -> mesh pipeline, shown by the
+// chunkviz overlay. Loading (generation and lighting) and meshing
+// (including the upload) run to completion inside map_tick, so these
+// are the states a chunk can be seen in between frames; the time
+// spent in each step is kept in load_ms and mesh_ms.
+enum ChunkState {
+	CHUNK_EMPTY, /* slot not loaded yet */
+	CHUNK_QUEUED, /* blocks loaded, waiting for its first mesh */
+	CHUNK_MESHED, /* meshes uploaded */
+	CHUNK_DIRTY, /* meshed, waiting for a remesh after an edit or neighbour load */
+	NUM_CHUNK_STATES
+};
+
+// where the blocks of a chunk came from
+enum ChunkSource {
+	CHUNK_FROM_GENERATOR,
+	CHUNK_FROM_GENCACHE,
+	CHUNK_FROM_STORE,
+	NUM_CHUNK_SOURCES
+};
+
 enum ChunkFlags {
 	BLOCK_CHANGED,
 };
@@ -64,10 +117,17 @@ typedef struct game_subchunk {
 	uint32_t block[CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE];
 } game_subchunk;
 
+// solid subchunk meshes keep their faces grouped by direction, in
+// BLOCK_TEX_* order (top, bottom, left, right, front, back)
+#define MAP_FACE_DIRS 6
+
 typedef struct game_chunk {
-	int x; // actual coordinates of chunk
-	int z;
+	int64_t x; // actual coordinates of chunk
+	int64_t z;
 	bool dirty;
+	bool modified; // edited since generated, kept in the chunk store when evicted
+	uint32_t dirty_mask; // subchunks to remesh, dirty means all of them
+	uint32_t alpha_mask; // subchunks contributing faces to the alpha mesh
 	uint32_t genstate;
 	uint32_t meshstate;
 	int offset_y;
@@ -75,8 +135,22 @@ typedef struct game_chunk {
 	uint32_t subchunks[MAX_SUBCHUNKS]; // number of 16x16x16 subchunks
 	// can have special subchunk indices for special subchunk types (all-air, all-solid...)
 	mesh_t solid[MAP_CHUNK_HEIGHT]; // a solid mesh for each subchunk
+	// first vertex of each direction range in solid[y], faces[y][MAP_FACE_DIRS] is the vertex count
+	uint32_t faces[MAP_CHUNK_HEIGHT][MAP_FACE_DIRS + 1];
 	mesh_t alpha;
+	// alpha faces are sorted back to front through the index buffer,
+	// again only when the eye moves to another block (alpha_cell)
+	float* alpha_centers; // xyz per alpha quad, chunk-local
+	uint32_t alpha_quads;
+	ivec3_t alpha_cell;
 	mesh_t sprite; // render twosided (same shader as solid meshes but different render state)
+	// pipeline tracking for the chunkviz overlay
+	uint8_t state; // ChunkState
+	uint8_t source; // ChunkSource
+	uint32_t mesh_verts; // solid + alpha vertices of the last mesh
+	float load_ms;
+	float mesh_ms; // last full or partial remesh
+	uint64_t state_frame; // game.stats.frames when state last changed
 	// add per-chunk state information here (things like command blocks..., entities?)
 } game_chunk;
 
@@ -101,29 +175,73 @@ struct game_map {
 	unsigned long seed;
 };
 
+// counters for benchmark reports, never reset
+struct map_stats {
+	uint64_t chunks_loaded;
+	uint64_t chunks_meshed; // full or partial remesh
+	uint64_t subchunks_meshed;
+	uint64_t verts;
+	uint64_t verts_drawn; // solid vertices submitted by map_draw
+	uint64_t verts_culled; // solid vertices skipped as back-facing
+};
+
 extern uint32_t* map_blocks;
 
-void map_init(void);
+void map_init(uint64_t seed);
 void map_exit(void);
 void map_tick(void);
 void map_draw(frustum_t* frustum);
 void map_draw_alphapass(void);
-void chunk_load(int x, int z);
-void chunk_mark_dirty(int x, int z);
+void chunk_load(int64_t x, int64_t z);
+void chunk_mark_dirty(int64_t x, int64_t z);
 void chunk_build_mesh_ptr(int bufx, int bufz, game_chunk* chunk);
-void chunk_build_mesh(int x, int z);
+void chunk_build_mesh(int64_t x, int64_t z);
 void map_update_block(ivec3_t block, uint32_t value);
+bool map_queue_edit(ivec3_t block, uint32_t value);
+size_t map_apply_edits(void);
+size_t map_fill_box(ivec3_t a, ivec3_t b, uint32_t value);
+size_t map_copy_region(ivec3_t a, ivec3_t b, ivec3_t dst);
+size_t map_replace_where(ivec3_t a, ivec3_t b, uint32_t from, uint32_t value);
+bool map_save(const char* filename);
+bool map_load(const char* filename);
+size_t chunk_snapshot(game_chunk* chunk, uint8_t* dst);
+bool chunk_restore(game_chunk* chunk, const uint8_t* src, size_t len);
 bool map_raycast(dvec3_t origin, vec3_t dir, int len, ivec3_t* hit, ivec3_t* prehit);
 uint32_t block_at(int x, int y, int z);
+const struct map_stats* map_stats(void);
+size_t map_dirty_chunks(void); // waiting to be (re)meshed
 
 
-// mod which handles negative numbers
+/*
+  Block <-> chunk conversion without division. The arithmetic right
+  shift floors towards negative infinity and the mask gives the
+  matching non-negative remainder, so negative coordinates need no
+  special casing. Chunk coordinates are 64-bit; block coordinates
+  are int and stay inside the range addressable by ivec3_t.
+ */
+static inline
+int64_t block_to_chunk(int64_t block)
+{
+	return block >> CHUNK_SHIFT;
+}
+
+static inline
+int block_in_chunk(int64_t block)
+{
+	return (int)(block & CHUNK_MASK);
+}
+
+static inline
+int64_t chunk_to_block(int64_t chunk)
+{
+	return chunk * CHUNK_SIZE;
+}
+
+// slot of a chunk in the map ring buffer, along one axis
 static inline
-int mod(int a, int b)
+int chunk_slot(int64_t chunk)
 {
-	if (b < 0) { a = -a; b = -b; }
-	int ret = a % b;
-	return (ret < 0) ? ret + b : ret;
+	return (int)(chunk & MAP_CHUNK_MASK);
 }
 
 
@@ -140,8 +258,8 @@ uint32_t packvec_1010102(unsigned int x, unsigned int y, unsigned int z, unsigne
 static inline
 size_t block_index(int x, int y, int z)
 {
-	return mod(z, MAP_BLOCK_WIDTH) * (MAP_BLOCK_WIDTH * MAP_BLOCK_HEIGHT) +
-		mod(x, MAP_BLOCK_WIDTH) * MAP_BLOCK_HEIGHT +
+	return (size_t)(z & MAP_BLOCK_MASK) * (MAP_BLOCK_WIDTH * MAP_BLOCK_HEIGHT) +
+		(size_t)(x & MAP_BLOCK_MASK) * MAP_BLOCK_HEIGHT +
 		y;
 }
 
@@ -150,8 +268,8 @@ static inline
 uint32_t* block_column(int x, int z)
 {
 	return map_blocks +
-		mod(z, MAP_BLOCK_WIDTH) * (MAP_BLOCK_WIDTH * MAP_BLOCK_HEIGHT) +
-		mod(x, MAP_BLOCK_WIDTH) * MAP_BLOCK_HEIGHT;
+		(size_t)(z & MAP_BLOCK_MASK) * (MAP_BLOCK_WIDTH * MAP_BLOCK_HEIGHT) +
+		(size_t)(x & MAP_BLOCK_MASK) * MAP_BLOCK_HEIGHT;
 }
 
 
@@ -179,8 +297,7 @@ uint32_t blocktype_by_coord(ivec3_t xyz)
 static inline
 chunkpos_t block_chunk(ivec3_t block)
 {
-	chunkpos_t c = { floor(round(block.x) / CHUNK_SIZE),
-	               floor(round(block.z) / CHUNK_SIZE) };
+	chunkpos_t c = { block_to_chunk(block.x), block_to_chunk(block.z) };
 	return c;
 }
 
@@ -1,5 +1,9 @@
 #include "common.h"
 #include "math3d.h"
+#include "mem.h"
+#if ML_SSE
+#include <emmintrin.h>
+#endif
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image.h"
@@ -211,6 +215,61 @@ int collide_frustum_aabb_y(frustum_t* frustum, vec3_t center, vec3_t extent)
 	return result;
 }
 
+size_t collide_frustum_aabb_batch(const frustum_t* frustum, const aabb_soa_t* boxes, uint32_t* visible)
+{
+	size_t i = 0, nvisible = 0;
+#if ML_SSE
+	__m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6], aw[6];
+	const __m128 zero = _mm_setzero_ps();
+	for (int k = 0; k < 6; ++k) {
+		px[k] = _mm_set1_ps(frustum->planes[k].x);
+		py[k] = _mm_set1_ps(frustum->planes[k].y);
+		pz[k] = _mm_set1_ps(frustum->planes[k].z);
+		pw[k] = _mm_set1_ps(frustum->planes[k].w);
+		ax[k] = _mm_set1_ps(frustum->absplanes[k].x);
+		ay[k] = _mm_set1_ps(frustum->absplanes[k].y);
+		az[k] = _mm_set1_ps(frustum->absplanes[k].z);
+		aw[k] = _mm_set1_ps(frustum->absplanes[k].w);
+	}
+	for (; i + 4 <= boxes->n; i += 4) {
+		__m128 cx = _mm_loadu_ps(boxes->cx + i);
+		__m128 cy = _mm_loadu_ps(boxes->cy + i);
+		__m128 cz = _mm_loadu_ps(boxes->cz + i);
+		__m128 ex = _mm_loadu_ps(boxes->ex + i);
+		__m128 ey = _mm_loadu_ps(boxes->ey + i);
+		__m128 ez = _mm_loadu_ps(boxes->ez + i);
+		__m128 outside = zero;
+		for (int k = 0; k < 6; ++k) {
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, px[k]), _mm_mul_ps(cy, py[k])),
+			                                 _mm_mul_ps(cz, pz[k])), pw[k]);
+			__m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ax[k]), _mm_mul_ps(ey, ay[k])),
+			                                 _mm_mul_ps(ez, az[k])), aw[k]);
+			outside = _mm_or_ps(outside, _mm_cmple_ps(_mm_add_ps(d, r), zero));
+		}
+		// branchless compaction of the 4 results
+		int mask = ~_mm_movemask_ps(outside);
+		for (int b = 0; b < 4; ++b) {
+			visible[nvisible] = (uint32_t)(i + b);
+			nvisible += (mask >> b) & 1;
+		}
+	}
+#endif
+	for (; i < boxes->n; ++i) {
+		bool outside = false;
+		for (int k = 0; k < 6; ++k) {
+			vec4_t p = frustum->planes[k];
+			vec4_t a = frustum->absplanes[k];
+			float d = boxes->cx[i] * p.x + boxes->cy[i] * p.y + boxes->cz[i] * p.z + p.w;
+			float r = boxes->ex[i] * a.x + boxes->ey[i] * a.y + boxes->ez[i] * a.z + a.w;
+			if (d + r <= 0)
+				outside = true;
+		}
+		visible[nvisible] = (uint32_t)i;
+		nvisible += !outside;
+	}
+	return nvisible;
+}
+
 
 vec3_t m_rotatevec3(const mat44_t* m, const vec3_t *v)
 {
@@ -244,7 +303,7 @@ vec3_t m_matmul33(const mat33_t* m, const vec3_t* v)
 }
 
 void
-m_matmul(mat44_t* to, const mat44_t* by)
+m_matmul_scalar(mat44_t* to, const mat44_t* by)
 {
 	const float*__restrict__ a = to->m;
 	const float*__restrict__ b = by->m;
@@ -328,7 +387,7 @@ void m_transpose33(mat33_t* m)
 }
 
 
-bool m_invert(mat44_t* to, const mat44_t* from)
+bool m_invert_scalar(mat44_t* to, const mat44_t* from)
 {
 	float inv[16];
 	float* out = to->m;
@@ -487,7 +546,7 @@ void m_invert_orthonormal(mat44_t* to, const mat44_t* from)
 }
 
 
-vec4_t m_matmulvec(const mat44_t* m, const vec4_t* v)
+vec4_t m_matmulvec_scalar(const mat44_t* m, const vec4_t* v)
 {
 	vec4_t ret;
 	ret.x = (v->x * m->m[0]) +
@@ -527,6 +586,192 @@ vec3_t m_matmulvec3(const mat44_t* m, const vec3_t* v)
 	return ret;
 }
 
+void m_transform_points_scalar(const mat44_t* m, const vec3_t* in, vec3_t* out, size_t n)
+{
+	for (size_t i = 0; i < n; ++i)
+		out[i] = m_matmulvec3(m, in + i);
+}
+
+
+/*
+  SSE versions. Matrices are column-major, so a column is one register
+  and m * v is the sum of the columns scaled by the components of v.
+  Loads and stores are unaligned since mat44_t has no alignment.
+ */
+#if ML_SSE
+
+#define ML_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps((a), (b), _MM_SHUFFLE((w), (z), (y), (x)))
+#define ML_SWIZZLE(a, x, y, z, w) ML_SHUFFLE((a), (a), (x), (y), (z), (w))
+#define ML_SPLAT(a, i) ML_SWIZZLE((a), (i), (i), (i), (i))
+
+static inline
+__m128 sse_lincomb(__m128 v, __m128 c0, __m128 c1, __m128 c2, __m128 c3)
+{
+	__m128 r = _mm_mul_ps(ML_SPLAT(v, 0), c0);
+	r = _mm_add_ps(r, _mm_mul_ps(ML_SPLAT(v, 1), c1));
+	r = _mm_add_ps(r, _mm_mul_ps(ML_SPLAT(v, 2), c2));
+	return _mm_add_ps(r, _mm_mul_ps(ML_SPLAT(v, 3), c3));
+}
+
+void m_matmul(mat44_t* to, const mat44_t* by)
+{
+	__m128 a0 = _mm_loadu_ps(to->m);
+	__m128 a1 = _mm_loadu_ps(to->m + 4);
+	__m128 a2 = _mm_loadu_ps(to->m + 8);
+	__m128 a3 = _mm_loadu_ps(to->m + 12);
+	__m128 r0 = sse_lincomb(_mm_loadu_ps(by->m), a0, a1, a2, a3);
+	__m128 r1 = sse_lincomb(_mm_loadu_ps(by->m + 4), a0, a1, a2, a3);
+	__m128 r2 = sse_lincomb(_mm_loadu_ps(by->m + 8), a0, a1, a2, a3);
+	__m128 r3 = sse_lincomb(_mm_loadu_ps(by->m + 12), a0, a1, a2, a3);
+	_mm_storeu_ps(to->m, r0);
+	_mm_storeu_ps(to->m + 4, r1);
+	_mm_storeu_ps(to->m + 8, r2);
+	_mm_storeu_ps(to->m + 12, r3);
+}
+
+vec4_t m_matmulvec(const mat44_t* m, const vec4_t* v)
+{
+	vec4_t ret;
+	__m128 r = sse_lincomb(_mm_loadu_ps(&v->x),
+	                       _mm_loadu_ps(m->m), _mm_loadu_ps(m->m + 4),
+	                       _mm_loadu_ps(m->m + 8), _mm_loadu_ps(m->m + 12));
+	_mm_storeu_ps(&ret.x, r);
+	return ret;
+}
+
+void m_transform_points(const mat44_t* m, const vec3_t* in, vec3_t* out, size_t n)
+{
+	__m128 c0 = _mm_loadu_ps(m->m);
+	__m128 c1 = _mm_loadu_ps(m->m + 4);
+	__m128 c2 = _mm_loadu_ps(m->m + 8);
+	__m128 c3 = _mm_loadu_ps(m->m + 12);
+	size_t i = 0;
+	// 4 points are 12 floats: three loads, four transforms, three stores
+	for (; i + 4 <= n; i += 4) {
+		const float* src = &in[i].x;
+		__m128 v0 = _mm_loadu_ps(src);      // x0 y0 z0 x1
+		__m128 v1 = _mm_loadu_ps(src + 4);  // y1 z1 x2 y2
+		__m128 v2 = _mm_loadu_ps(src + 8);  // z2 x3 y3 z3
+		__m128 p0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ML_SPLAT(v0, 0), c0), _mm_mul_ps(ML_SPLAT(v0, 1), c1)),
+		                       _mm_add_ps(_mm_mul_ps(ML_SPLAT(v0, 2), c2), c3));
+		__m128 p1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ML_SPLAT(v0, 3), c0), _mm_mul_ps(ML_SPLAT(v1, 0), c1)),
+		                       _mm_add_ps(_mm_mul_ps(ML_SPLAT(v1, 1), c2), c3));
+		__m128 p2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ML_SPLAT(v1, 2), c0), _mm_mul_ps(ML_SPLAT(v1, 3), c1)),
+		                       _mm_add_ps(_mm_mul_ps(ML_SPLAT(v2, 0), c2), c3));
+		__m128 p3 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ML_SPLAT(v2, 1), c0), _mm_mul_ps(ML_SPLAT(v2, 2), c1)),
+		                       _mm_add_ps(_mm_mul_ps(ML_SPLAT(v2, 3), c2), c3));
+		// pack xyz xyz xyz xyz into three registers
+		float* dst = &out[i].x;
+		_mm_storeu_ps(dst, ML_SHUFFLE(p0, ML_SHUFFLE(p0, p1, 2, 2, 0, 0), 0, 1, 0, 2));
+		_mm_storeu_ps(dst + 4, ML_SHUFFLE(ML_SHUFFLE(p1, p1, 1, 2, 1, 2), p2, 0, 1, 0, 1));
+		_mm_storeu_ps(dst + 8, ML_SHUFFLE(ML_SHUFFLE(p2, p3, 2, 2, 0, 0), p3, 0, 2, 1, 2));
+	}
+	for (; i < n; ++i)
+		out[i] = m_matmulvec3(m, in + i);
+}
+
+/*
+  Inverse through 2x2 blocks: with M = |A B; C D|, the adjugates of
+  the blocks give the four blocks of the inverse without cofactor
+  expansion. Each __m128 holds one 2x2 block as (m00 m01 m10 m11).
+  inv(M^T) = inv(M)^T, so the column-major layout needs no transposes.
+ */
+static inline
+__m128 mat2_mul(__m128 a, __m128 b)
+{
+	return _mm_add_ps(_mm_mul_ps(a, ML_SWIZZLE(b, 0, 3, 0, 3)),
+	                  _mm_mul_ps(ML_SWIZZLE(a, 1, 0, 3, 2), ML_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+// adj(a) * b
+static inline
+__m128 mat2_adjmul(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(ML_SWIZZLE(a, 3, 3, 0, 0), b),
+	                  _mm_mul_ps(ML_SWIZZLE(a, 1, 1, 2, 2), ML_SWIZZLE(b, 2, 3, 0, 1)));
+}
+
+// a * adj(b)
+static inline
+__m128 mat2_muladj(__m128 a, __m128 b)
+{
+	return _mm_sub_ps(_mm_mul_ps(a, ML_SWIZZLE(b, 3, 0, 3, 0)),
+	                  _mm_mul_ps(ML_SWIZZLE(a, 1, 0, 3, 2), ML_SWIZZLE(b, 2, 1, 2, 1)));
+}
+
+bool m_invert(mat44_t* to, const mat44_t* from)
+{
+	__m128 r0 = _mm_loadu_ps(from->m);
+	__m128 r1 = _mm_loadu_ps(from->m + 4);
+	__m128 r2 = _mm_loadu_ps(from->m + 8);
+	__m128 r3 = _mm_loadu_ps(from->m + 12);
+
+	__m128 A = _mm_movelh_ps(r0, r1);
+	__m128 B = _mm_movehl_ps(r1, r0);
+	__m128 C = _mm_movelh_ps(r2, r3);
+	__m128 D = _mm_movehl_ps(r3, r2);
+
+	// (|A| |B| |C| |D|)
+	__m128 dets = _mm_sub_ps(_mm_mul_ps(ML_SHUFFLE(r0, r2, 0, 2, 0, 2), ML_SHUFFLE(r1, r3, 1, 3, 1, 3)),
+	                         _mm_mul_ps(ML_SHUFFLE(r0, r2, 1, 3, 1, 3), ML_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+	__m128 detA = ML_SPLAT(dets, 0);
+	__m128 detB = ML_SPLAT(dets, 1);
+	__m128 detC = ML_SPLAT(dets, 2);
+	__m128 detD = ML_SPLAT(dets, 3);
+
+	__m128 DC = mat2_adjmul(D, C);
+	__m128 AB = mat2_adjmul(A, B);
+	__m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), mat2_mul(B, DC));
+	__m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), mat2_mul(C, AB));
+	__m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), mat2_muladj(D, AB));
+	__m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), mat2_muladj(A, DC));
+
+	// |M| = |A||D| + |B||C| - tr(adj(A)B adj(D)C)
+	__m128 tr = _mm_mul_ps(AB, ML_SWIZZLE(DC, 0, 2, 1, 3));
+	tr = _mm_add_ps(tr, ML_SWIZZLE(tr, 2, 3, 0, 1));
+	tr = _mm_add_ps(tr, ML_SWIZZLE(tr, 1, 0, 3, 2));
+	__m128 det = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC)), tr);
+	if (_mm_cvtss_f32(det) == 0.f)
+		return false;
+
+	__m128 rdet = _mm_div_ps(_mm_setr_ps(1.f, -1.f, -1.f, 1.f), det);
+	X = _mm_mul_ps(X, rdet);
+	Y = _mm_mul_ps(Y, rdet);
+	Z = _mm_mul_ps(Z, rdet);
+	W = _mm_mul_ps(W, rdet);
+
+	// adjugate of each block and back to rows in one shuffle
+	_mm_storeu_ps(to->m, ML_SHUFFLE(X, Y, 3, 1, 3, 1));
+	_mm_storeu_ps(to->m + 4, ML_SHUFFLE(X, Y, 2, 0, 2, 0));
+	_mm_storeu_ps(to->m + 8, ML_SHUFFLE(Z, W, 3, 1, 3, 1));
+	_mm_storeu_ps(to->m + 12, ML_SHUFFLE(Z, W, 2, 0, 2, 0));
+	return true;
+}
+
+#else
+
+void m_matmul(mat44_t* to, const mat44_t* by)
+{
+	m_matmul_scalar(to, by);
+}
+
+vec4_t m_matmulvec(const mat44_t* m, const vec4_t* v)
+{
+	return m_matmulvec_scalar(m, v);
+}
+
+void m_transform_points(const mat44_t* m, const vec3_t* in, vec3_t* out, size_t n)
+{
+	m_transform_points_scalar(m, in, out, n);
+}
+
+bool m_invert(mat44_t* to, const mat44_t* from)
+{
+	return m_invert_scalar(to, from);
+}
+
+#endif
+
 
 GLuint m_compile_shader(GLenum type, const char* source)
 {
@@ -622,7 +867,8 @@ static inline GLsizei mesh_stride(GLenum flags)
 		((flags & ML_N_3F) ? 12 : 0) +
 		((flags & ML_N_4B) ? 4 : 0) +
 		((flags & ML_TC_2F) ? 8 : 0) +
-		((flags & ML_TC_2US) ? 4 : 0);
+		((flags & ML_TC_2US) ? 4 : 0) +
+		((flags & ML_TC_2UB) ? 4 : 0);
 }
 
 void m_create_mesh(mesh_t* mesh, size_t n, void* data, GLenum flags, GLenum usage)
@@ -633,14 +879,17 @@ void m_create_mesh(mesh_t* mesh, size_t n, void* data, GLenum flags, GLenum usag
 	M_CHECKGL(glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo));
 	M_CHECKGL(glBufferData(GL_ARRAY_BUFFER, (GLsizei)n * stride, data, usage));
 	M_CHECKGL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+	mesh->bytes = (GLsizeiptr)n * stride;
+	mesh->ibo_bytes = 0;
+	mem_track(MEM_GPU, mesh->bytes);
 
 	GLint offset = 0;
 	mesh->position = (flags & (ML_POS_2F + ML_POS_3F + ML_POS_4UB + ML_POS_10_2)) ? offset : -1;
 	offset += (flags & ML_POS_2F) ? 8 : ((flags & ML_POS_3F) ? 12 : (flags & (ML_POS_4UB + ML_POS_10_2) ? 4 : 0));
 	mesh->normal = (flags & (ML_N_3F + ML_N_4B)) ? offset : -1;
 	offset += (flags & ML_N_3F) ? 12 : ((flags & ML_N_4B) ? 4 : 0);
-	mesh->texcoord = (flags & (ML_TC_2F + ML_TC_2US)) ? offset : -1;
-	offset += (flags & ML_TC_2F) ? 8 : ((flags & ML_TC_2US) ? 4 : 0);
+	mesh->texcoord = (flags & (ML_TC_2F + ML_TC_2US + ML_TC_2UB)) ? offset : -1;
+	offset += (flags & ML_TC_2F) ? 8 : ((flags & (ML_TC_2US + ML_TC_2UB)) ? 4 : 0);
 	mesh->color = (flags & ML_CLR_4UB) ? offset : -1;
 	offset += (flags & ML_CLR_4UB) ? 4 : 0;
 	mesh->stride = stride;
@@ -659,19 +908,29 @@ void m_update_mesh(mesh_t* mesh, GLintptr offset, GLsizeiptr n, const void* data
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
+void m_update_indices(mesh_t* mesh, GLintptr offset, GLsizeiptr n, const void* data)
+{
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, offset, n, data);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
 void m_replace_mesh(mesh_t* mesh, GLsizeiptr n, const void* data, GLenum usage)
 {
 	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
 	glBufferData(GL_ARRAY_BUFFER, n, data, usage);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	mem_track(MEM_GPU, -mesh->bytes);
+	mesh->bytes = n;
+	mem_track(MEM_GPU, mesh->bytes);
 }
 
-void m_create_indexed_mesh(mesh_t* mesh, size_t n, void* data, size_t ilen, GLenum indextype, void* indices, GLenum flags)
+void m_create_indexed_mesh(mesh_t* mesh, size_t n, void* data, size_t ilen, GLenum indextype, void* indices, GLenum flags, GLenum index_usage)
 {
 	m_create_mesh(mesh, n, data, flags, GL_STATIC_DRAW);
 	M_CHECKGL(glGenBuffers(1, &mesh->ibo));
 
-	GLsizei isize = 0;
+	GLsizeiptr isize = 0;
 	switch (indextype) {
 	case GL_UNSIGNED_BYTE:
 		isize = 1; break;
@@ -684,8 +943,10 @@ void m_create_indexed_mesh(mesh_t* mesh, size_t n, void* data, size_t ilen, GLen
 	}
 
 	M_CHECKGL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo));
-	M_CHECKGL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizei)ilen * isize, indices, GL_STATIC_DRAW));
+	M_CHECKGL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)ilen * isize, indices, index_usage));
 	M_CHECKGL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+	mesh->ibo_bytes = (GLsizeiptr)ilen * isize;
+	mem_track(MEM_GPU, mesh->ibo_bytes);
 
 	mesh->count = (GLsizei)ilen;
 	mesh->ibotype = indextype;
@@ -696,6 +957,10 @@ void m_destroy_mesh(mesh_t* mesh)
 	if (mesh->vbo != 0) { M_CHECKGL(glDeleteBuffers(1, &(mesh->vbo))); mesh->vbo = 0; }
 	if (mesh->ibo != 0) { M_CHECKGL(glDeleteBuffers(1, &(mesh->ibo))); mesh->ibo = 0; }
 	if (mesh->vao != 0) { M_CHECKGL(glDeleteVertexArrays(1, &(mesh->vao))); mesh->vao = 0; }
+	mem_track(MEM_GPU, -mesh->bytes);
+	mem_track(MEM_GPU, -mesh->ibo_bytes);
+	mesh->bytes = 0;
+	mesh->ibo_bytes = 0;
 	mesh->material = NULL;
 }
 
@@ -737,6 +1002,8 @@ void m_set_material(mesh_t* mesh, material_t* material)
 		if (mesh->texcoord > -1) {
 			if (mesh->flags & ML_TC_2F)
 				M_CHECKGL(glVertexAttribPointer(midx, 2, GL_FLOAT, GL_FALSE, mesh->stride, (void*)((ptrdiff_t)mesh->texcoord)));
+			else if (mesh->flags & ML_TC_2UB)
+				M_CHECKGL(glVertexAttribIPointer(midx, 2, GL_UNSIGNED_BYTE, mesh->stride, (void*)((ptrdiff_t)mesh->texcoord)));
 			else // 2US
 				M_CHECKGL(glVertexAttribPointer(midx, 2, GL_UNSIGNED_SHORT, GL_TRUE, mesh->stride, (void*)((ptrdiff_t)mesh->texcoord)));
 			M_CHECKGL(glEnableVertexAttribArray(midx));
@@ -761,14 +1028,14 @@ void m_mtxstack_init(mtxstack_t* stack, size_t size)
 	if (size == 0)
 		fatal_error("Matrix stack too small");
 	stack->top = 0;
-	stack->stack = malloc(sizeof(mat44_t) * size);
+	stack->stack = mem_alloc(MEM_MISC, sizeof(mat44_t) * size);
 	for (size_t i = 0; i < size; ++i)
 		m_setidentity(stack->stack + i);
 }
 
 void m_mtxstack_destroy(mtxstack_t* stack)
 {
-	free(stack->stack);
+	mem_free(stack->stack);
 	stack->top = -1;
 	stack->stack = NULL;
 }
@@ -829,8 +1096,12 @@ void m_tex2d_load(tex2d_t* tex, const char* filename)
 //	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
 	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
 	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	tex->target = GL_TEXTURE_2D;
 	tex->w = (uint16_t)x;
 	tex->h = (uint16_t)y;
+	tex->layers = 1;
+	tex->bytes = (GLsizeiptr)x * y * 4; // as RGBA8, drivers tend to pad
+	mem_track(MEM_GPU, tex->bytes);
 
 	switch (n) {
 	case 4:
@@ -852,43 +1123,59 @@ void m_tex2d_load(tex2d_t* tex, const char* filename)
 	M_CHECKGL(glBindTexture(GL_TEXTURE_2D, 0));
 }
 
-void m_save_screenshot(const char* filename)
+void m_tex2d_load_array(tex2d_t* tex, const char* filename, int tilew)
 {
-	int ok, x, y, w, h;
-	uint8_t* data;
+	int x, y, n;
+	unsigned char* data;
 
-	int viewport[4] = {0};
-	M_CHECKGL(glGetIntegerv(GL_VIEWPORT, viewport));
-	if (viewport[2] == 0 || viewport[3] == 0) {
-		puts("Failed to get viewport information.");
-		return;
+	memset(tex, 0, sizeof(tex2d_t));
+	data = stbi_load(filename, &x, &y, &n, 4);
+	if (data == NULL)
+		fatal_error("Failed to load image %s", filename);
+	if (tilew <= 0 || x % tilew != 0 || y % tilew != 0)
+		fatal_error("%s is %dx%d, not a grid of %d pixel tiles", filename, x, y, tilew);
+
+	int cols = x / tilew;
+	int layers = cols * (y / tilew);
+	size_t tilebytes = (size_t)tilew * tilew * 4;
+	uint8_t* slices = mem_alloc(MEM_MISC, tilebytes * layers);
+	for (int l = 0; l < layers; ++l) {
+		const uint8_t* src = data + ((size_t)(l / cols) * tilew * x + (size_t)(l % cols) * tilew) * 4;
+		for (int row = 0; row < tilew; ++row)
+			memcpy(slices + tilebytes * l + (size_t)row * tilew * 4, src + (size_t)row * x * 4, (size_t)tilew * 4);
 	}
-	printf("viewport: %d,%d - %d,%d\n", viewport[0], viewport[1], viewport[2], viewport[3]);
-
-	data = (uint8_t*)malloc(viewport[2] * viewport[3] * 3);
-	M_CHECKGL(glReadBuffer(GL_FRONT));
-	M_CHECKGL(glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGB, GL_UNSIGNED_BYTE, data));
-
-	// need to flip the image data
-	w = viewport[2]*3;
-	h = viewport[3];
-	for (y = 0; y < h/2; ++y)
-		for (x = 0; x < w; ++x) {
-			uint8_t p = data[y * w + x];
-			data[y * w + x] = data[(h - y - 1) * w + x];
-			data[(h - y - 1) * w + x] = p;
-		}
+	stbi_image_free(data);
+
+	tex->target = GL_TEXTURE_2D_ARRAY;
+	tex->w = (uint16_t)tilew;
+	tex->h = (uint16_t)tilew;
+	tex->layers = (uint16_t)layers;
+	tex->bytes = (GLsizeiptr)(tilebytes * layers * 4 / 3); // with the mip chain
 
-	ok = stbi_write_png(filename, viewport[2], viewport[3], 3, data, 0);
-	free(data);
-	if (!ok) {
-		printf("Failed to write to %s\n", filename);
+	M_CHECKGL(glActiveTexture(GL_TEXTURE0));
+	M_CHECKGL(glGenTextures(1, &tex->id));
+	M_CHECKGL(glBindTexture(GL_TEXTURE_2D_ARRAY, tex->id));
+	M_CHECKGL(glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, tilew, tilew, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, slices));
+	// each layer mips on its own, so tiles never bleed into each other
+	M_CHECKGL(glGenerateMipmap(GL_TEXTURE_2D_ARRAY));
+	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	M_CHECKGL(glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	if (GLEW_EXT_texture_filter_anisotropic) {
+		GLfloat maxaniso = 1.f;
+		M_CHECKGL(glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxaniso));
+		M_CHECKGL(glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, ML_MIN(maxaniso, 16.f)));
 	}
+	M_CHECKGL(glBindTexture(GL_TEXTURE_2D_ARRAY, 0));
+	mem_track(MEM_GPU, tex->bytes);
+	mem_free(slices);
 }
 
 void m_tex2d_destroy(tex2d_t* tex)
 {
 	M_CHECKGL(glDeleteTextures(1, &tex->id));
+	mem_track(MEM_GPU, -tex->bytes);
 	memset(tex, 0, sizeof(tex2d_t));
 
 }
@@ -896,7 +1183,7 @@ void m_tex2d_destroy(tex2d_t* tex)
 void m_tex2d_bind(tex2d_t* tex, int index)
 {
 	M_CHECKGL(glActiveTexture(GL_TEXTURE0 + index));
-	M_CHECKGL(glBindTexture(GL_TEXTURE_2D, tex->id));
+	M_CHECKGL(glBindTexture(tex->target, tex->id));
 }
 
 /* based on code by Pierre Terdiman
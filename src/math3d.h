@@ -16,6 +16,12 @@
 #define ML_MIN(a, b) (((b) < (a)) ? (b) : (a))
 #define ML_MAX(a, b) (((b) > (a)) ? (b) : (a))
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define ML_SSE 1
+#else
+#define ML_SSE 0
+#endif
+
 #define ML_DEG2RAD(d) (((d) * ML_PI) / 180.0)
 #define ML_RAD2DEG(r) (((r) * 180.0) / ML_PI)
 
@@ -34,7 +40,8 @@ enum ml_MeshFlags {
 	ML_N_4B   = 0x20,
 	ML_TC_2F   = 0x40,
 	ML_TC_2US  = 0x80,
-	ML_CLR_4UB = 0x100
+	ML_CLR_4UB = 0x100,
+	ML_TC_2UB  = 0x200 // integer attribute, padded to 4 bytes
 };
 
 
@@ -71,7 +78,7 @@ typedef struct dvec3 {
 } dvec3_t;
 
 typedef struct chunkpos {
-	int x, z;
+	int64_t x, z;
 } chunkpos_t;
 
 typedef struct mat44 {
@@ -92,6 +99,17 @@ typedef struct aabb_t {
 	vec3_t extent;
 } aabb_t;
 
+// many boxes as structure-of-arrays, for collide_frustum_aabb_batch
+typedef struct aabb_soa {
+	float* cx;
+	float* cy;
+	float* cz;
+	float* ex;
+	float* ey;
+	float* ez;
+	size_t n;
+} aabb_soa_t;
+
 
 #pragma pack(push, 4)
 
@@ -168,13 +186,18 @@ typedef struct mesh {
 	GLenum ibotype;
 	GLsizei count;
 	GLenum flags;
+	GLsizeiptr bytes; // GPU memory held by vbo
+	GLsizeiptr ibo_bytes; // and by ibo, tracked separately
 } mesh_t;
 
 
 typedef struct tex2d_t {
 	GLuint id;
+	GLenum target; // GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
 	uint16_t w;
 	uint16_t h;
+	uint16_t layers;
+	GLsizeiptr bytes; // GPU memory including mips
 } tex2d_t;
 
 typedef struct mtxstack {
@@ -194,6 +217,9 @@ void     m_fpsmatrix(mat44_t* to, vec3_t eye, float pitch, float yaw);
 void     m_matmul(mat44_t* to, const mat44_t* by);
 vec4_t   m_matmulvec(const mat44_t* m, const vec4_t* v);
 vec3_t   m_matmulvec3(const mat44_t* m, const vec3_t* v);
+// out[i] = m * (in[i], 1), w dropped. in and out may be the same array
+// but must not otherwise overlap.
+void     m_transform_points(const mat44_t* m, const vec3_t* in, vec3_t* out, size_t n);
 vec3_t   m_rotatevec3(const mat44_t* m, const vec3_t* v);
 void     m_translate(mat44_t* m, float x, float y, float z);
 void     m_rotate(mat44_t* m, float angle, float x, float y, float z);
@@ -205,6 +231,12 @@ bool     m_invert(mat44_t* to, const mat44_t* from);
 void     m_invert_orthonormal(mat44_t* to, const mat44_t* from);
 void     m_makefrustum(frustum_t* frustum, mat44_t* projection, mat44_t* view);
 
+// plain C versions of the SSE paths above, for cross-checking
+void     m_matmul_scalar(mat44_t* to, const mat44_t* by);
+vec4_t   m_matmulvec_scalar(const mat44_t* m, const vec4_t* v);
+bool     m_invert_scalar(mat44_t* to, const mat44_t* from);
+void     m_transform_points_scalar(const mat44_t* m, const vec3_t* in, vec3_t* out, size_t n);
+
 
 // GL helpers
 
@@ -213,15 +245,19 @@ GLuint   m_link_program(GLuint vsh, GLuint fsh);
 void     m_create_material(material_t* material, const char* vsource, const char* fsource);
 void     m_destroy_material(material_t* material);
 void     m_create_mesh(mesh_t* mesh, size_t n, void* data, GLenum flags, GLenum usage);
-void     m_create_indexed_mesh(mesh_t* mesh, size_t n, void* data, size_t ilen, GLenum indextype, void* indices, GLenum flags);
+// index_usage: GL_DYNAMIC_DRAW for index buffers rewritten by m_update_indices
+void     m_create_indexed_mesh(mesh_t* mesh, size_t n, void* data, size_t ilen, GLenum indextype, void* indices, GLenum flags, GLenum index_usage);
 void     m_destroy_mesh(mesh_t* mesh);
 void     m_update_mesh(mesh_t *mesh, GLintptr offset, GLsizeiptr n, const void* data);
+void     m_update_indices(mesh_t *mesh, GLintptr offset, GLsizeiptr n, const void* data);
 void     m_replace_mesh(mesh_t *mesh, GLsizeiptr n, const void* data, GLenum usage);
 void     m_set_material(mesh_t* mesh, material_t* material);
 void     m_tex2d_load(tex2d_t* tex, const char* filename);
+// slices an atlas of tilew x tilew tiles into the layers of a
+// mipmapped array texture, row by row from the top left
+void     m_tex2d_load_array(tex2d_t* tex, const char* filename, int tilew);
 void     m_tex2d_destroy(tex2d_t* tex);
 void     m_tex2d_bind(tex2d_t* tex, int index);
-void     m_save_screenshot(const char* filename);
 
 
 // Matrix stack
@@ -241,6 +277,9 @@ mat44_t* m_getmatrix(mtxstack_t* stack);
 int      collide_frustum_aabb(frustum_t* frustum, vec3_t center, vec3_t extent);
 int      collide_frustum_aabb_xz(frustum_t* frustum, vec3_t center, vec3_t extent);
 int      collide_frustum_aabb_y(frustum_t* frustum, vec3_t center, vec3_t extent);
+// same test as collide_frustum_aabb for every box, 4 at a time with SSE.
+// Writes the indices of boxes not fully outside to visible, returns the count.
+size_t   collide_frustum_aabb_batch(const frustum_t* frustum, const aabb_soa_t* boxes, uint32_t* visible);
 bool     collide_ray_aabb(vec3_t origin, vec3_t dir, vec3_t center, vec3_t extent);
 bool     collide_sphere_aabb(vec3_t pos, float radius, vec3_t center, vec3_t extent);
 bool     collide_sphere_aabb_full(vec3_t pos, float radius, vec3_t center, vec3_t extent, vec3_t* hit);
@@ -428,6 +467,16 @@ void m_draw_range(const mesh_t* mesh, GLint first, GLsizei count)
 }
 
 
+// several ranges of a non-indexed mesh in one call
+static inline
+void m_draw_ranges(const mesh_t* mesh, const GLint* first, const GLsizei* count, GLsizei n)
+{
+	M_CHECKGL(glBindVertexArray(mesh->vao));
+	M_CHECKGL(glMultiDrawArrays(mesh->mode, first, count, n));
+	glBindVertexArray(0);
+}
+
+
 static inline
 vec3_t m_xaxis44(const mat44_t* from)
 {
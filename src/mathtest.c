@@ -0,0 +1,224 @@
+#include "common.h"
+#include "math3d.h"
+#include "mathtest.h"
+#include "mem.h"
+#include "rnd.h"
+#include "map.h"
+
+static uint64_t test_rng = 1;
+static volatile float test_sink; // keeps benchmark results alive
+
+
+static
+float randf(float lo, float hi)
+{
+	test_rng = rand64(test_rng);
+	return lo + (hi - lo) * (float)(test_rng >> 40) / (float)(1 << 24);
+}
+
+static
+void random_matrix(mat44_t* m)
+{
+	for (int i = 0; i < 16; ++i)
+		m->m[i] = randf(-10.f, 10.f);
+}
+
+// rotation, scale and translation, like the camera and model matrices
+static
+void random_transform(mat44_t* m)
+{
+	m_setidentity(m);
+	m_translate(m, randf(-100.f, 100.f), randf(-100.f, 100.f), randf(-100.f, 100.f));
+	m_rotate(m, randf(0.f, (float)ML_TWO_PI), randf(-1.f, 1.f), randf(-1.f, 1.f), randf(0.1f, 1.f));
+	for (int i = 0; i < 12; ++i)
+		m->m[i] *= randf(0.5f, 2.f);
+}
+
+static
+float max_abs(const float* a, int n)
+{
+	float r = 0.f;
+	for (int i = 0; i < n; ++i)
+		r = ML_MAX(r, fabsf(a[i]));
+	return r;
+}
+
+// largest difference relative to the largest element
+static
+float rel_error(const float* a, const float* b, int n)
+{
+	float err = 0.f;
+	for (int i = 0; i < n; ++i)
+		err = ML_MAX(err, fabsf(a[i] - b[i]));
+	return err / ML_MAX(max_abs(b, n), 1e-6f);
+}
+
+static
+bool check(const char* what, float err, float tolerance)
+{
+	if (err <= tolerance)
+		return true;
+	printf("mathtest: %s differs by %g (tolerance %g)\n", what, err, tolerance);
+	return false;
+}
+
+#define BENCH(label, iters, body) do { \
+	int64_t bench_start = sys_timens(); \
+	for (int bench_i = 0; bench_i < (iters); ++bench_i) { body; } \
+	printf("  %-28s %8.2f ns\n", (label), (double)(sys_timens() - bench_start) / (iters)); \
+} while (0)
+
+int mathtest_simd()
+{
+	const int trials = 10000;
+	int failures = 0;
+	mat44_t a, b, r1, r2;
+
+	printf("mathtest: %s paths against scalar, %d random cases each\n", ML_SSE ? "sse" : "scalar", trials);
+	for (int t = 0; t < trials; ++t) {
+		random_matrix(&a);
+		random_matrix(&b);
+		r1 = a;
+		r2 = a;
+		m_matmul(&r1, &b);
+		m_matmul_scalar(&r2, &b);
+		failures += !check("m_matmul", rel_error(r1.m, r2.m, 16), 1e-5f);
+
+		vec4_t v = { randf(-10.f, 10.f), randf(-10.f, 10.f), randf(-10.f, 10.f), randf(-10.f, 10.f) };
+		vec4_t v1 = m_matmulvec(&a, &v);
+		vec4_t v2 = m_matmulvec_scalar(&a, &v);
+		failures += !check("m_matmulvec", rel_error(&v1.x, &v2.x, 4), 1e-5f);
+
+		random_transform(&a);
+		bool ok1 = m_invert(&r1, &a);
+		bool ok2 = m_invert_scalar(&r2, &a);
+		if (ok1 != ok2) {
+			printf("mathtest: m_invert disagrees on singularity\n");
+			failures++;
+		} else if (ok1) {
+			failures += !check("m_invert", rel_error(r1.m, r2.m, 16), 1e-4f);
+			// rounding in M * inv(M) grows with the size of both
+			float scale = max_abs(a.m, 16) * max_abs(r1.m, 16);
+			m_matmul(&r1, &a);
+			m_setidentity(&r2);
+			failures += !check("m_invert identity", rel_error(r1.m, r2.m, 16), 1e-5f * scale);
+		}
+		if (failures > 10)
+			break;
+	}
+
+	memset(&a, 0, sizeof(a));
+	a.m[0] = a.m[5] = 1.f; // rank 2
+	if (m_invert(&r1, &a) || m_invert_scalar(&r2, &a)) {
+		printf("mathtest: m_invert accepted a singular matrix\n");
+		failures++;
+	}
+
+	const size_t npoints = 1027; // not a multiple of 4, to cover the tail
+	vec3_t* in = mem_alloc(MEM_MISC, npoints * sizeof(vec3_t));
+	vec3_t* out1 = mem_alloc(MEM_MISC, npoints * sizeof(vec3_t));
+	vec3_t* out2 = mem_alloc(MEM_MISC, npoints * sizeof(vec3_t));
+	for (size_t i = 0; i < npoints; ++i)
+		in[i] = m_vec3(randf(-100.f, 100.f), randf(-100.f, 100.f), randf(-100.f, 100.f));
+	random_transform(&a);
+	m_transform_points(&a, in, out1, npoints);
+	m_transform_points_scalar(&a, in, out2, npoints);
+	failures += !check("m_transform_points", rel_error(&out1[0].x, &out2[0].x, (int)npoints * 3), 1e-5f);
+	memcpy(out1, in, npoints * sizeof(vec3_t));
+	m_transform_points(&a, out1, out1, npoints);
+	failures += !check("m_transform_points in place", rel_error(&out1[0].x, &out2[0].x, (int)npoints * 3), 1e-5f);
+
+	printf("mathtest: %d failures\n", failures);
+
+	const int iters = 1000000;
+	random_transform(&a);
+	random_transform(&b);
+	vec4_t v = { 1.f, 2.f, 3.f, 1.f };
+	printf("mathtest: ns per call\n");
+	BENCH("m_matmul", iters, { r1 = a; m_matmul(&r1, &b); test_sink = r1.m[bench_i & 15]; });
+	BENCH("m_matmul_scalar", iters, { r1 = a; m_matmul_scalar(&r1, &b); test_sink = r1.m[bench_i & 15]; });
+	BENCH("m_matmulvec", iters, { v.x = (float)bench_i; test_sink = m_matmulvec(&a, &v).y; });
+	BENCH("m_matmulvec_scalar", iters, { v.x = (float)bench_i; test_sink = m_matmulvec_scalar(&a, &v).y; });
+	BENCH("m_invert", iters, { a.m[12] = (float)bench_i; m_invert(&r1, &a); test_sink = r1.m[12]; });
+	BENCH("m_invert_scalar", iters, { a.m[12] = (float)bench_i; m_invert_scalar(&r1, &a); test_sink = r1.m[12]; });
+	BENCH("m_transform_points x1027", iters / 100, { m_transform_points(&a, in, out1, npoints); test_sink = out1[bench_i % npoints].x; });
+	BENCH("m_transform_points_scalar x1027", iters / 100, { m_transform_points_scalar(&a, in, out1, npoints); test_sink = out1[bench_i % npoints].x; });
+
+	mem_free(in);
+	mem_free(out1);
+	mem_free(out2);
+	return failures == 0 ? 0 : 1;
+}
+
+/*
+  Checks collide_frustum_aabb_batch against collide_frustum_aabb on the
+  subchunk grid of a 64 chunk view distance and times both. Needs no
+  window or GL context.
+ */
+int mathtest_cull()
+{
+	const int view = 64;
+	const size_t nboxes = (size_t)(view*2) * (view*2) * MAP_CHUNK_HEIGHT;
+	float* soa = mem_alloc(MEM_MISC, nboxes * 6 * sizeof(float));
+	uint32_t* visible = mem_alloc(MEM_MISC, nboxes * sizeof(uint32_t));
+	aabb_soa_t boxes = {
+		soa, soa + nboxes, soa + nboxes*2,
+		soa + nboxes*3, soa + nboxes*4, soa + nboxes*5,
+		nboxes
+	};
+	size_t n = 0;
+	for (int z = -view; z < view; ++z) {
+		for (int x = -view; x < view; ++x) {
+			for (int y = 0; y < MAP_CHUNK_HEIGHT; ++y, ++n) {
+				boxes.cx[n] = (float)(x*CHUNK_SIZE) + CHUNK_SIZE*0.5f;
+				boxes.cy[n] = (float)(y*CHUNK_SIZE) + CHUNK_SIZE*0.5f;
+				boxes.cz[n] = (float)(z*CHUNK_SIZE) + CHUNK_SIZE*0.5f;
+				boxes.ex[n] = boxes.ey[n] = boxes.ez[n] = CHUNK_SIZE*0.5f;
+			}
+		}
+	}
+
+	mat44_t proj, view_mat;
+	frustum_t frustum;
+	m_perspective(&proj, (float)ML_DEG2RAD(70.0), 16.f/9.f, 0.1f, (float)(view*CHUNK_SIZE));
+	uint64_t rng = 1;
+	int64_t batch_ns = 0, scalar_ns = 0;
+	size_t mismatches = 0, total_visible = 0;
+	const int trials = 64;
+	for (int t = 0; t < trials; ++t) {
+		rng = rand64(rng);
+		float yaw = (float)(rng % 3600) * (float)ML_TWO_PI / 3600.f;
+		float pitch = ((float)((rng >> 16) % 1000) / 1000.f - 0.5f) * 2.f;
+		vec3_t eye = { 0.f, 80.f, 0.f };
+		vec3_t at = { cosf(yaw) * cosf(pitch), 80.f + sinf(pitch), sinf(yaw) * cosf(pitch) };
+		m_lookat(&view_mat, eye, at, m_up);
+		m_makefrustum(&frustum, &proj, &view_mat);
+
+		int64_t start = sys_timens();
+		size_t nvisible = collide_frustum_aabb_batch(&frustum, &boxes, visible);
+		batch_ns += sys_timens() - start;
+		total_visible += nvisible;
+
+		start = sys_timens();
+		size_t j = 0;
+		for (size_t i = 0; i < nboxes; ++i) {
+			vec3_t c = { boxes.cx[i], boxes.cy[i], boxes.cz[i] };
+			vec3_t e = { boxes.ex[i], boxes.ey[i], boxes.ez[i] };
+			bool vis = collide_frustum_aabb(&frustum, c, e) != ML_OUTSIDE;
+			bool batch_vis = (j < nvisible && visible[j] == i);
+			if (batch_vis)
+				++j;
+			mismatches += (vis != batch_vis);
+		}
+		scalar_ns += sys_timens() - start;
+	}
+	printf("culltest: %zu boxes, %zu visible per frame, %zu mismatches (%s)\n",
+	       nboxes, total_visible / trials, mismatches, ML_SSE ? "sse" : "scalar");
+	printf("batch %.3f ms/frame (%.2f ns/box), per-box loop %.3f ms/frame\n",
+	       (double)batch_ns / trials / 1e6, (double)batch_ns / trials / (double)nboxes,
+	       (double)scalar_ns / trials / 1e6);
+	mem_free(soa);
+	mem_free(visible);
+	return mismatches == 0 ? 0 : 1;
+}
+
@@ -0,0 +1,10 @@
+#pragma once
+
+/*
+  Self tests and benchmarks for math3d, run from the command line
+  ("roam mathtest", "roam culltest"). They need no window or GL
+  context. Each returns 0 if every check passed.
+ */
+
+int mathtest_simd(void);
+int mathtest_cull(void);
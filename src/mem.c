@@ -0,0 +1,155 @@
+#include "common.h"
+#include "math3d.h"
+#include "mem.h"
+#include "ui.h"
+#include "script.h"
+
+#define MEM_MAGIC 0x6d656d21 // "mem!"
+
+// 16 bytes, keeps the payload aligned like malloc
+struct mem_header {
+	uint64_t size;
+	uint32_t tag;
+	uint32_t magic;
+};
+
+static const char* mem_names[NUM_MEM_TAGS] = {
+	"map",
+	"mesh",
+	"gpu",
+	"ui",
+	"script",
+	"cache",
+	"misc",
+};
+
+static struct mem_stats tag_stats[NUM_MEM_TAGS];
+static SDL_SpinLock mem_lock;
+
+
+static
+void account(int tag, ptrdiff_t bytes, int count)
+{
+	SDL_AtomicLock(&mem_lock);
+	struct mem_stats* s = tag_stats + tag;
+	s->current += bytes;
+	s->count += count;
+	if (count > 0)
+		s->total += count;
+	if (s->current > s->peak)
+		s->peak = s->current;
+	SDL_AtomicUnlock(&mem_lock);
+}
+
+static inline
+struct mem_header* header_of(void* ptr)
+{
+	struct mem_header* h = (struct mem_header*)ptr - 1;
+	if (h->magic != MEM_MAGIC)
+		fatal_error("mem_free: %p was not allocated by mem_alloc", ptr);
+	return h;
+}
+
+static
+void mem_cmd(int argc, char** argv)
+{
+	size_t total = 0, peak = 0;
+	ui_console_printf("%-8s %10s %10s %8s", "tag", "kB", "peak kB", "allocs");
+	for (int i = 0; i < NUM_MEM_TAGS; ++i) {
+		ui_console_printf("%-8s %10zu %10zu %8zu", mem_names[i],
+		                  tag_stats[i].current / 1024, tag_stats[i].peak / 1024, tag_stats[i].count);
+		total += tag_stats[i].current;
+		peak += tag_stats[i].peak;
+	}
+	ui_console_printf("%-8s %10zu %10zu", "total", total / 1024, peak / 1024);
+}
+
+void mem_init()
+{
+	memset(tag_stats, 0, sizeof(tag_stats));
+}
+
+void mem_init_commands()
+{
+	script_defun("mem", mem_cmd);
+}
+
+void mem_exit()
+{
+	for (int i = 0; i < NUM_MEM_TAGS; ++i) {
+		if (tag_stats[i].current != 0 || tag_stats[i].count != 0)
+			printf("* mem: %s leaked %zu bytes in %zu allocations (peak %zu kB)\n",
+			       mem_names[i], tag_stats[i].current, tag_stats[i].count, tag_stats[i].peak / 1024);
+	}
+}
+
+void* mem_alloc(int tag, size_t size)
+{
+	struct mem_header* h = malloc(sizeof(struct mem_header) + size);
+	if (h == NULL)
+		fatal_error("mem_alloc: out of memory (%zu bytes for %s)", size, mem_names[tag]);
+	h->size = size;
+	h->tag = tag;
+	h->magic = MEM_MAGIC;
+	account(tag, size, 1);
+	return h + 1;
+}
+
+void* mem_calloc(int tag, size_t n, size_t size)
+{
+	void* ptr = mem_alloc(tag, n * size);
+	memset(ptr, 0, n * size);
+	return ptr;
+}
+
+void* mem_realloc(int tag, void* ptr, size_t size)
+{
+	if (ptr == NULL)
+		return mem_alloc(tag, size);
+	struct mem_header* h = header_of(ptr);
+	size_t old = h->size;
+	int oldtag = h->tag;
+	h = realloc(h, sizeof(struct mem_header) + size);
+	if (h == NULL)
+		fatal_error("mem_realloc: out of memory (%zu bytes for %s)", size, mem_names[tag]);
+	h->size = size;
+	h->tag = tag;
+	account(oldtag, -(ptrdiff_t)old, -1);
+	account(tag, size, 1);
+	return h + 1;
+}
+
+char* mem_strdup(int tag, const char* str)
+{
+	size_t len = strlen(str) + 1;
+	char* copy = mem_alloc(tag, len);
+	memcpy(copy, str, len);
+	return copy;
+}
+
+void mem_free(void* ptr)
+{
+	if (ptr == NULL)
+		return;
+	struct mem_header* h = header_of(ptr);
+	account(h->tag, -(ptrdiff_t)h->size, -1);
+	h->magic = 0;
+	free(h);
+}
+
+void mem_track(int tag, ptrdiff_t bytes)
+{
+	if (bytes == 0)
+		return;
+	account(tag, bytes, (bytes > 0) ? 1 : -1);
+}
+
+const struct mem_stats* mem_stats(int tag)
+{
+	return tag_stats + tag;
+}
+
+const char* mem_tag_name(int tag)
+{
+	return mem_names[tag];
+}
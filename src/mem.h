@@ -0,0 +1,42 @@
+#pragma once
+#include "common.h"
+
+/*
+  Tagged allocation layer. Every block carries a small header with
+  its size and tag so per-subsystem current/peak usage can be
+  tracked, and anything still allocated at exit is reported.
+  Memory from mem_alloc & co must be released with mem_free.
+
+  mem_track() accounts for memory we don't allocate ourselves (GPU
+  buffers, static arrays).
+ */
+
+enum MemTags {
+	MEM_MAP,
+	MEM_MESH, // CPU-side mesh data
+	MEM_GPU,
+	MEM_UI,
+	MEM_SCRIPT,
+	MEM_CACHE,
+	MEM_MISC,
+	NUM_MEM_TAGS
+};
+
+struct mem_stats {
+	size_t current;
+	size_t peak;
+	size_t count; // live allocations
+	uint64_t total; // allocations made
+};
+
+void  mem_init(void); // before any tagged allocation
+void  mem_init_commands(void); // the mem console command, after script_init
+void  mem_exit(void); // reports leaks
+void* mem_alloc(int tag, size_t size);
+void* mem_calloc(int tag, size_t n, size_t size);
+void* mem_realloc(int tag, void* ptr, size_t size);
+char* mem_strdup(int tag, const char* str);
+void  mem_free(void* ptr);
+void  mem_track(int tag, ptrdiff_t bytes);
+const struct mem_stats* mem_stats(int tag);
+const char* mem_tag_name(int tag);
@@ -0,0 +1,198 @@
+#include "common.h"
+#include "math3d.h"
+#include "meshopt.h"
+#include "mem.h"
+
+/*
+  Vertex cache ordering after Tom Forsyth, "Linear-Speed Vertex Cache
+  Optimisation". Every vertex gets a score from its position in a
+  simulated LRU cache and from how many triangles still use it; the
+  next triangle is the best scoring one among those touching the
+  cache.
+ */
+
+#define FORSYTH_CACHE_DECAY 1.5f
+#define FORSYTH_LAST_TRI 0.75f
+#define FORSYTH_VALENCE_SCALE 2.0f
+#define FORSYTH_VALENCE_POWER 0.5f
+#define FORSYTH_MAX_VALENCE 64
+
+static float cache_scores[MESHOPT_CACHE_SIZE];
+static float valence_scores[FORSYTH_MAX_VALENCE];
+
+
+static
+void forsyth_init()
+{
+	if (valence_scores[1] != 0.f)
+		return;
+	for (int i = 0; i < MESHOPT_CACHE_SIZE; ++i) {
+		if (i < 3) {
+			cache_scores[i] = FORSYTH_LAST_TRI;
+		} else {
+			float s = 1.f - (float)(i - 3) / (float)(MESHOPT_CACHE_SIZE - 3);
+			cache_scores[i] = powf(s, FORSYTH_CACHE_DECAY);
+		}
+	}
+	for (int i = 1; i < FORSYTH_MAX_VALENCE; ++i)
+		valence_scores[i] = FORSYTH_VALENCE_SCALE * powf((float)i, -FORSYTH_VALENCE_POWER);
+}
+
+static inline
+float vertex_score(int cachepos, uint32_t valence)
+{
+	if (valence == 0)
+		return -1.f; // no triangles left, never picked
+	float score = (cachepos >= 0) ? cache_scores[cachepos] : 0.f;
+	return score + valence_scores[ML_MIN(valence, FORSYTH_MAX_VALENCE - 1)];
+}
+
+void meshopt_vertex_cache(uint32_t* dst, const uint32_t* indices, size_t nindices, size_t nverts)
+{
+	size_t ntris = nindices / 3;
+	if (ntris == 0)
+		return;
+	forsyth_init();
+
+	// triangles of each vertex: adjacency[offsets[v] .. offsets[v] + valence[v]]
+	uint32_t* valence = mem_calloc(MEM_MESH, nverts, sizeof(uint32_t));
+	uint32_t* offsets = mem_alloc(MEM_MESH, nverts * sizeof(uint32_t));
+	uint32_t* adjacency = mem_alloc(MEM_MESH, nindices * sizeof(uint32_t));
+	int* cachepos = mem_alloc(MEM_MESH, nverts * sizeof(int));
+	float* vscore = mem_alloc(MEM_MESH, nverts * sizeof(float));
+	float* tscore = mem_alloc(MEM_MESH, ntris * sizeof(float));
+	bool* emitted = mem_calloc(MEM_MESH, ntris, sizeof(bool));
+
+	for (size_t i = 0; i < nindices; ++i)
+		valence[indices[i]]++;
+	uint32_t sum = 0;
+	for (size_t v = 0; v < nverts; ++v) {
+		offsets[v] = sum;
+		sum += valence[v];
+		valence[v] = 0;
+	}
+	for (size_t i = 0; i < nindices; ++i) {
+		uint32_t v = indices[i];
+		adjacency[offsets[v] + valence[v]++] = (uint32_t)(i / 3);
+	}
+	for (size_t v = 0; v < nverts; ++v) {
+		cachepos[v] = -1;
+		vscore[v] = vertex_score(-1, valence[v]);
+	}
+	size_t best = 0;
+	for (size_t t = 0; t < ntris; ++t) {
+		tscore[t] = vscore[indices[t*3]] + vscore[indices[t*3 + 1]] + vscore[indices[t*3 + 2]];
+		if (tscore[t] > tscore[best])
+			best = t;
+	}
+
+	uint32_t cache[MESHOPT_CACHE_SIZE + 3];
+	int cachelen = 0;
+	size_t cursor = 0; // fallback scan when nothing in the cache has triangles left
+
+	for (size_t out = 0; out < ntris; ++out) {
+		if (best == SIZE_MAX) {
+			while (emitted[cursor])
+				++cursor;
+			best = cursor;
+		}
+		const uint32_t* tri = indices + best * 3;
+		memcpy(dst + out * 3, tri, 3 * sizeof(uint32_t));
+		emitted[best] = true;
+
+		// drop the triangle from its vertices and move them to the front
+		uint32_t newcache[MESHOPT_CACHE_SIZE + 3];
+		int newlen = 0;
+		for (int k = 0; k < 3; ++k) {
+			uint32_t v = tri[k];
+			uint32_t* adj = adjacency + offsets[v];
+			for (uint32_t j = 0; j < valence[v]; ++j) {
+				if (adj[j] == best) {
+					adj[j] = adj[--valence[v]];
+					break;
+				}
+			}
+			newcache[newlen++] = v;
+		}
+		for (int i = 0; i < cachelen; ++i) {
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+				newcache[newlen++] = v;
+		}
+
+		// rescore everything that was or is in the cache
+		for (int i = 0; i < newlen; ++i) {
+			uint32_t v = newcache[i];
+			cachepos[v] = (i < MESHOPT_CACHE_SIZE) ? i : -1;
+			float s = vertex_score(cachepos[v], valence[v]);
+			float delta = s - vscore[v];
+			vscore[v] = s;
+			const uint32_t* adj = adjacency + offsets[v];
+			for (uint32_t j = 0; j < valence[v]; ++j)
+				tscore[adj[j]] += delta;
+		}
+		best = SIZE_MAX;
+		float bestscore = -FLT_MAX;
+		for (int i = 0; i < newlen && i < MESHOPT_CACHE_SIZE; ++i) {
+			uint32_t v = newcache[i];
+			const uint32_t* adj = adjacency + offsets[v];
+			for (uint32_t j = 0; j < valence[v]; ++j) {
+				if (tscore[adj[j]] > bestscore) {
+					bestscore = tscore[adj[j]];
+					best = adj[j];
+				}
+			}
+		}
+		cachelen = ML_MIN(newlen, MESHOPT_CACHE_SIZE);
+		memcpy(cache, newcache, (size_t)cachelen * sizeof(uint32_t));
+	}
+
+	mem_free(valence);
+	mem_free(offsets);
+	mem_free(adjacency);
+	mem_free(cachepos);
+	mem_free(vscore);
+	mem_free(tscore);
+	mem_free(emitted);
+}
+
+size_t meshopt_vertex_fetch(uint32_t* remap, uint32_t* indices, size_t nindices, size_t nverts)
+{
+	uint32_t next = 0;
+	memset(remap, 0xff, nverts * sizeof(uint32_t));
+	for (size_t i = 0; i < nindices; ++i) {
+		uint32_t v = indices[i];
+		if (remap[v] == UINT32_MAX)
+			remap[v] = next++;
+		indices[i] = remap[v];
+	}
+	return next;
+}
+
+void meshopt_remap(void* data, size_t size, const uint32_t* remap, size_t nverts)
+{
+	uint8_t* tmp = mem_alloc(MEM_MESH, nverts * size);
+	memcpy(tmp, data, nverts * size);
+	for (size_t v = 0; v < nverts; ++v)
+		if (remap[v] != UINT32_MAX)
+			memcpy((uint8_t*)data + remap[v] * size, tmp + v * size, size);
+	mem_free(tmp);
+}
+
+double meshopt_acmr(const uint32_t* indices, size_t nindices, size_t nverts, int cachesize)
+{
+	if (nindices < 3)
+		return 0.0;
+	// a vertex is in the FIFO while fewer than cachesize misses happened since it was loaded
+	size_t* loaded = mem_alloc(MEM_MESH, nverts * sizeof(size_t));
+	size_t misses = 0;
+	for (size_t v = 0; v < nverts; ++v)
+		loaded[v] = SIZE_MAX;
+	for (size_t i = 0; i < nindices; ++i) {
+		uint32_t v = indices[i];
+		if (loaded[v] == SIZE_MAX || misses - loaded[v] >= (size_t)cachesize)
+			loaded[v] = misses++;
+	}
+	mem_free(loaded);
+	return (double)misses / (double)(nindices / 3);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "common.h"
+
+/*
+  Offline optimization of indexed triangle lists, run once when a
+  model is loaded.
+ */
+
+// post-transform cache size the triangle order is tuned for
+#define MESHOPT_CACHE_SIZE 32
+
+// reorders triangles for vertex cache hits (Forsyth's linear-speed
+// algorithm). dst and indices may not overlap.
+void meshopt_vertex_cache(uint32_t* dst, const uint32_t* indices, size_t nindices, size_t nverts);
+
+// builds remap[old vertex] = new vertex in order of first use, and
+// rewrites indices to match. Unused vertices get UINT32_MAX. Returns
+// the number of vertices in use.
+size_t meshopt_vertex_fetch(uint32_t* remap, uint32_t* indices, size_t nindices, size_t nverts);
+
+// moves nverts elements of size bytes into their remapped slots
+void meshopt_remap(void* data, size_t size, const uint32_t* remap, size_t nverts);
+
+// average cache misses per triangle for a FIFO cache of cachesize,
+// 0.5 is ideal and 3 is no reuse at all
+double meshopt_acmr(const uint32_t* indices, size_t nindices, size_t nverts, int cachesize);
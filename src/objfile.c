@@ -1,128 +1,503 @@
 #include "common.h"
 #include "math3d.h"
 #include "objfile.h"
+#include "mem.h"
+#include "meshopt.h"
 
-#define LINEBUF_SIZE 1024
+#define OBJ_MAX_FACE 64 // corners in one polygon
+#define OBJ_NO_INDEX UINT32_MAX
+
+#define OBJCACHE_MAGIC 0x4a424f52 // "ROBJ"
+#define OBJCACHE_VERSION 2
+
+/*
+  Everything the parser accumulates. Positions, texcoords and normals
+  are the raw v / vt / vn lists; keys holds the (v, vt, vn) triple of
+  each output vertex and table maps triples to output vertices.
+ */
+struct obj_parser {
+	float* pos;
+	size_t npos;
+	size_t poscap;
+	float* tc;
+	size_t ntc;
+	size_t tccap;
+	float* n;
+	size_t nn;
+	size_t ncap;
+
+	uint32_t* keys;
+	size_t nkeys;
+	size_t keycap;
+	uint32_t* table; // open addressing, OBJ_NO_INDEX = empty
+	size_t tablecap;
+
+	uint32_t* indices;
+	size_t nindices;
+	size_t icap;
+
+	int line;
+};
 
 static
-bool read_line(char* to, const char** data)
-{
-	char* wp = to;
-	const char* buf = *data;
-	while (wp == to) {
-		if (!*buf)
-			return false;
-		// skip whitespace
-		while (*buf && isspace(*buf))
-			++buf;
-		// skip comments
-		if (*buf == '#') {
-			while (*buf && *buf != '\n')
-				++buf;
-			continue;
-		}
-		// copy line data
-		while (*buf && *buf != '\n') {
-			*wp++ = *buf++;
-			if (wp - to >= LINEBUF_SIZE)
-				fatal_error("objLoad: Line too long");
-		}
-	}
-	*data = buf;
-	*wp = '\0';
-	return true;
+void* grow(void* ptr, size_t* cap, size_t need, size_t elemsize)
+{
+	if (need <= *cap)
+		return ptr;
+	while (*cap < need)
+		*cap *= 2;
+	return mem_realloc(MEM_MESH, ptr, *cap * elemsize);
+}
+
+static inline
+bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+static inline
+const char* skip_blank(const char* p, const char* end)
+{
+	while (p < end && is_blank(*p))
+		++p;
+	return p;
+}
+
+static inline
+const char* skip_line(const char* p, const char* end)
+{
+	while (p < end && *p != '\n')
+		++p;
+	return p;
 }
 
 /*
-  Based on stb.h: stb_strtok_raw()
+  Decimal to float without strtod: up to 18 significant digits go into
+  an integer mantissa, then one multiply or divide by an exact power of
+  ten. Exact for the short fixed-point numbers exporters write; very
+  long or extreme values fall back to pow().
  */
+static const double pow10_table[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
 static
-char* strtok_x(char* output, char* tokens, const char* delim)
+const char* parse_float(const char* p, const char* end, float* out)
 {
-	while (*tokens && strchr(delim, *tokens) != NULL)
-		tokens++;
-	while (*tokens && strchr(delim, *tokens) == NULL)
-		*output++ = *tokens++;
-	*output = '\0';
-	return *tokens ? tokens + 1 : tokens;
+	bool neg = false;
+	uint64_t mant = 0;
+	int exp = 0;
+	const char* start;
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = (*p++ == '-');
+	start = p;
+	for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+		if (mant < 100000000000000000ull)
+			mant = mant * 10 + (uint64_t)(*p - '0');
+		else
+			exp++;
+	}
+	if (p < end && *p == '.') {
+		for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+			if (mant < 100000000000000000ull) {
+				mant = mant * 10 + (uint64_t)(*p - '0');
+				exp--;
+			}
+		}
+	}
+	if (p == start)
+		return NULL;
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		bool eneg = false;
+		int e = 0;
+		++p;
+		if (p < end && (*p == '-' || *p == '+'))
+			eneg = (*p++ == '-');
+		for (; p < end && *p >= '0' && *p <= '9'; ++p)
+			if (e < 10000)
+				e = e * 10 + (*p - '0');
+		exp += eneg ? -e : e;
+	}
+	double v = (double)mant;
+	if (mant == 0)
+		v = 0.0;
+	else if (exp < 0 && exp >= -22)
+		v /= pow10_table[-exp];
+	else if (exp > 0 && exp <= 22)
+		v *= pow10_table[exp];
+	else if (exp != 0)
+		v *= pow(10.0, exp);
+	*out = (float)(neg ? -v : v);
+	return p;
 }
 
-// this data
+// .obj indices are 1-based, negative ones count back from the end
+static
+const char* parse_index(struct obj_parser* op, const char* p, const char* end, size_t count, uint32_t* out)
+{
+	bool neg = false;
+	int64_t idx = 0;
+	const char* start;
+	if (p < end && *p == '-') {
+		neg = true;
+		++p;
+	}
+	start = p;
+	for (; p < end && *p >= '0' && *p <= '9'; ++p)
+		idx = idx * 10 + (*p - '0');
+	if (p == start || idx == 0)
+		fatal_error("obj: bad index on line %d", op->line);
+	idx = neg ? (int64_t)count - idx : idx - 1;
+	if (idx < 0 || idx >= (int64_t)count)
+		fatal_error("obj: index out of bounds on line %d", op->line);
+	*out = (uint32_t)idx;
+	return p;
+}
 
 static
-void push_vert(obj_t* m, float* v, size_t n)
+const char* parse_floats(struct obj_parser* op, const char* p, const char* end, float* out, size_t min, size_t max)
 {
-	if (n != 3)
-		fatal_error("Only 3D vertices allowed in obj: n = %zu", n);
-	while (m->nverts + n > m->vcap) {
-		m->vcap *= 2;
-		m->verts = realloc(m->verts, m->vcap * sizeof(float));
+	size_t i = 0;
+	for (;;) {
+		p = skip_blank(p, end);
+		if (p >= end || *p == '\n' || *p == '#')
+			break;
+		float v = 0.f;
+		p = parse_float(p, end, &v);
+		if (p == NULL)
+			fatal_error("obj: bad number on line %d", op->line);
+		if (i < max)
+			out[i] = v;
+		++i;
 	}
-	memcpy(m->verts + m->nverts, v, n * sizeof(float));
-	m->nverts += n;
+	if (i < min)
+		fatal_error("obj: expected %zu values on line %d", min, op->line);
+	return p;
+}
+
+static inline
+uint32_t key_hash(const uint32_t* key)
+{
+	uint64_t h = ((uint64_t)key[0] * 0x9e3779b97f4a7c15ull) ^
+		((uint64_t)key[1] * 0xc2b2ae3d27d4eb4full) ^
+		((uint64_t)key[2] * 0x165667b19e3779f9ull);
+	return (uint32_t)(h ^ (h >> 32));
 }
 
 static
-void push_face(obj_t* m, uint32_t* f, size_t n)
+void table_rehash(struct obj_parser* op, size_t cap)
 {
-	if (n != 3)
-		fatal_error("Only triangles allowed in obj: n = %zu", n);
-	while (m->nindices + n > m->fcap) {
-		m->fcap *= 2;
-		m->indices = realloc(m->indices, m->fcap * sizeof(uint32_t));
+	mem_free(op->table);
+	op->table = mem_alloc(MEM_MESH, cap * sizeof(uint32_t));
+	op->tablecap = cap;
+	memset(op->table, 0xff, cap * sizeof(uint32_t));
+	for (size_t k = 0; k < op->nkeys; ++k) {
+		size_t i = key_hash(op->keys + k * 3) & (cap - 1);
+		while (op->table[i] != OBJ_NO_INDEX)
+			i = (i + 1) & (cap - 1);
+		op->table[i] = (uint32_t)k;
 	}
-	memcpy(m->indices + m->nindices, f, n * sizeof(uint32_t));
-	m->nindices += n;
 }
 
-void obj_load(obj_t* mesh, const char* data, float vscale)
+// output vertex for a (v, vt, vn) triple, added if it's new
+static
+uint32_t vertex_index(struct obj_parser* op, const uint32_t* key)
 {
-	char linebuf[LINEBUF_SIZE];
-	char tokbuf[LINEBUF_SIZE];
-	const char* delim = " \t\r\n";
-	float tmpvert[4];
-	uint32_t tmpindex[3];
-	size_t i;
+	size_t i = key_hash(key) & (op->tablecap - 1);
+	for (; op->table[i] != OBJ_NO_INDEX; i = (i + 1) & (op->tablecap - 1)) {
+		const uint32_t* k = op->keys + op->table[i] * 3;
+		if (k[0] == key[0] && k[1] == key[1] && k[2] == key[2])
+			return op->table[i];
+	}
+	uint32_t idx = (uint32_t)op->nkeys;
+	op->keys = grow(op->keys, &op->keycap, (op->nkeys + 1) * 3, sizeof(uint32_t));
+	memcpy(op->keys + op->nkeys * 3, key, 3 * sizeof(uint32_t));
+	op->table[i] = idx;
+	if (++op->nkeys * 2 > op->tablecap)
+		table_rehash(op, op->tablecap * 2);
+	return idx;
+}
+
+static
+const char* parse_face(struct obj_parser* op, const char* p, const char* end)
+{
+	uint32_t corners[OBJ_MAX_FACE];
+	size_t n = 0;
+	size_t npos = op->npos / 3, ntc = op->ntc / 2, nn = op->nn / 3;
+	for (;;) {
+		uint32_t key[3] = { OBJ_NO_INDEX, OBJ_NO_INDEX, OBJ_NO_INDEX };
+		p = skip_blank(p, end);
+		if (p >= end || *p == '\n' || *p == '#')
+			break;
+		if (n == OBJ_MAX_FACE)
+			fatal_error("obj: too many vertices in face on line %d", op->line);
+		p = parse_index(op, p, end, npos, &key[0]);
+		if (p < end && *p == '/') {
+			++p;
+			if (p < end && *p != '/')
+				p = parse_index(op, p, end, ntc, &key[1]);
+			if (p < end && *p == '/')
+				p = parse_index(op, p + 1, end, nn, &key[2]);
+		}
+		if (p < end && !is_blank(*p) && *p != '\n')
+			fatal_error("obj: bad face on line %d", op->line);
+		corners[n++] = vertex_index(op, key);
+	}
+	if (n < 3)
+		fatal_error("obj: face with %zu vertices on line %d", n, op->line);
+	// fan triangulation, fine for the convex polygons exporters write
+	op->indices = grow(op->indices, &op->icap, op->nindices + (n - 2) * 3, sizeof(uint32_t));
+	for (size_t i = 2; i < n; ++i) {
+		op->indices[op->nindices++] = corners[0];
+		op->indices[op->nindices++] = corners[i - 1];
+		op->indices[op->nindices++] = corners[i];
+	}
+	return p;
+}
+
+// moves the parse results into mesh->storage
+static
+void obj_build(obj_t* mesh, struct obj_parser* op)
+{
+	size_t nv = op->nkeys;
+	bool has_tc = op->ntc > 0, has_n = op->nn > 0;
+	size_t floats = nv * (3 + (has_tc ? 2 : 0) + (has_n ? 3 : 0));
+	mesh->storage = mem_alloc(MEM_MESH, floats * sizeof(float) + op->nindices * sizeof(uint32_t));
+	mesh->verts = (float*)mesh->storage;
+	mesh->texcoords = has_tc ? mesh->verts + nv * 3 : NULL;
+	mesh->normals = has_n ? mesh->verts + nv * (has_tc ? 5 : 3) : NULL;
+	mesh->indices = (uint32_t*)(mesh->verts + floats);
+	mesh->nverts = nv * 3;
+	mesh->nindices = op->nindices;
+	for (size_t i = 0; i < nv; ++i) {
+		const uint32_t* k = op->keys + i * 3;
+		memcpy(mesh->verts + i * 3, op->pos + k[0] * 3, 3 * sizeof(float));
+		if (has_tc) {
+			float* tc = mesh->texcoords + i * 2;
+			if (k[1] != OBJ_NO_INDEX)
+				memcpy(tc, op->tc + k[1] * 2, 2 * sizeof(float));
+			else
+				tc[0] = tc[1] = 0.f;
+		}
+		if (has_n) {
+			float* n = mesh->normals + i * 3;
+			if (k[2] != OBJ_NO_INDEX)
+				memcpy(n, op->n + k[2] * 3, 3 * sizeof(float));
+			else
+				n[0] = n[1] = n[2] = 0.f;
+		}
+	}
+	memcpy(mesh->indices, op->indices, op->nindices * sizeof(uint32_t));
+}
+
+void obj_load(obj_t* mesh, const char* data, size_t len, float vscale)
+{
+	struct obj_parser op;
+	const char* p = data;
+	const char* end = data + len;
+	// a vertex line is rarely shorter than 24 bytes, so this saves most regrowing
+	size_t guess = ML_MAX(len / 24, 64);
 
 	memset(mesh, 0, sizeof(obj_t));
-	mesh->vcap = 1024;
-	mesh->fcap = 1024;
-	mesh->verts = malloc(mesh->vcap * sizeof(float));
-	mesh->indices = malloc(mesh->fcap * sizeof(uint32_t));
-
-	while (read_line(linebuf, &data)) {
-		char* tok = strtok_x(tokbuf, linebuf, delim);
-		if (strcmp(tokbuf, "v") == 0) {
-			// vertex
-			i = 0;
-			do {
-				tok = strtok_x(tokbuf, tok, delim);
-				tmpvert[i++] = atof(tokbuf) * vscale;
-				if (i > 4)
-					fatal_error("Too many dimensions (%d) in .obj vertex", i);
-			} while (*tok != '\0');
-			push_vert(mesh, tmpvert, i);
-		} else if (strcmp(tokbuf, "f") == 0) {
-			i = 0;
-			do {
-				tok = strtok_x(tokbuf, tok, delim);
-				// - 1 because .obj indices are 1-based
-				tmpindex[i++] = (uint32_t)atol(tokbuf) - 1;
-				if (i > 3)
-					fatal_error("Too many vertices in face (%d)", i);
-			} while (*tok != '\0');
-			push_face(mesh, tmpindex, i);
-		} else {
-			// TODO: vt, vn, f v/vt/vn
-			fatal_error("Unhandled token: '%s'", tokbuf);
+	memset(&op, 0, sizeof(op));
+	op.poscap = guess * 3;
+	op.tccap = 64;
+	op.ncap = 64;
+	op.keycap = guess * 3;
+	op.icap = guess * 6;
+	op.pos = mem_alloc(MEM_MESH, op.poscap * sizeof(float));
+	op.tc = mem_alloc(MEM_MESH, op.tccap * sizeof(float));
+	op.n = mem_alloc(MEM_MESH, op.ncap * sizeof(float));
+	op.keys = mem_alloc(MEM_MESH, op.keycap * sizeof(uint32_t));
+	op.indices = mem_alloc(MEM_MESH, op.icap * sizeof(uint32_t));
+	table_rehash(&op, 1024);
+
+	for (op.line = 1; p < end; ++op.line) {
+		float v[4];
+		p = skip_blank(p, end);
+		if (p + 1 < end && p[0] == 'v' && is_blank(p[1])) {
+			p = parse_floats(&op, p + 2, end, v, 3, 4);
+			op.pos = grow(op.pos, &op.poscap, op.npos + 3, sizeof(float));
+			for (int i = 0; i < 3; ++i)
+				op.pos[op.npos++] = v[i] * vscale;
+		} else if (p + 2 < end && p[0] == 'v' && p[1] == 't' && is_blank(p[2])) {
+			v[1] = 0.f;
+			p = parse_floats(&op, p + 3, end, v, 1, 3);
+			op.tc = grow(op.tc, &op.tccap, op.ntc + 2, sizeof(float));
+			op.tc[op.ntc++] = v[0];
+			op.tc[op.ntc++] = v[1];
+		} else if (p + 2 < end && p[0] == 'v' && p[1] == 'n' && is_blank(p[2])) {
+			p = parse_floats(&op, p + 3, end, v, 3, 3);
+			op.n = grow(op.n, &op.ncap, op.nn + 3, sizeof(float));
+			for (int i = 0; i < 3; ++i)
+				op.n[op.nn++] = v[i];
+		} else if (p + 1 < end && p[0] == 'f' && is_blank(p[1])) {
+			p = parse_face(&op, p + 2, end);
 		}
+		// comments, blank lines and what we don't use (o, g, s, usemtl, mtllib, l)
+		p = skip_line(p, end);
+		if (p < end)
+			++p;
+	}
+
+	obj_build(mesh, &op);
+	mem_free(op.pos);
+	mem_free(op.tc);
+	mem_free(op.n);
+	mem_free(op.keys);
+	mem_free(op.table);
+	mem_free(op.indices);
+}
+
+/*
+  Cache file next to the .obj: a header and then the storage block
+  exactly as obj_build lays it out. It is only used if its recorded
+  size, mtime and scale match the source.
+ */
+struct objcache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t src_size;
+	int64_t src_mtime;
+	float vscale;
+	uint32_t flags; // 1 = texcoords, 2 = normals
+	uint32_t nverts;
+	uint32_t nindices;
+};
+
+static
+size_t storage_size(const obj_t* mesh)
+{
+	size_t nv = mesh->nverts / 3;
+	size_t floats = nv * (3 + (mesh->texcoords ? 2 : 0) + (mesh->normals ? 3 : 0));
+	return floats * sizeof(float) + mesh->nindices * sizeof(uint32_t);
+}
+
+static
+bool objcache_read(obj_t* mesh, const char* filename, uint64_t src_size, int64_t src_mtime, float vscale)
+{
+	struct objcache_header h;
+	FILE* f = fopen(filename, "rb");
+	if (f == NULL)
+		return false;
+	if (fread(&h, sizeof(h), 1, f) != 1 || h.magic != OBJCACHE_MAGIC || h.version != OBJCACHE_VERSION ||
+	    h.src_size != src_size || h.src_mtime != src_mtime || h.vscale != vscale) {
+		fclose(f);
+		return false;
+	}
+	memset(mesh, 0, sizeof(obj_t));
+	size_t nv = h.nverts;
+	size_t floats = nv * (3 + ((h.flags & 1) ? 2 : 0) + ((h.flags & 2) ? 3 : 0));
+	size_t size = floats * sizeof(float) + h.nindices * sizeof(uint32_t);
+	mesh->storage = mem_alloc(MEM_MESH, size);
+	if (fread(mesh->storage, size, 1, f) != 1) {
+		fclose(f);
+		mem_free(mesh->storage);
+		mesh->storage = NULL;
+		return false;
+	}
+	fclose(f);
+	mesh->verts = (float*)mesh->storage;
+	mesh->texcoords = (h.flags & 1) ? mesh->verts + nv * 3 : NULL;
+	mesh->normals = (h.flags & 2) ? mesh->verts + nv * ((h.flags & 1) ? 5 : 3) : NULL;
+	mesh->indices = (uint32_t*)(mesh->verts + floats);
+	mesh->nverts = nv * 3;
+	mesh->nindices = h.nindices;
+	return true;
+}
+
+static
+void objcache_write(const obj_t* mesh, const char* filename, uint64_t src_size, int64_t src_mtime, float vscale)
+{
+	struct objcache_header h;
+	memset(&h, 0, sizeof(h));
+	h.magic = OBJCACHE_MAGIC;
+	h.version = OBJCACHE_VERSION;
+	h.src_size = src_size;
+	h.src_mtime = src_mtime;
+	h.vscale = vscale;
+	h.flags = (mesh->texcoords ? 1 : 0) | (mesh->normals ? 2 : 0);
+	h.nverts = (uint32_t)(mesh->nverts / 3);
+	h.nindices = (uint32_t)mesh->nindices;
+	FILE* f = fopen(filename, "wb");
+	if (f == NULL)
+		return;
+	bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+		fwrite(mesh->storage, storage_size(mesh), 1, f) == 1;
+	if (fclose(f) != 0 || !ok) {
+		printf("obj: failed to write %s\n", filename);
+		remove(filename);
+	}
+}
+
+bool obj_loadfile(obj_t* mesh, const char* filename, float vscale)
+{
+	char cachename[512];
+	uint64_t size;
+	int64_t mtime;
+	if (!sys_filestat(filename, &size, &mtime))
+		return false;
+	snprintf(cachename, sizeof(cachename), "%s.cache", filename);
+	if (objcache_read(mesh, cachename, size, mtime, vscale))
+		return true;
+
+	size_t len;
+	const char* data = sys_mapfile(filename, &len);
+	if (data == NULL)
+		return false;
+	obj_load(mesh, data, len, vscale);
+	sys_unmapfile(data, len);
+	obj_optimize(mesh);
+	objcache_write(mesh, cachename, size, mtime, vscale);
+	return true;
+}
+
+void obj_optimize(obj_t* mesh)
+{
+	size_t nv = mesh->nverts / 3;
+	uint32_t* tmp = mem_alloc(MEM_MESH, ML_MAX(mesh->nindices, nv) * sizeof(uint32_t));
+	meshopt_vertex_cache(tmp, mesh->indices, mesh->nindices, nv);
+	// some exporters already write a good order, keep it then
+	if (meshopt_acmr(tmp, mesh->nindices, nv, MESHOPT_CACHE_SIZE) <
+	    meshopt_acmr(mesh->indices, mesh->nindices, nv, MESHOPT_CACHE_SIZE))
+		memcpy(mesh->indices, tmp, mesh->nindices * sizeof(uint32_t));
+	// vertices nothing refers to end up after the used ones and are cut off
+	size_t used = meshopt_vertex_fetch(tmp, mesh->indices, mesh->nindices, nv);
+	uint32_t next = (uint32_t)used;
+	for (size_t v = 0; v < nv; ++v)
+		if (tmp[v] == UINT32_MAX)
+			tmp[v] = next++;
+	meshopt_remap(mesh->verts, 3 * sizeof(float), tmp, nv);
+	if (mesh->texcoords != NULL)
+		meshopt_remap(mesh->texcoords, 2 * sizeof(float), tmp, nv);
+	if (mesh->normals != NULL)
+		meshopt_remap(mesh->normals, 3 * sizeof(float), tmp, nv);
+	mem_free(tmp);
+	if (used < nv) {
+		// repack so the arrays stay contiguous in storage
+		obj_t packed = *mesh;
+		size_t floats = used * (3 + (mesh->texcoords ? 2 : 0) + (mesh->normals ? 3 : 0));
+		packed.storage = mem_alloc(MEM_MESH, floats * sizeof(float) + mesh->nindices * sizeof(uint32_t));
+		packed.verts = (float*)packed.storage;
+		packed.texcoords = mesh->texcoords ? packed.verts + used * 3 : NULL;
+		packed.normals = mesh->normals ? packed.verts + used * (mesh->texcoords ? 5 : 3) : NULL;
+		packed.indices = (uint32_t*)(packed.verts + floats);
+		packed.nverts = used * 3;
+		memcpy(packed.verts, mesh->verts, used * 3 * sizeof(float));
+		if (packed.texcoords != NULL)
+			memcpy(packed.texcoords, mesh->texcoords, used * 2 * sizeof(float));
+		if (packed.normals != NULL)
+			memcpy(packed.normals, mesh->normals, used * 3 * sizeof(float));
+		memcpy(packed.indices, mesh->indices, mesh->nindices * sizeof(uint32_t));
+		mem_free(mesh->storage);
+		*mesh = packed;
 	}
 }
 
 void obj_free(obj_t* mesh)
 {
-	free(mesh->verts);
-	free(mesh->indices);
+	mem_free(mesh->storage);
 	memset(mesh, 0, sizeof(obj_t));
 }
 
@@ -131,25 +506,35 @@ void obj_normals(obj_t* obj, void** vertexdata, size_t* vertexsize, GLenum* mesh
 {
 	size_t i;
 	size_t nvertices = obj->nverts / 3;
-	posnormalvert_t* verts = malloc(sizeof(posnormalvert_t) * nvertices);
+	posnormalvert_t* verts = mem_alloc(MEM_MESH, sizeof(posnormalvert_t) * nvertices);
 	for (i = 0; i < nvertices; ++i) {
 		memcpy(&verts[i].pos.x, obj->verts + (i * 3), sizeof(float) * 3);
 	}
 
-	for (i = 0; i < obj->nindices; i += 3) {
-		if (obj->indices[i + 0] > nvertices)
-			fatal_error("index out of bound: %u", obj->indices[i + 0]);
-		if (obj->indices[i + 1] > nvertices)
-			fatal_error("index out of bound: %u", obj->indices[i + 1]);
-		if (obj->indices[i + 2] > nvertices)
-			fatal_error("index out of bound: %u", obj->indices[i + 2]);
-		vec3_t t1 = verts[obj->indices[i + 0]].pos;
-		vec3_t t2 = verts[obj->indices[i + 1]].pos;
-		vec3_t t3 = verts[obj->indices[i + 2]].pos;
-		vec3_t n = m_vec3normalize(m_vec3cross(m_vec3sub(t2, t1), m_vec3sub(t3, t1)));
-		verts[obj->indices[i + 0]].n = n;
-		verts[obj->indices[i + 1]].n = n;
-		verts[obj->indices[i + 2]].n = n;
+	if (obj->normals != NULL) {
+		for (i = 0; i < nvertices; ++i)
+			memcpy(&verts[i].n.x, obj->normals + (i * 3), sizeof(float) * 3);
+	} else {
+		/*
+		  Smooth normals: every vertex gets the sum of its face
+		  normals weighted by face area (the unnormalized cross
+		  product). Faces meeting at a hard edge should use
+		  separate vertices, which exporters write as separate vn.
+		 */
+		for (i = 0; i < nvertices; ++i)
+			verts[i].n = m_vec3(0.f, 0.f, 0.f);
+		for (i = 0; i < obj->nindices; i += 3) {
+			uint32_t a = obj->indices[i + 0], b = obj->indices[i + 1], c = obj->indices[i + 2];
+			if (a >= nvertices || b >= nvertices || c >= nvertices)
+				fatal_error("index out of bound: %u %u %u", a, b, c);
+			vec3_t t1 = verts[a].pos;
+			vec3_t n = m_vec3cross(m_vec3sub(verts[b].pos, t1), m_vec3sub(verts[c].pos, t1));
+			verts[a].n = m_vec3add(verts[a].n, n);
+			verts[b].n = m_vec3add(verts[b].n, n);
+			verts[c].n = m_vec3add(verts[c].n, n);
+		}
+		for (i = 0; i < nvertices; ++i)
+			verts[i].n = m_vec3normalize(verts[i].n);
 	}
 
 	*vertexsize = sizeof(posnormalvert_t);
@@ -165,12 +550,14 @@ void obj_createmesh(mesh_t* mesh, obj_t* obj, obj_meshgenfn fn)
 	size_t vertexsize;
 	(*fn)(obj, &vtxdata, &vertexsize, &meshflags);
 
-	m_create_indexed_mesh(mesh,
-	                    obj->nverts / 3,
-	                    vtxdata,
-	                    obj->nindices,
-	                    GL_UNSIGNED_INT,
-	                    obj->indices,
-	                    meshflags);
-	free(vtxdata);
+	if (obj->nverts / 3 <= 0x10000) {
+		uint16_t* indices16 = mem_alloc(MEM_MESH, obj->nindices * sizeof(uint16_t));
+		for (size_t i = 0; i < obj->nindices; ++i)
+			indices16[i] = (uint16_t)obj->indices[i];
+		m_create_indexed_mesh(mesh, obj->nverts / 3, vtxdata, obj->nindices, GL_UNSIGNED_SHORT, indices16, meshflags, GL_STATIC_DRAW);
+		mem_free(indices16);
+	} else {
+		m_create_indexed_mesh(mesh, obj->nverts / 3, vtxdata, obj->nindices, GL_UNSIGNED_INT, obj->indices, meshflags, GL_STATIC_DRAW);
+	}
+	mem_free(vtxdata);
 }
@@ -1,19 +1,33 @@
 #pragma once
 
+/*
+  Vertices are deduplicated on their (v, vt, vn) triple, so the arrays
+  line up: vertex i is verts[i*3], texcoords[i*2] and normals[i*3].
+  texcoords and normals are NULL if the file has no vt / vn.
+  All arrays live in one allocation.
+ */
 typedef struct obj_t {
 	float* verts;
+	float* texcoords;
+	float* normals;
 	uint32_t* indices;
-	size_t nverts;
-	size_t vcap;
+	size_t nverts; // floats in verts, nverts / 3 vertices
 	size_t nindices;
-	size_t fcap;
+	void* storage;
 } obj_t;
 
 typedef void (*obj_meshgenfn)(obj_t* obj, void** vertexdata, size_t* vertexsize, GLenum* meshflags);
 
 
-void obj_load(obj_t* mesh, const char* data, float vscale);
+// parses len bytes of .obj text, data doesn't need to be terminated
+void obj_load(obj_t* mesh, const char* data, size_t len, float vscale);
+// maps the file, parses and optimizes it, or loads filename.cache if
+// it matches.
+// Returns false if the file can't be read.
+bool obj_loadfile(obj_t* mesh, const char* filename, float vscale);
+// vertex cache triangle order, then vertices in order of first use.
+// obj_loadfile has already done this.
+void obj_optimize(obj_t* mesh);
 void obj_free(obj_t* mesh);
 void obj_normals(obj_t* obj, void** vertexdata, size_t* vertexsize, GLenum* meshflags);
 void obj_createmesh(mesh_t* mesh, obj_t* obj, obj_meshgenfn fn);
-
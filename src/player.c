@@ -81,6 +81,17 @@ void player_init()
 	p->walking = false;
 	p->sprinting = false;
 	p->crouching = false;
+
+	script_bind_float("player.accel", &pv.accel, 120.f, NULL, NULL);
+	script_bind_float("player.friction", &pv.friction, 0.2f, NULL, NULL);
+	script_bind_float("player.gravity", &pv.gravity, -10.f, NULL, NULL);
+	script_bind_float("player.flyspeed", &pv.flyspeed, 30.f, NULL, NULL);
+	script_bind_float("player.flyfriction", &pv.flyfriction, 0.05f, NULL, NULL);
+	script_bind_float("player.height", &pv.height, 2.f, NULL, NULL);
+	script_bind_float("player.crouchheight", &pv.crouchheight, 1.5f, NULL, NULL);
+	script_bind_float("player.camoffset", &pv.camoffset, 1.8f, NULL, NULL);
+	script_bind_float("player.crouchcamoffset", &pv.crouchcamoffset, 0.8f, NULL, NULL);
+	script_bind_float("player.jumpspeed", &pv.jumpspeed, 0.f, NULL, NULL);
 }
 
 void player_move_to_spawn()
@@ -172,18 +183,6 @@ void fps_move(struct player *p, float dt)
 
 void player_tick(float dt)
 {
-	// update script vars
-	pv.accel = script_get("player.accel");
-	pv.friction = script_get("player.friction");
-	pv.gravity = script_get("player.gravity");
-	pv.flyspeed = script_get("player.flyspeed");
-	pv.flyfriction = script_get("player.flyfriction");
-	pv.height = script_get("player.height");
-	pv.crouchheight = script_get("player.crouchheight");
-	pv.camoffset = script_get("player.camoffset");
-	pv.crouchcamoffset = script_get("player.crouchcamoffset");
-	pv.jumpspeed = script_get("player.jumpspeed");
-
 	struct player *p = &game.player;
 	// update animations
 	p->crouch_fade = m_clamp(p->crouch_fade + (p->crouching?dt:-dt)*5.f, 0.f, 1.f);
@@ -62,6 +62,8 @@ struct inputstate {
 	bool move_backward;
 	bool move_jump;
 	bool move_crouch;
+	bool primary_action; // pending clicks, consumed by the next tick
+	bool secondary_action;
 	int mouse_xrel;
 	int mouse_yrel;
 };
@@ -0,0 +1,286 @@
+#include "common.h"
+#include "math3d.h"
+#include "prof.h"
+#include "ui.h"
+#include "script.h"
+
+struct prof_event {
+	int64_t start;
+	int64_t dur;
+	uint32_t frame;
+	uint32_t timer;
+};
+
+static const char* prof_names[NUM_PROF_TIMERS] = {
+	"player",
+	"map_tick",
+	"map_gen",
+	"map_mesh",
+	"map_upload",
+	"map_draw",
+	"alpha",
+	"sky",
+	"ui",
+};
+
+static const char* prof_gpu_names[NUM_PROF_GPU_PASSES] = {
+	"map",
+	"sky",
+	"alpha",
+	"ui",
+	"postproc",
+};
+
+// GPU pass shown next to each CPU timer in the overlay
+static const int prof_gpu_for_timer[NUM_PROF_TIMERS] = {
+	-1, -1, -1, -1, -1,
+	PROF_GPU_MAP,
+	PROF_GPU_ALPHA,
+	PROF_GPU_SKY,
+	PROF_GPU_UI,
+};
+
+static struct prof_event events[PROF_EVENTS];
+static uint64_t nevents;
+static int64_t open_start[NUM_PROF_TIMERS];
+static int64_t frame_ns[NUM_PROF_TIMERS];
+static float history[NUM_PROF_TIMERS][PROF_HISTORY];
+static float frame_history[PROF_HISTORY];
+static int64_t frame_start;
+static int64_t trace_epoch;
+static uint32_t frame;
+
+static bool gpu_enabled;
+static GLuint gpu_queries[PROF_GPU_FRAMES][NUM_PROF_GPU_PASSES];
+static bool gpu_pending[PROF_GPU_FRAMES][NUM_PROF_GPU_PASSES];
+static bool gpu_active[NUM_PROF_GPU_PASSES]; // query issued this frame
+static double gpu_ms[NUM_PROF_GPU_PASSES];
+static bool gpu_log;
+
+
+static
+void prof_trace_cmd(int argc, char** argv)
+{
+	const char* filename = (argc > 0) ? argv[1] : "trace.json";
+	if (prof_write_trace(filename))
+		ui_console_printf("wrote %llu events to %s",
+		                  (unsigned long long)ML_MIN(nevents, (uint64_t)PROF_EVENTS), filename);
+	else
+		ui_console_printf("failed to write %s", filename);
+}
+
+void prof_init()
+{
+	memset(events, 0, sizeof(events));
+	memset(history, 0, sizeof(history));
+	memset(frame_history, 0, sizeof(frame_history));
+	memset(frame_ns, 0, sizeof(frame_ns));
+	nevents = 0;
+	frame = 0;
+	trace_epoch = frame_start = sys_timens();
+	script_defun("proftrace", prof_trace_cmd);
+}
+
+void prof_exit()
+{
+}
+
+void prof_begin(int timer)
+{
+	open_start[timer] = sys_timens();
+}
+
+void prof_end(int timer)
+{
+	int64_t now = sys_timens();
+	struct prof_event* e = events + (nevents++ & (PROF_EVENTS - 1));
+	e->start = open_start[timer];
+	e->dur = now - open_start[timer];
+	e->frame = frame;
+	e->timer = timer;
+	frame_ns[timer] += e->dur;
+}
+
+// read back any finished queries without waiting for the rest
+static
+void prof_gpu_collect()
+{
+	for (int f = 0; f < PROF_GPU_FRAMES; ++f) {
+		for (int p = 0; p < NUM_PROF_GPU_PASSES; ++p) {
+			GLint available = 0;
+			GLuint64 ns = 0;
+			if (!gpu_pending[f][p])
+				continue;
+			glGetQueryObjectiv(gpu_queries[f][p], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+			glGetQueryObjectui64v(gpu_queries[f][p], GL_QUERY_RESULT, &ns);
+			gpu_ms[p] = (double)ns / 1e6;
+			gpu_pending[f][p] = false;
+		}
+	}
+}
+
+static
+void prof_gpu_print()
+{
+	char buf[256];
+	int n = snprintf(buf, sizeof(buf), "gpu:");
+	for (int p = 0; p < NUM_PROF_GPU_PASSES && n < (int)sizeof(buf); ++p)
+		n += snprintf(buf + n, sizeof(buf) - n, " %s %.2f", prof_gpu_names[p], ML_MAX(gpu_ms[p], 0.0));
+	ui_console_printf("%s ms", buf);
+}
+
+void prof_frame()
+{
+	int64_t now = sys_timens();
+	if (gpu_enabled) {
+		prof_gpu_collect();
+		if (gpu_log && frame % 60 == 0)
+			prof_gpu_print();
+	}
+	int slot = frame % PROF_HISTORY;
+	for (int i = 0; i < NUM_PROF_TIMERS; ++i) {
+		history[i][slot] = (float)((double)frame_ns[i] / 1e6);
+		frame_ns[i] = 0;
+	}
+	frame_history[slot] = (float)((double)(now - frame_start) / 1e6);
+	frame_start = now;
+	frame++;
+}
+
+double prof_ms(int timer)
+{
+	return history[timer][(frame + PROF_HISTORY - 1) % PROF_HISTORY];
+}
+
+const char* prof_name(int timer)
+{
+	return prof_names[timer];
+}
+
+// one row per timer: label, last value and a bar per frame, oldest
+// to the left. Bars are scaled so a full row is 1/60 s.
+static
+void prof_draw_row(float x, float y, const char* name, const float* values, uint32_t clr)
+{
+	const float w = 2.f, h = 16.f, scale = h / (1000.f / 60.f);
+	float last = values[(frame + PROF_HISTORY - 1) % PROF_HISTORY];
+	ui_text(x, y + 2.f, 0xffffffff, "%-10s %5.2f", name, last);
+	x += 230.f;
+	ui_rect(x, y, PROF_HISTORY * w, h, 0x7f2c3e50);
+	for (int i = 0; i < PROF_HISTORY; ++i) {
+		float v = values[(frame + i) % PROF_HISTORY];
+		if (v > 0.f)
+			ui_rect(x + i * w, y, w, ML_MIN(v * scale, h), (v > 1000.f / 60.f) ? 0xffe74c3c : clr);
+	}
+}
+
+void prof_draw(float x, float y)
+{
+	prof_draw_row(x, y, "frame", frame_history, 0xff2ecc71);
+	for (int i = 0; i < NUM_PROF_TIMERS; ++i) {
+		y -= 18.f;
+		prof_draw_row(x, y, prof_names[i], history[i], 0xff3498db);
+		int p = prof_gpu_for_timer[i];
+		if (p >= 0 && gpu_ms[p] >= 0.0)
+			ui_text(x + 230.f + PROF_HISTORY * 2.f + 6.f, y + 2.f, 0xfff1c40f, "%5.2f", gpu_ms[p]);
+	}
+	y -= 18.f;
+	if (gpu_enabled && gpu_ms[PROF_GPU_POSTPROC] >= 0.0)
+		ui_text(x, y + 2.f, 0xfff1c40f, "%-10s %5.2f (gpu)", "postproc", gpu_ms[PROF_GPU_POSTPROC]);
+	else if (!gpu_enabled)
+		ui_text(x, y + 2.f, 0xfff1c40f, "no gpu timers");
+}
+
+bool prof_write_trace(const char* filename)
+{
+	FILE* f = fopen(filename, "w");
+	if (f == NULL)
+		return false;
+	uint64_t first = (nevents > PROF_EVENTS) ? nevents - PROF_EVENTS : 0;
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (uint64_t i = first; i < nevents; ++i) {
+		struct prof_event* e = events + (i & (PROF_EVENTS - 1));
+		fprintf(f, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%u}}%s\n",
+		        prof_names[e->timer],
+		        (double)(e->start - trace_epoch) / 1000.0, (double)e->dur / 1000.0,
+		        e->frame, (i + 1 < nevents) ? "," : "");
+	}
+	fprintf(f, "],\"displayTimeUnit\":\"ms\"}\n");
+	return fclose(f) == 0;
+}
+
+static
+void prof_gputimes_cmd(int argc, char** argv)
+{
+	if (!gpu_enabled) {
+		ui_console_printf("gputimes: timer queries not supported");
+		return;
+	}
+	if (argc > 0)
+		gpu_log = (strcmp(argv[1], "on") == 0);
+	prof_gpu_print();
+}
+
+void prof_gpu_init()
+{
+	for (int p = 0; p < NUM_PROF_GPU_PASSES; ++p)
+		gpu_ms[p] = -1.0;
+	memset(gpu_pending, 0, sizeof(gpu_pending));
+	memset(gpu_active, 0, sizeof(gpu_active));
+	gpu_log = false;
+	script_defun("gputimes", prof_gputimes_cmd);
+
+	// timer queries are core in 3.3, llvmpipe and friends may still lack them
+	gpu_enabled = (GLEW_VERSION_3_3 || GLEW_ARB_timer_query);
+	if (gpu_enabled) {
+		GLint bits = 0;
+		while (glGetError() != GL_NO_ERROR)
+			;
+		glGetQueryiv(GL_TIME_ELAPSED, GL_QUERY_COUNTER_BITS, &bits);
+		gpu_enabled = (glGetError() == GL_NO_ERROR && bits > 0);
+	}
+	if (!gpu_enabled) {
+		printf("* GPU timer queries not available\n");
+		return;
+	}
+	glGenQueries(PROF_GPU_FRAMES * NUM_PROF_GPU_PASSES, &gpu_queries[0][0]);
+}
+
+void prof_gpu_exit()
+{
+	if (gpu_enabled)
+		glDeleteQueries(PROF_GPU_FRAMES * NUM_PROF_GPU_PASSES, &gpu_queries[0][0]);
+	gpu_enabled = false;
+}
+
+// a query still in flight from PROF_GPU_FRAMES ago means the GPU is
+// that far behind, skip this frame's sample rather than wait
+void prof_gpu_begin(int pass)
+{
+	int f = frame % PROF_GPU_FRAMES;
+	if (!gpu_enabled || gpu_pending[f][pass])
+		return;
+	glBeginQuery(GL_TIME_ELAPSED, gpu_queries[f][pass]);
+	gpu_active[pass] = true;
+}
+
+void prof_gpu_end(int pass)
+{
+	if (!gpu_active[pass])
+		return;
+	glEndQuery(GL_TIME_ELAPSED);
+	gpu_active[pass] = false;
+	gpu_pending[frame % PROF_GPU_FRAMES][pass] = true;
+}
+
+double prof_gpu_ms(int pass)
+{
+	return gpu_ms[pass];
+}
+
+const char* prof_gpu_name(int pass)
+{
+	return prof_gpu_names[pass];
+}
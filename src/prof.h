@@ -0,0 +1,61 @@
+#pragma once
+#include "common.h"
+
+/*
+  Frame profiler: scoped timers on a monotonic nanosecond clock.
+  Every begin/end pair is recorded as an event in a ring buffer
+  (dumped as a Chrome trace with the proftrace console command), and
+  per-frame totals feed the rolling histograms in the debug overlay.
+
+  Timers may nest, but a timer must not be begun again before it has
+  been ended. Main thread only.
+ */
+
+enum ProfTimers {
+	PROF_PLAYER,
+	PROF_MAP_TICK,
+	PROF_MAP_GEN,
+	PROF_MAP_MESH,
+	PROF_MAP_UPLOAD,
+	PROF_MAP_DRAW,
+	PROF_ALPHA,
+	PROF_SKY,
+	PROF_UI,
+	NUM_PROF_TIMERS
+};
+
+/*
+  GPU pass timers: GL_TIME_ELAPSED queries in a ring of
+  PROF_GPU_FRAMES frames, so results are read a couple of frames
+  late and never stall the pipeline. Without timer query support
+  these are no-ops and report no time.
+ */
+enum ProfGpuPasses {
+	PROF_GPU_MAP,
+	PROF_GPU_SKY,
+	PROF_GPU_ALPHA,
+	PROF_GPU_UI,
+	PROF_GPU_POSTPROC,
+	NUM_PROF_GPU_PASSES
+};
+
+#define PROF_GPU_FRAMES 3
+#define PROF_HISTORY 64 // frames shown in the overlay
+#define PROF_EVENTS 32768 // events kept for the trace, power of two
+
+void prof_init(void);
+void prof_exit(void);
+void prof_begin(int timer);
+void prof_end(int timer);
+void prof_frame(void); // call once at the end of each frame
+double prof_ms(int timer); // last frame's total for timer
+const char* prof_name(int timer);
+void prof_draw(float x, float y);
+bool prof_write_trace(const char* filename);
+
+void prof_gpu_init(void); // needs a GL context
+void prof_gpu_exit(void);
+void prof_gpu_begin(int pass);
+void prof_gpu_end(int pass);
+double prof_gpu_ms(int pass); // latest result, negative if none
+const char* prof_gpu_name(int pass);
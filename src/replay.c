@@ -0,0 +1,198 @@
+#include "common.h"
+#include "math3d.h"
+#include "game.h"
+#include "replay.h"
+
+#define REPLAY_MAGIC 0x50524d52 // "RMRP"
+#define REPLAY_VERSION 1
+
+enum ReplayButtons {
+	RB_SPRINT = 1 << 0,
+	RB_LEFT = 1 << 1,
+	RB_RIGHT = 1 << 2,
+	RB_FORWARD = 1 << 3,
+	RB_BACKWARD = 1 << 4,
+	RB_JUMP = 1 << 5,
+	RB_CROUCH = 1 << 6,
+	RB_PRIMARY = 1 << 7,
+	RB_SECONDARY = 1 << 8,
+	RB_GROUND = 1 << 9,
+	RB_FASTDAY = 1 << 10,
+	RB_COLLISIONS = 1 << 11
+};
+
+/*
+  file:
+    u32 magic, u32 version, u64 seed, u32 dt (ms), u32 count
+    count * replay_frame
+  in native byte order. count is patched in by replay_close().
+ */
+struct replay_frame {
+	int32_t picked[3];
+	int32_t prepicked[3];
+	int32_t mouse_xrel;
+	int32_t mouse_yrel;
+	uint16_t buttons;
+	uint8_t camera_mode;
+	uint8_t pad;
+};
+
+static FILE* replay_file;
+static bool replay_reading;
+static size_t replay_nframes;
+static size_t replay_pos;
+
+
+static
+void pack_frame(struct replay_frame* f)
+{
+	const struct inputstate* in = &game.input;
+	uint16_t b = 0;
+	f->picked[0] = in->picked_block.x;
+	f->picked[1] = in->picked_block.y;
+	f->picked[2] = in->picked_block.z;
+	f->prepicked[0] = in->prepicked_block.x;
+	f->prepicked[1] = in->prepicked_block.y;
+	f->prepicked[2] = in->prepicked_block.z;
+	f->mouse_xrel = in->mouse_xrel;
+	f->mouse_yrel = in->mouse_yrel;
+	if (in->move_sprint) b |= RB_SPRINT;
+	if (in->move_left) b |= RB_LEFT;
+	if (in->move_right) b |= RB_RIGHT;
+	if (in->move_forward) b |= RB_FORWARD;
+	if (in->move_backward) b |= RB_BACKWARD;
+	if (in->move_jump) b |= RB_JUMP;
+	if (in->move_crouch) b |= RB_CROUCH;
+	if (in->primary_action) b |= RB_PRIMARY;
+	if (in->secondary_action) b |= RB_SECONDARY;
+	if (game.enable_ground) b |= RB_GROUND;
+	if (game.fast_day_mode) b |= RB_FASTDAY;
+	if (game.collisions_on) b |= RB_COLLISIONS;
+	f->buttons = b;
+	f->camera_mode = (uint8_t)game.camera.mode;
+	f->pad = 0;
+}
+
+static
+void unpack_frame(const struct replay_frame* f)
+{
+	struct inputstate* in = &game.input;
+	uint16_t b = f->buttons;
+	in->picked_block.x = f->picked[0];
+	in->picked_block.y = f->picked[1];
+	in->picked_block.z = f->picked[2];
+	in->prepicked_block.x = f->prepicked[0];
+	in->prepicked_block.y = f->prepicked[1];
+	in->prepicked_block.z = f->prepicked[2];
+	in->mouse_xrel = f->mouse_xrel;
+	in->mouse_yrel = f->mouse_yrel;
+	in->move_sprint = (b & RB_SPRINT) != 0;
+	in->move_left = (b & RB_LEFT) != 0;
+	in->move_right = (b & RB_RIGHT) != 0;
+	in->move_forward = (b & RB_FORWARD) != 0;
+	in->move_backward = (b & RB_BACKWARD) != 0;
+	in->move_jump = (b & RB_JUMP) != 0;
+	in->move_crouch = (b & RB_CROUCH) != 0;
+	in->primary_action = (b & RB_PRIMARY) != 0;
+	in->secondary_action = (b & RB_SECONDARY) != 0;
+	game.enable_ground = (b & RB_GROUND) != 0;
+	game.fast_day_mode = (b & RB_FASTDAY) != 0;
+	game.collisions_on = (b & RB_COLLISIONS) != 0;
+	game.camera.mode = f->camera_mode % NUM_CAMERA_MODES;
+}
+
+bool replay_record(const char* filename, uint64_t seed, int dt)
+{
+	replay_close();
+	replay_file = fopen(filename, "wb");
+	if (replay_file == NULL)
+		return false;
+	uint32_t header[2] = { REPLAY_MAGIC, REPLAY_VERSION };
+	uint32_t info[2] = { (uint32_t)dt, 0 };
+	if (fwrite(header, sizeof(header), 1, replay_file) != 1 ||
+	    fwrite(&seed, sizeof(seed), 1, replay_file) != 1 ||
+	    fwrite(info, sizeof(info), 1, replay_file) != 1) {
+		fclose(replay_file);
+		replay_file = NULL;
+		return false;
+	}
+	replay_reading = false;
+	replay_nframes = 0;
+	replay_pos = 0;
+	return true;
+}
+
+bool replay_open(const char* filename, uint64_t* seed, int* dt)
+{
+	replay_close();
+	replay_file = fopen(filename, "rb");
+	if (replay_file == NULL)
+		return false;
+	uint32_t header[2];
+	uint32_t info[2];
+	bool ok = fread(header, sizeof(header), 1, replay_file) == 1 &&
+		header[0] == REPLAY_MAGIC && header[1] == REPLAY_VERSION &&
+		fread(seed, sizeof(*seed), 1, replay_file) == 1 &&
+		fread(info, sizeof(info), 1, replay_file) == 1 &&
+		info[0] > 0;
+	if (!ok) {
+		fclose(replay_file);
+		replay_file = NULL;
+		return false;
+	}
+	*dt = (int)info[0];
+	replay_reading = true;
+	replay_nframes = info[1];
+	replay_pos = 0;
+	return true;
+}
+
+void replay_close()
+{
+	if (replay_file == NULL)
+		return;
+	if (!replay_reading) {
+		uint32_t count = (uint32_t)replay_nframes;
+		long offset = (long)(sizeof(uint32_t)*2 + sizeof(uint64_t) + sizeof(uint32_t));
+		if (fseek(replay_file, offset, SEEK_SET) == 0)
+			fwrite(&count, sizeof(count), 1, replay_file);
+		printf("* Recorded %zu frames\n", replay_nframes);
+	}
+	fclose(replay_file);
+	replay_file = NULL;
+	replay_reading = false;
+}
+
+bool replay_tick()
+{
+	struct replay_frame f;
+	if (replay_file == NULL)
+		return true;
+	if (replay_reading) {
+		if (replay_pos >= replay_nframes || fread(&f, sizeof(f), 1, replay_file) != 1) {
+			replay_close();
+			return false;
+		}
+		unpack_frame(&f);
+		replay_pos++;
+	} else {
+		pack_frame(&f);
+		if (fwrite(&f, sizeof(f), 1, replay_file) != 1) {
+			printf("replay: write failed, recording stopped\n");
+			replay_close();
+			return true;
+		}
+		replay_nframes++;
+	}
+	return true;
+}
+
+bool replay_playing()
+{
+	return replay_file != NULL && replay_reading;
+}
+
+size_t replay_frames()
+{
+	return replay_nframes;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+
+/*
+  Input recorder for reproducible fly-throughs. One frame is stored
+  per fixed timestep: the input state (movement keys, pending clicks,
+  picked blocks, mouse deltas) plus the toggles that change what the
+  simulation does. Together with the map seed and timestep stored in
+  the header, playing a recording back gives the same world and the
+  same camera path. Console commands are not recorded.
+ */
+
+bool replay_record(const char* filename, uint64_t seed, int dt);
+bool replay_open(const char* filename, uint64_t* seed, int* dt);
+void replay_close(void);
+
+// call once per timestep after events are handled and before
+// game_tick: writes game.input when recording, replaces it when
+// playing. Returns false once a playback runs out of frames.
+bool replay_tick(void);
+
+bool replay_playing(void);
+size_t replay_frames(void); // frames recorded, or total frames in playback
@@ -0,0 +1,69 @@
+#include "common.h"
+#include "rle.h"
+
+#define RLE_SUNLIGHT_SHIFT 28
+#define RLE_NOSUNLIGHT_MASK 0x0fffffff
+
+size_t rle_encode(const uint32_t* src, size_t n, uint8_t* dst)
+{
+	uint8_t* p = dst;
+	size_t i = 0, len;
+	uint32_t b, prev;
+
+	if (n == 0)
+		return 0;
+	prev = ~src[0];
+	while (i < n) {
+		b = src[i];
+		len = 1;
+		while (i + len < n && src[i + len] == b && len < RLE_MAX_RUN)
+			++len;
+		if (((b ^ prev) & RLE_NOSUNLIGHT_MASK) == 0) {
+			*p++ = 0x80 | (uint8_t)(len - 1);
+			*p++ = (uint8_t)(b >> RLE_SUNLIGHT_SHIFT);
+		} else {
+			*p++ = (uint8_t)(len - 1);
+			p[0] = (uint8_t)b;
+			p[1] = (uint8_t)(b >> 8);
+			p[2] = (uint8_t)(b >> 16);
+			p[3] = (uint8_t)(b >> 24);
+			p += 4;
+		}
+		prev = b;
+		i += len;
+	}
+	return p - dst;
+}
+
+size_t rle_decode(const uint8_t* src, size_t srclen, uint32_t* dst, size_t n)
+{
+	const uint8_t* p = src;
+	const uint8_t* end = src + srclen;
+	uint32_t* to = dst;
+	uint32_t* stop = dst + n;
+	uint32_t b = 0;
+	size_t len;
+	uint8_t t;
+
+	while (to < stop) {
+		if (p >= end)
+			return 0;
+		t = *p++;
+		len = (t & 0x7f) + 1;
+		if (t & 0x80) {
+			if (p >= end)
+				return 0;
+			b = (b & RLE_NOSUNLIGHT_MASK) | ((uint32_t)*p++ << RLE_SUNLIGHT_SHIFT);
+		} else {
+			if (end - p < 4)
+				return 0;
+			b = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+			p += 4;
+		}
+		if ((size_t)(stop - to) < len)
+			return 0;
+		while (len--)
+			*to++ = b;
+	}
+	return p - src;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include "common.h"
+
+/*
+  Run-length codec for columns of packed 32-bit block words (see
+  map.h for the layout). Columns are encoded in memory order, so
+  decoding writes straight into block_column() layout.
+
+  Each run starts with a token byte:
+    bits 0-6: run length - 1 (1..128)
+    bit 7:    set if the block only differs from the previous run in
+              the sunlight nibble. One byte with the new sunlight value
+              follows, otherwise the full block follows as 4 bytes,
+              little-endian.
+ */
+
+#define RLE_MAX_RUN 128
+#define RLE_MAX_BYTES(n) ((n) * 5)
+
+size_t rle_encode(const uint32_t* src, size_t n, uint8_t* dst);
+
+// returns number of bytes consumed from src, 0 if the data is corrupt
+size_t rle_decode(const uint8_t* src, size_t srclen, uint32_t* dst, size_t n);
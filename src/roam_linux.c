@@ -5,15 +5,28 @@
 #define ML_SWAP(a, b) do { __typeof__ (a) _swap_##__LINE__ = (a); (a) = (b); (b) = _swap_##__LINE__; } while (0)
 
 #include "stb.c"
+#include "arena.c"
 #include "blocks.c"
+#include "capture.c"
+#include "chunkstore.c"
+#include "chunkviz.c"
 #include "gen.c"
+#include "gencache.c"
 #include "geometry.c"
+#include "http.c"
 #include "map.c"
 #include "math3d.c"
+#include "mathtest.c"
+#include "mem.c"
+#include "meshopt.c"
 #include "noise.c"
 #include "objfile.c"
 #include "player.c"
+#include "prof.c"
+#include "replay.c"
+#include "rle.c"
 #include "script.c"
+#include "scriptvm.c"
 #include "sky.c"
 #include "stb.c"
 #include "sys.c"
@@ -22,6 +35,12 @@
 #include "main.c"
 
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 uint64_t sys_urandom()
 {
@@ -42,6 +61,95 @@ int64_t sys_timems()
 	fatal_error("failed to get current time");
 }
 
+int64_t sys_timens()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (int64_t)ts.tv_sec * 1000000000 + (int64_t)ts.tv_nsec;
+	fatal_error("failed to get monotonic time");
+}
+
+const char* sys_mapfile(const char* filename, size_t* len)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	madvise(data, (size_t)st.st_size, MADV_SEQUENTIAL);
+	*len = (size_t)st.st_size;
+	return (const char*)data;
+}
+
+void sys_unmapfile(const char* data, size_t len)
+{
+	munmap((void*)data, len);
+}
+
+sys_socket_t sys_tcp_listen(int port)
+{
+	int s = socket(AF_INET, SOCK_STREAM, 0);
+	if (s < 0)
+		return SYS_NO_SOCKET;
+	int one = 1;
+	setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((uint16_t)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(s, 8) < 0) {
+		close(s);
+		return SYS_NO_SOCKET;
+	}
+	return s;
+}
+
+static
+bool sys_tcp_wait(sys_socket_t s, int timeout_ms)
+{
+	struct pollfd p = { (int)s, POLLIN, 0 };
+	return poll(&p, 1, timeout_ms) > 0;
+}
+
+sys_socket_t sys_tcp_accept(sys_socket_t s, int timeout_ms)
+{
+	if (!sys_tcp_wait(s, timeout_ms))
+		return SYS_NO_SOCKET;
+	int c = accept((int)s, NULL, NULL);
+	return (c < 0) ? SYS_NO_SOCKET : c;
+}
+
+int sys_tcp_recv(sys_socket_t s, void* buf, size_t len, int timeout_ms)
+{
+	if (!sys_tcp_wait(s, timeout_ms))
+		return -1;
+	return (int)recv((int)s, buf, len, 0);
+}
+
+bool sys_tcp_send(sys_socket_t s, const void* buf, size_t len)
+{
+	const char* p = buf;
+	while (len > 0) {
+		ssize_t n = send((int)s, p, len, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
+
+void sys_tcp_close(sys_socket_t s)
+{
+	close((int)s);
+}
+
 
 
 int main(int argc, char* argv[]) {
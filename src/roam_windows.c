@@ -8,16 +8,33 @@
 
 #define ML_SWAP(a, b) do { a=(a+b) - (b=a); } while (0)
 
+// before anything pulls in windows.h (and with it the old winsock.h)
+#include <winsock2.h>
+#pragma comment(lib, "ws2_32.lib")
+
 #include "stb.c"
+#include "arena.c"
 #include "blocks.c"
+#include "capture.c"
+#include "chunkstore.c"
+#include "chunkviz.c"
 #include "gen.c"
+#include "gencache.c"
 #include "geometry.c"
+#include "http.c"
 #include "map.c"
 #include "math3d.c"
+#include "mathtest.c"
+#include "mem.c"
+#include "meshopt.c"
 #include "noise.c"
 #include "objfile.c"
 #include "player.c"
+#include "prof.c"
+#include "replay.c"
+#include "rle.c"
 #include "script.c"
+#include "scriptvm.c"
 #include "sky.c"
 #include "stb.c"
 #include "sys.c"
@@ -103,6 +120,17 @@ int64_t sys_timems()
 	fatal_error("failed to get current time");
 }
 
+int64_t sys_timens()
+{
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (int64_t)(now.QuadPart / freq.QuadPart) * 1000000000 +
+		(int64_t)(now.QuadPart % freq.QuadPart) * 1000000000 / freq.QuadPart;
+}
+
 
 uint64_t sys_urandom()
 {
@@ -111,6 +139,101 @@ uint64_t sys_urandom()
 }
 
 
+const char* sys_mapfile(const char* filename, size_t* len)
+{
+	HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return NULL;
+	LARGE_INTEGER size;
+	void* data = NULL;
+	if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping != NULL) {
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	if (data == NULL)
+		return NULL;
+	*len = (size_t)size.QuadPart;
+	return (const char*)data;
+}
+
+void sys_unmapfile(const char* data, size_t len)
+{
+	UnmapViewOfFile(data);
+}
+
+sys_socket_t sys_tcp_listen(int port)
+{
+	static bool started = false;
+	if (!started) {
+		WSADATA wsa;
+		if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0)
+			return SYS_NO_SOCKET;
+		started = true;
+	}
+	SOCKET s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (s == INVALID_SOCKET)
+		return SYS_NO_SOCKET;
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((u_short)port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+	    listen(s, 8) == SOCKET_ERROR) {
+		closesocket(s);
+		return SYS_NO_SOCKET;
+	}
+	return (sys_socket_t)s;
+}
+
+static
+bool sys_tcp_wait(sys_socket_t s, int timeout_ms)
+{
+	fd_set set;
+	struct timeval tv = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	FD_ZERO(&set);
+	FD_SET((SOCKET)s, &set);
+	return select(0, &set, NULL, NULL, &tv) > 0;
+}
+
+sys_socket_t sys_tcp_accept(sys_socket_t s, int timeout_ms)
+{
+	if (!sys_tcp_wait(s, timeout_ms))
+		return SYS_NO_SOCKET;
+	SOCKET c = accept((SOCKET)s, NULL, NULL);
+	return (c == INVALID_SOCKET) ? SYS_NO_SOCKET : (sys_socket_t)c;
+}
+
+int sys_tcp_recv(sys_socket_t s, void* buf, size_t len, int timeout_ms)
+{
+	if (!sys_tcp_wait(s, timeout_ms))
+		return -1;
+	return recv((SOCKET)s, (char*)buf, (int)len, 0);
+}
+
+bool sys_tcp_send(sys_socket_t s, const void* buf, size_t len)
+{
+	const char* p = (const char*)buf;
+	while (len > 0) {
+		int n = send((SOCKET)s, p, (int)len, 0);
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= (size_t)n;
+	}
+	return true;
+}
+
+void sys_tcp_close(sys_socket_t s)
+{
+	closesocket((SOCKET)s);
+}
+
+
 int main(int argc, char* argv[]) {
 	return roam_main(argc, argv);
 }
@@ -3,19 +3,26 @@
 #include "ui.h"
 #include "game.h"
 #include "script.h"
+#include "scriptvm.h"
 #include "stb.h"
+#include "mem.h"
 
 
-#define MAX_DEFUNS 32
-
-struct defun_data {
-	const char* name;
-	void (*cb)(int, char**);
+enum ScriptVarTypes {
+	SCRIPT_FLOAT,
+	SCRIPT_INT,
+	SCRIPT_BOOL
 };
 
-static struct defun_data defuns[MAX_DEFUNS];
+struct script_binding {
+	int type;
+	void* ptr;
+	script_var_cb on_change;
+	void* data;
+};
 
 static stb_sdict* vars;
+static stb_sdict* bindings;
 
 
 static int is_boolean_true(const char* str)
@@ -58,7 +65,8 @@ static void script_teleport(int argc, char** argv)
 void script_init()
 {
 	vars = stb_sdict_new(0);
-	memset(defuns, 0, sizeof(defuns));
+	bindings = stb_sdict_new(0);
+	scriptvm_init();
 	script_defun("quit", script_quit);
 	script_defun("debug", script_debug_mode);
 	script_defun("wireframe", script_wireframe);
@@ -68,6 +76,18 @@ void script_init()
 
 void script_exit()
 {
+	scriptvm_exit();
+	int i;
+	char* name;
+	void* value;
+	stb_sdict_for(vars, i, name, value)
+		mem_free(value);
+	stb_sdict_delete(vars);
+	vars = NULL;
+	stb_sdict_for(bindings, i, name, value)
+		mem_free(value);
+	stb_sdict_delete(bindings);
+	bindings = NULL;
 }
 
 
@@ -76,63 +96,32 @@ void script_tick()
 }
 
 
-static void script_call(int argc, char** argv)
-{
-	printf("call: %s\n", argv[0]);
-	for (struct defun_data* d = defuns; d->name; ++d) {
-		if (strcmp(d->name, argv[0]) == 0) {
-			(*d->cb)(argc, argv);
-			return;
-		}
-	}
-	ui_console_printf("undefined: %s", argv[0]);
-}
-
-
 int script_exec(char *cmd)
 {
-	int count;
-	char **tokens;
-	tokens = stb_tokens_quoted(cmd, " \t", &count);
-	if (count == 3 && strcmp(tokens[1], "=") == 0) {
-		ui_console_printf("%s = %s", tokens[0], tokens[2]);
-		void* prev = stb_sdict_change(vars, tokens[0], strdup(tokens[2]));
-		if (prev != NULL)
-			free(prev);
-	} else if (count > 0) {
-		script_call(count-1, tokens);
-	}
-	free(tokens);
-	return 0;
+	return scriptvm_run(cmd, "console");
 }
 
 int script_dofile(const char* filename)
 {
-	if (!sys_isfile(filename)) {
+	char* src = sys_readfile(filename);
+	if (src == NULL) {
 		ui_console_printf("script not found: %s", filename);
 		return 0;
 	}
-	int len;
-	char** lines = stb_stringfile_trimmed((char*)filename, &len, '#');
-	for (int i = 0; i < len; ++i) {
-		script_exec(lines[i]);
-	}
-	free(lines);
-	return 0;
+	int ret = scriptvm_run(src, filename);
+	free(src);
+	return ret;
 }
 
 
 void script_defun(const char *name, void (*cb)(int argc, char** argv))
 {
-	for (unsigned int i = 0; i < stb_arrcount(defuns); ++i) {
-		if (defuns[i].name == 0) {
-			defuns[i].name = name;
-			defuns[i].cb = cb;
-			ui_console_printf("def %s", name);
-			return;
-		}
-	}
-	ui_console_printf("max defuns reached when defining '%s'", name);
+	scriptvm_defun(name, cb);
+}
+
+void script_defnative(const char *name, int nargs, script_native fn)
+{
+	scriptvm_defnative(name, nargs, fn);
 }
 
 double script_get(const char *name)
@@ -143,5 +132,120 @@ double script_get(const char *name)
 	return 0.0;
 }
 
+const char* script_get_string(const char *name)
+{
+	return (const char*)stb_sdict_get(vars, (char*)name);
+}
+
+static
+void store_string(const char *name, const char *value)
+{
+	void* prev = stb_sdict_change(vars, (char*)name, mem_strdup(MEM_SCRIPT, value));
+	if (prev != NULL)
+		mem_free(prev);
+}
+
+static
+void store_binding(struct script_binding* b, const char *value)
+{
+	switch (b->type) {
+	case SCRIPT_FLOAT: *(float*)b->ptr = (float)atof(value); break;
+	case SCRIPT_INT: *(int*)b->ptr = (int)strtol(value, NULL, 0); break;
+	case SCRIPT_BOOL: *(bool*)b->ptr = is_boolean_true(value); break;
+	}
+}
+
+void script_set(const char *name, const char *value)
+{
+	ui_console_printf("%s = %s", name, value);
+	script_set_quiet(name, value);
+}
+
+void script_set_quiet(const char *name, const char *value)
+{
+	store_string(name, value);
+	struct script_binding* b = (struct script_binding*)stb_sdict_get(bindings, (char*)name);
+	if (b != NULL) {
+		store_binding(b, value);
+		if (b->on_change != NULL)
+			b->on_change(name, b->data);
+	}
+}
+
+static
+void script_bind(const char *name, int type, void* ptr, const char* def, script_var_cb on_change, void* data)
+{
+	struct script_binding* b = mem_alloc(MEM_SCRIPT, sizeof(struct script_binding));
+	b->type = type;
+	b->ptr = ptr;
+	b->on_change = on_change;
+	b->data = data;
+	void* prev = stb_sdict_change(bindings, (char*)name, b);
+	if (prev != NULL)
+		mem_free(prev);
+	const char* value = script_get_string(name);
+	if (value == NULL) {
+		store_string(name, def);
+		value = def;
+	}
+	store_binding(b, value);
+}
+
+void script_bind_float(const char *name, float* ptr, float def, script_var_cb on_change, void* data)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%g", def);
+	script_bind(name, SCRIPT_FLOAT, ptr, buf, on_change, data);
+}
 
+void script_bind_int(const char *name, int* ptr, int def, script_var_cb on_change, void* data)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%d", def);
+	script_bind(name, SCRIPT_INT, ptr, buf, on_change, data);
+}
 
+void script_bind_bool(const char *name, bool* ptr, bool def, script_var_cb on_change, void* data)
+{
+	script_bind(name, SCRIPT_BOOL, ptr, def ? "true" : "false", on_change, data);
+}
+
+void script_foreach(void (*cb)(const char* name, const char* value, void* data), void* data)
+{
+	int i;
+	char* name;
+	void* value;
+	stb_sdict_for(vars, i, name, value)
+		cb(name, (const char*)value, data);
+}
+
+double script_tonum(const struct script_value* v)
+{
+	return (v->type == SCRIPT_NUM) ? v->num : atof(v->str);
+}
+
+bool script_get_value(const char *name, struct script_value* out)
+{
+	struct script_binding* b = (struct script_binding*)stb_sdict_get(bindings, (char*)name);
+	out->type = SCRIPT_NUM;
+	out->str = NULL;
+	if (b != NULL) {
+		switch (b->type) {
+		case SCRIPT_FLOAT: out->num = *(float*)b->ptr; break;
+		case SCRIPT_INT: out->num = *(int*)b->ptr; break;
+		case SCRIPT_BOOL: out->num = *(bool*)b->ptr; break;
+		}
+		return true;
+	}
+	const char* val = script_get_string(name);
+	if (val == NULL)
+		return false;
+	char* end;
+	out->num = strtod(val, &end);
+	if (end == val || *end != '\0') {
+		out->type = SCRIPT_STR;
+		out->num = 0.0;
+		out->str = val;
+	}
+	return true;
+}
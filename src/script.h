@@ -1,4 +1,5 @@
 #pragma once
+#include "common.h"
 
 typedef void* script_state;
 
@@ -15,3 +16,49 @@ int script_dofile(const char* filename);
 void script_defun(const char *name, void (*cb)(int, char**));
 
 double script_get(const char *name);
+
+// returns NULL if the variable isn't set
+const char* script_get_string(const char *name);
+
+// same as "name = value" on the console
+void script_set(const char *name, const char *value);
+void script_set_quiet(const char *name, const char *value); // no console echo
+
+void script_foreach(void (*cb)(const char* name, const char* value, void* data), void* data);
+
+/*
+  Typed bindings: the variable is parsed once into *ptr when bound
+  and again on every assignment, so readers use the field directly
+  instead of calling script_get. An existing value (from boot.script)
+  wins over the default. on_change (may be NULL) runs after the new
+  value has been stored, not when binding.
+ */
+typedef void (*script_var_cb)(const char* name, void* data);
+
+void script_bind_float(const char *name, float* ptr, float def, script_var_cb on_change, void* data);
+void script_bind_int(const char *name, int* ptr, int def, script_var_cb on_change, void* data);
+void script_bind_bool(const char *name, bool* ptr, bool def, script_var_cb on_change, void* data);
+
+/*
+  Natives are functions callable from script expressions, for
+  example block(x, y, z). nargs is checked by the compiler, -1 for
+  any number. Strings are only valid for the duration of the call.
+ */
+enum ScriptValueTypes {
+	SCRIPT_NUM,
+	SCRIPT_STR
+};
+
+struct script_value {
+	int type;
+	double num;
+	const char* str;
+};
+
+typedef double (*script_native)(int argc, const struct script_value* argv);
+
+void script_defnative(const char *name, int nargs, script_native fn);
+double script_tonum(const struct script_value* v);
+
+// numbers for numeric strings and typed bindings, false if unset
+bool script_get_value(const char *name, struct script_value* out);
@@ -0,0 +1,1292 @@
+#include <ctype.h>
+#include <setjmp.h>
+#include "common.h"
+#include "math3d.h"
+#include "script.h"
+#include "scriptvm.h"
+#include "mem.h"
+#include "ui.h"
+#include "rnd.h"
+
+#define VM_STACK 1024
+#define VM_FRAMES 64
+#define VM_MAX_LOCALS 255
+#define VM_SLOT_HIDDEN -1 // temporaries, never found by name
+#define VM_SLOT_RETIRED -2 // free for reuse
+#define VM_MAX_ARGS 16
+#define VM_MAX_BREAKS 64
+#define VM_BUDGET 100000000 // instructions per run, catches runaway loops
+
+enum VmOps {
+	OP_NUM, // f64
+	OP_STR, // u32 sym
+	OP_LOCAL, // u8 slot
+	OP_SETLOCAL, // u8 slot
+	OP_GLOBAL, // u32 sym
+	OP_SETGLOBAL, // u32 sym
+	OP_VAR, // u32 sym
+	OP_SETVAR, // u32 sym, u8 echo
+	OP_ADD,
+	OP_SUB,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_NEG,
+	OP_NOT,
+	OP_EQ,
+	OP_NE,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_JMP, // i32, relative to the end of the instruction
+	OP_JMPF, // i32, pops
+	OP_AND, // i32, jumps keeping a false value, else pops
+	OP_OR, // i32, jumps keeping a true value, else pops
+	OP_FORTEST, // pops i, limit, step, pushes the loop condition
+	OP_CALL, // u32 sym, u8 argc
+	OP_CMD, // u32 sym, u8 argc
+	OP_POP,
+	OP_RET
+};
+
+struct vm_proto {
+	uint8_t* code;
+	size_t len;
+	size_t cap;
+	int nparams;
+	int nlocals;
+	const char* name;
+	struct vm_proto* next; // every proto ever compiled, freed at exit
+};
+
+struct vm_sym {
+	char* name;
+	uint32_t hash;
+	void (*cmd)(int, char**);
+	script_native native;
+	int nargs;
+	struct vm_proto* func;
+	struct script_value global;
+	bool has_global;
+};
+
+struct vm_frame {
+	struct vm_proto* proto;
+	const uint8_t* ip;
+	int base;
+};
+
+static struct vm_sym* vm_syms;
+static uint32_t vm_nsyms;
+static uint32_t vm_symcap;
+static int32_t* vm_index; // open addressing, -1 = empty
+static uint32_t vm_indexcap;
+static struct vm_proto* vm_protos;
+static uint64_t vm_rng;
+
+
+static inline
+uint32_t sym_hash(const char* s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	for (size_t i = 0; i < len; ++i)
+		h = (h ^ (uint8_t)s[i]) * 16777619u;
+	return h;
+}
+
+static
+void sym_rehash(uint32_t cap)
+{
+	mem_free(vm_index);
+	vm_index = mem_alloc(MEM_SCRIPT, cap * sizeof(int32_t));
+	vm_indexcap = cap;
+	for (uint32_t i = 0; i < cap; ++i)
+		vm_index[i] = -1;
+	for (uint32_t s = 0; s < vm_nsyms; ++s) {
+		uint32_t i = vm_syms[s].hash & (cap - 1);
+		while (vm_index[i] >= 0)
+			i = (i + 1) & (cap - 1);
+		vm_index[i] = (int32_t)s;
+	}
+}
+
+static
+uint32_t sym_intern(const char* name, size_t len)
+{
+	uint32_t h = sym_hash(name, len);
+	uint32_t i = h & (vm_indexcap - 1);
+	for (; vm_index[i] >= 0; i = (i + 1) & (vm_indexcap - 1)) {
+		struct vm_sym* s = vm_syms + vm_index[i];
+		if (s->hash == h && strncmp(s->name, name, len) == 0 && s->name[len] == '\0')
+			return (uint32_t)vm_index[i];
+	}
+	if (vm_nsyms == vm_symcap) {
+		vm_symcap *= 2;
+		vm_syms = mem_realloc(MEM_SCRIPT, vm_syms, vm_symcap * sizeof(struct vm_sym));
+	}
+	struct vm_sym* s = vm_syms + vm_nsyms;
+	memset(s, 0, sizeof(struct vm_sym));
+	s->name = mem_alloc(MEM_SCRIPT, len + 1);
+	memcpy(s->name, name, len);
+	s->name[len] = '\0';
+	s->hash = h;
+	vm_index[i] = (int32_t)vm_nsyms;
+	if (++vm_nsyms * 2 > vm_indexcap)
+		sym_rehash(vm_indexcap * 2);
+	return vm_nsyms - 1;
+}
+
+static inline
+uint32_t sym_intern_str(const char* name)
+{
+	return sym_intern(name, strlen(name));
+}
+
+static
+struct vm_proto* proto_alloc(const char* name)
+{
+	struct vm_proto* f = mem_calloc(MEM_SCRIPT, 1, sizeof(struct vm_proto));
+	f->name = name;
+	return f;
+}
+
+static
+void proto_free(struct vm_proto* f)
+{
+	mem_free(f->code);
+	mem_free(f);
+}
+
+// functions are kept until exit, the code may be running when redefined
+static
+struct vm_proto* proto_new(const char* name)
+{
+	struct vm_proto* f = proto_alloc(name);
+	f->next = vm_protos;
+	vm_protos = f;
+	return f;
+}
+
+/*
+  Compiler: one pass, recursive descent, code is emitted while
+  parsing. Errors longjmp out of the parse.
+ */
+
+enum VmTokens {
+	TK_EOF,
+	TK_NUM,
+	TK_STR,
+	TK_NAME,
+	TK_PUNCT
+};
+
+struct vm_loop {
+	size_t breaks[VM_MAX_BREAKS];
+	int nbreaks;
+	struct vm_loop* outer;
+};
+
+struct vm_compiler {
+	const char* p;
+	const char* chunk;
+	int line;
+	// current token
+	int tok;
+	int tok_line;
+	double num;
+	char text[256];
+
+	struct vm_proto* proto;
+	int32_t locals[VM_MAX_LOCALS]; // sym per slot, or VM_SLOT_HIDDEN / VM_SLOT_RETIRED
+	int nlocals;
+	bool in_func;
+	int depth; // statements nested in blocks don't echo assignments
+	struct vm_loop* loop;
+	jmp_buf fail;
+};
+
+static
+void compile_error(struct vm_compiler* c, const char* msg, ...)
+{
+	char buf[256];
+	va_list va_args;
+	va_start(va_args, msg);
+	vsnprintf(buf, sizeof(buf), msg, va_args);
+	va_end(va_args);
+	ui_console_printf("%s:%d: %s", c->chunk, c->tok_line, buf);
+	longjmp(c->fail, 1);
+}
+
+static
+void lex_next(struct vm_compiler* c)
+{
+	const char* p = c->p;
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == ';') {
+			if (*p == '\n')
+				c->line++;
+			++p;
+		}
+		if (*p != '#')
+			break;
+		while (*p && *p != '\n')
+			++p;
+	}
+	c->tok_line = c->line;
+	if (*p == '\0') {
+		c->tok = TK_EOF;
+		c->text[0] = '\0';
+	} else if (isdigit((unsigned char)*p) || (*p == '.' && isdigit((unsigned char)p[1]))) {
+		char* end;
+		c->num = strtod(p, &end);
+		c->tok = TK_NUM;
+		p = end;
+	} else if (isalpha((unsigned char)*p) || *p == '_') {
+		size_t n = 0;
+		while (isalnum((unsigned char)*p) || *p == '_' || *p == '.') {
+			if (n + 1 >= sizeof(c->text))
+				compile_error(c, "name too long");
+			c->text[n++] = *p++;
+		}
+		c->text[n] = '\0';
+		c->tok = TK_NAME;
+	} else if (*p == '"') {
+		size_t n = 0;
+		++p;
+		while (*p && *p != '"' && *p != '\n') {
+			char ch = *p++;
+			if (ch == '\\' && *p) {
+				ch = *p++;
+				if (ch == 'n') ch = '\n';
+				else if (ch == 't') ch = '\t';
+			}
+			if (n + 1 >= sizeof(c->text))
+				compile_error(c, "string too long");
+			c->text[n++] = ch;
+		}
+		if (*p != '"')
+			compile_error(c, "unterminated string");
+		++p;
+		c->text[n] = '\0';
+		c->tok = TK_STR;
+	} else {
+		static const char* ops2[] = { "==", "!=", "<=", ">=" };
+		c->tok = TK_PUNCT;
+		c->text[0] = *p;
+		c->text[1] = '\0';
+		for (size_t i = 0; i < ASIZE(ops2); ++i) {
+			if (p[0] == ops2[i][0] && p[1] == ops2[i][1]) {
+				c->text[1] = p[1];
+				c->text[2] = '\0';
+				++p;
+				break;
+			}
+		}
+		++p;
+	}
+	c->p = p;
+}
+
+static inline
+bool tok_is(struct vm_compiler* c, const char* text)
+{
+	return (c->tok == TK_NAME || c->tok == TK_PUNCT) && strcmp(c->text, text) == 0;
+}
+
+static inline
+const char* tok_text(struct vm_compiler* c)
+{
+	return (c->tok == TK_EOF) ? "end of input" : c->text;
+}
+
+static
+void expect(struct vm_compiler* c, const char* text)
+{
+	if (!tok_is(c, text))
+		compile_error(c, "expected '%s' near '%s'", text, tok_text(c));
+	lex_next(c);
+}
+
+static
+bool is_keyword(const char* name)
+{
+	static const char* keywords[] = {
+		"if", "then", "elseif", "else", "end", "while", "do", "for", "func",
+		"return", "break", "and", "or", "not", "true", "false"
+	};
+	for (size_t i = 0; i < ASIZE(keywords); ++i)
+		if (strcmp(name, keywords[i]) == 0)
+			return true;
+	return false;
+}
+
+static
+void emit(struct vm_compiler* c, const void* data, size_t n)
+{
+	struct vm_proto* f = c->proto;
+	if (f->len + n > f->cap) {
+		f->cap = ML_MAX(f->cap * 2, f->len + n + 64);
+		f->code = mem_realloc(MEM_SCRIPT, f->code, f->cap);
+	}
+	memcpy(f->code + f->len, data, n);
+	f->len += n;
+}
+
+static inline
+void emit_op(struct vm_compiler* c, uint8_t op)
+{
+	emit(c, &op, 1);
+}
+
+static inline
+void emit_u8(struct vm_compiler* c, uint8_t op, uint8_t arg)
+{
+	uint8_t b[2] = { op, arg };
+	emit(c, b, 2);
+}
+
+static inline
+void emit_u32(struct vm_compiler* c, uint8_t op, uint32_t arg)
+{
+	emit_op(c, op);
+	emit(c, &arg, sizeof(arg));
+}
+
+static
+void emit_num(struct vm_compiler* c, double num)
+{
+	emit_op(c, OP_NUM);
+	emit(c, &num, sizeof(num));
+}
+
+// returns the offset of the jump operand, for patch_jump
+static
+size_t emit_jump(struct vm_compiler* c, uint8_t op)
+{
+	int32_t rel = 0;
+	emit_op(c, op);
+	emit(c, &rel, sizeof(rel));
+	return c->proto->len - sizeof(rel);
+}
+
+static
+void patch_jump(struct vm_compiler* c, size_t at, size_t target)
+{
+	int32_t rel = (int32_t)target - (int32_t)(at + sizeof(int32_t));
+	memcpy(c->proto->code + at, &rel, sizeof(rel));
+}
+
+static
+void emit_loop(struct vm_compiler* c, size_t target)
+{
+	size_t at = emit_jump(c, OP_JMP);
+	patch_jump(c, at, target);
+}
+
+static
+int find_local(struct vm_compiler* c, uint32_t sym)
+{
+	for (int i = c->nlocals - 1; i >= 0; --i)
+		if (c->locals[i] == (int32_t)sym)
+			return i;
+	return -1;
+}
+
+static
+int add_local(struct vm_compiler* c, int32_t sym)
+{
+	for (int i = 0; i < c->nlocals; ++i) {
+		if (c->locals[i] == VM_SLOT_RETIRED) {
+			c->locals[i] = sym;
+			return i;
+		}
+	}
+	if (c->nlocals >= VM_MAX_LOCALS)
+		compile_error(c, "too many locals");
+	c->locals[c->nlocals] = sym;
+	c->proto->nlocals = ML_MAX(c->proto->nlocals, c->nlocals + 1);
+	return c->nlocals++;
+}
+
+static
+void emit_load(struct vm_compiler* c, const char* name)
+{
+	uint32_t sym = sym_intern_str(name);
+	int slot;
+	if (strchr(name, '.') != NULL)
+		emit_u32(c, OP_VAR, sym);
+	else if ((slot = find_local(c, sym)) >= 0)
+		emit_u8(c, OP_LOCAL, (uint8_t)slot);
+	else
+		emit_u32(c, OP_GLOBAL, sym);
+}
+
+static
+void emit_store(struct vm_compiler* c, const char* name)
+{
+	uint32_t sym = sym_intern_str(name);
+	int slot;
+	if (strchr(name, '.') != NULL) {
+		uint8_t echo = (!c->in_func && c->depth == 0);
+		emit_u32(c, OP_SETVAR, sym);
+		emit(c, &echo, 1);
+	} else if (c->in_func) {
+		if ((slot = find_local(c, sym)) < 0)
+			slot = add_local(c, (int32_t)sym);
+		emit_u8(c, OP_SETLOCAL, (uint8_t)slot);
+	} else if ((slot = find_local(c, sym)) >= 0) {
+		emit_u8(c, OP_SETLOCAL, (uint8_t)slot);
+	} else {
+		emit_u32(c, OP_SETGLOBAL, sym);
+	}
+}
+
+static void expr(struct vm_compiler* c);
+static void block(struct vm_compiler* c);
+
+static inline
+const char* skip_blanks(const char* p)
+{
+	while (*p == ' ' || *p == '\t')
+		++p;
+	return p;
+}
+
+// current token is the function name, c->p is just past it
+static
+void call(struct vm_compiler* c, const char* name)
+{
+	uint32_t sym = sym_intern_str(name);
+	int argc = 0;
+	int line = c->tok_line;
+	lex_next(c);
+	expect(c, "(");
+	if (!tok_is(c, ")")) {
+		for (;;) {
+			expr(c);
+			if (++argc > VM_MAX_ARGS)
+				compile_error(c, "too many arguments to %s", name);
+			if (!tok_is(c, ","))
+				break;
+			lex_next(c);
+		}
+	}
+	expect(c, ")");
+	struct vm_sym* s = vm_syms + sym;
+	int nargs = (s->func != NULL) ? s->func->nparams : (s->native != NULL) ? s->nargs : -1;
+	if (nargs >= 0 && nargs != argc) {
+		c->tok_line = line;
+		compile_error(c, "%s takes %d arguments", name, nargs);
+	}
+	emit_u32(c, OP_CALL, sym);
+	emit(c, &(uint8_t){ (uint8_t)argc }, 1);
+}
+
+static
+void primary(struct vm_compiler* c)
+{
+	if (c->tok == TK_NUM) {
+		emit_num(c, c->num);
+		lex_next(c);
+	} else if (c->tok == TK_STR) {
+		emit_u32(c, OP_STR, sym_intern_str(c->text));
+		lex_next(c);
+	} else if (tok_is(c, "(")) {
+		lex_next(c);
+		expr(c);
+		expect(c, ")");
+	} else if (tok_is(c, "true") || tok_is(c, "false")) {
+		emit_num(c, tok_is(c, "true") ? 1.0 : 0.0);
+		lex_next(c);
+	} else if (c->tok == TK_NAME && !is_keyword(c->text)) {
+		char name[256];
+		strmcpy(name, c->text, sizeof(name));
+		if (*skip_blanks(c->p) == '(') {
+			call(c, name);
+		} else {
+			emit_load(c, name);
+			lex_next(c);
+		}
+	} else {
+		compile_error(c, "unexpected '%s'", tok_text(c));
+	}
+}
+
+static
+void unary(struct vm_compiler* c)
+{
+	if (tok_is(c, "-")) {
+		lex_next(c);
+		unary(c);
+		emit_op(c, OP_NEG);
+	} else if (tok_is(c, "not") || tok_is(c, "!")) {
+		lex_next(c);
+		unary(c);
+		emit_op(c, OP_NOT);
+	} else {
+		primary(c);
+	}
+}
+
+static
+void term(struct vm_compiler* c)
+{
+	unary(c);
+	for (;;) {
+		uint8_t op;
+		if (tok_is(c, "*")) op = OP_MUL;
+		else if (tok_is(c, "/")) op = OP_DIV;
+		else if (tok_is(c, "%")) op = OP_MOD;
+		else break;
+		lex_next(c);
+		unary(c);
+		emit_op(c, op);
+	}
+}
+
+static
+void sum(struct vm_compiler* c)
+{
+	term(c);
+	for (;;) {
+		uint8_t op;
+		if (tok_is(c, "+")) op = OP_ADD;
+		else if (tok_is(c, "-")) op = OP_SUB;
+		else break;
+		lex_next(c);
+		term(c);
+		emit_op(c, op);
+	}
+}
+
+static
+void comparison(struct vm_compiler* c)
+{
+	sum(c);
+	for (;;) {
+		uint8_t op;
+		if (tok_is(c, "==")) op = OP_EQ;
+		else if (tok_is(c, "!=")) op = OP_NE;
+		else if (tok_is(c, "<")) op = OP_LT;
+		else if (tok_is(c, "<=")) op = OP_LE;
+		else if (tok_is(c, ">")) op = OP_GT;
+		else if (tok_is(c, ">=")) op = OP_GE;
+		else break;
+		lex_next(c);
+		sum(c);
+		emit_op(c, op);
+	}
+}
+
+static
+void conjunction(struct vm_compiler* c)
+{
+	comparison(c);
+	while (tok_is(c, "and")) {
+		lex_next(c);
+		size_t j = emit_jump(c, OP_AND);
+		comparison(c);
+		patch_jump(c, j, c->proto->len);
+	}
+}
+
+static
+void expr(struct vm_compiler* c)
+{
+	conjunction(c);
+	while (tok_is(c, "or")) {
+		lex_next(c);
+		size_t j = emit_jump(c, OP_OR);
+		conjunction(c);
+		patch_jump(c, j, c->proto->len);
+	}
+}
+
+/*
+  Command arguments are read straight from the source: each one is a
+  raw word, a "string", $name or a parenthesized expression, up to the
+  end of the line or ';'.
+ */
+static
+void command(struct vm_compiler* c, const char* name)
+{
+	uint32_t sym = sym_intern_str(name);
+	int argc = 0;
+	for (;;) {
+		const char* p = skip_blanks(c->p);
+		c->p = p;
+		if (*p == '\0' || *p == '\n' || *p == '\r' || *p == ';' || *p == '#')
+			break;
+		if (argc >= VM_MAX_ARGS)
+			compile_error(c, "too many arguments to %s", name);
+		if (*p == '"') {
+			lex_next(c);
+			emit_u32(c, OP_STR, sym_intern_str(c->text));
+		} else if (*p == '$') {
+			const char* start = ++p;
+			while (isalnum((unsigned char)*p) || *p == '_' || *p == '.')
+				++p;
+			char var[256];
+			size_t n = ML_MIN((size_t)(p - start), sizeof(var) - 1);
+			if (n == 0)
+				compile_error(c, "expected a name after '$'");
+			memcpy(var, start, n);
+			var[n] = '\0';
+			emit_load(c, var);
+			c->p = p;
+		} else if (*p == '(') {
+			lex_next(c);
+			lex_next(c);
+			expr(c);
+			if (!tok_is(c, ")"))
+				compile_error(c, "expected ')' near '%s'", tok_text(c));
+			// c->p is just past the ')'
+		} else {
+			const char* start = p;
+			while (*p && !isspace((unsigned char)*p) && *p != ';')
+				++p;
+			emit_u32(c, OP_STR, sym_intern(start, (size_t)(p - start)));
+			c->p = p;
+		}
+		++argc;
+	}
+	emit_u32(c, OP_CMD, sym);
+	emit(c, &(uint8_t){ (uint8_t)argc }, 1);
+	lex_next(c);
+}
+
+static
+void if_statement(struct vm_compiler* c)
+{
+	size_t ends[64];
+	int nends = 0;
+	lex_next(c);
+	for (;;) {
+		expr(c);
+		if (tok_is(c, "then"))
+			lex_next(c);
+		size_t next = emit_jump(c, OP_JMPF);
+		block(c);
+		if (tok_is(c, "elseif") || tok_is(c, "else")) {
+			if (nends >= (int)ASIZE(ends))
+				compile_error(c, "too many elseif branches");
+			ends[nends++] = emit_jump(c, OP_JMP);
+		}
+		patch_jump(c, next, c->proto->len);
+		if (tok_is(c, "elseif")) {
+			lex_next(c);
+			continue;
+		}
+		if (tok_is(c, "else")) {
+			lex_next(c);
+			block(c);
+		}
+		break;
+	}
+	expect(c, "end");
+	for (int i = 0; i < nends; ++i)
+		patch_jump(c, ends[i], c->proto->len);
+}
+
+static
+void loop_body(struct vm_compiler* c, struct vm_loop* loop)
+{
+	loop->nbreaks = 0;
+	loop->outer = c->loop;
+	c->loop = loop;
+	block(c);
+	c->loop = loop->outer;
+	expect(c, "end");
+}
+
+static
+void while_statement(struct vm_compiler* c)
+{
+	struct vm_loop loop;
+	size_t top = c->proto->len;
+	lex_next(c);
+	expr(c);
+	if (tok_is(c, "do"))
+		lex_next(c);
+	size_t exit = emit_jump(c, OP_JMPF);
+	loop_body(c, &loop);
+	emit_loop(c, top);
+	patch_jump(c, exit, c->proto->len);
+	for (int i = 0; i < loop.nbreaks; ++i)
+		patch_jump(c, loop.breaks[i], c->proto->len);
+}
+
+static
+void for_statement(struct vm_compiler* c)
+{
+	struct vm_loop loop;
+	char var[256];
+	lex_next(c);
+	if (c->tok != TK_NAME || is_keyword(c->text) || strchr(c->text, '.') != NULL)
+		compile_error(c, "expected loop variable near '%s'", tok_text(c));
+	strmcpy(var, c->text, sizeof(var));
+	lex_next(c);
+	expect(c, "=");
+	expr(c);
+	emit_store(c, var);
+	expect(c, ",");
+	expr(c);
+	int limit = add_local(c, VM_SLOT_HIDDEN);
+	emit_u8(c, OP_SETLOCAL, (uint8_t)limit);
+	if (tok_is(c, ",")) {
+		lex_next(c);
+		expr(c);
+	} else {
+		emit_num(c, 1.0);
+	}
+	int step = add_local(c, VM_SLOT_HIDDEN);
+	emit_u8(c, OP_SETLOCAL, (uint8_t)step);
+	if (tok_is(c, "do"))
+		lex_next(c);
+
+	size_t top = c->proto->len;
+	emit_load(c, var);
+	emit_u8(c, OP_LOCAL, (uint8_t)limit);
+	emit_u8(c, OP_LOCAL, (uint8_t)step);
+	emit_op(c, OP_FORTEST);
+	size_t exit = emit_jump(c, OP_JMPF);
+	loop_body(c, &loop);
+	emit_load(c, var);
+	emit_u8(c, OP_LOCAL, (uint8_t)step);
+	emit_op(c, OP_ADD);
+	emit_store(c, var);
+	emit_loop(c, top);
+	patch_jump(c, exit, c->proto->len);
+	for (int i = 0; i < loop.nbreaks; ++i)
+		patch_jump(c, loop.breaks[i], c->proto->len);
+	// the hidden slots can be reused after the loop. Locals first
+	// assigned in the body may sit above them, so retire these two
+	// by index rather than popping the top of the list.
+	c->locals[limit] = VM_SLOT_RETIRED;
+	c->locals[step] = VM_SLOT_RETIRED;
+}
+
+static
+void func_statement(struct vm_compiler* c)
+{
+	lex_next(c);
+	if (c->tok != TK_NAME || is_keyword(c->text) || strchr(c->text, '.') != NULL)
+		compile_error(c, "expected function name near '%s'", tok_text(c));
+	if (c->in_func)
+		compile_error(c, "functions can't be nested");
+	uint32_t sym = sym_intern_str(c->text);
+	if (vm_syms[sym].native != NULL || vm_syms[sym].cmd != NULL)
+		compile_error(c, "%s is already a builtin", c->text);
+	lex_next(c);
+
+	struct vm_compiler fc = *c;
+	fc.proto = proto_new(vm_syms[sym].name);
+	fc.nlocals = 0;
+	fc.in_func = true;
+	fc.depth = 0;
+	fc.loop = NULL;
+	expect(&fc, "(");
+	if (!tok_is(&fc, ")")) {
+		for (;;) {
+			if (fc.tok != TK_NAME || is_keyword(fc.text) || strchr(fc.text, '.') != NULL)
+				compile_error(&fc, "expected parameter name near '%s'", tok_text(&fc));
+			add_local(&fc, (int32_t)sym_intern_str(fc.text));
+			fc.proto->nparams++;
+			lex_next(&fc);
+			if (!tok_is(&fc, ","))
+				break;
+			lex_next(&fc);
+		}
+	}
+	expect(&fc, ")");
+	// defined before the body so it can call itself
+	struct vm_proto* prev = vm_syms[sym].func;
+	vm_syms[sym].func = fc.proto;
+	if (setjmp(fc.fail)) {
+		vm_syms[sym].func = prev;
+		longjmp(c->fail, 1);
+	}
+	block(&fc);
+	expect(&fc, "end");
+	emit_num(&fc, 0.0);
+	emit_op(&fc, OP_RET);
+
+	c->p = fc.p;
+	c->line = fc.line;
+	c->tok = fc.tok;
+	c->tok_line = fc.tok_line;
+	c->num = fc.num;
+	memcpy(c->text, fc.text, sizeof(c->text));
+}
+
+static
+bool at_block_end(struct vm_compiler* c)
+{
+	return c->tok == TK_EOF || tok_is(c, "end") || tok_is(c, "else") || tok_is(c, "elseif");
+}
+
+static
+void statement(struct vm_compiler* c)
+{
+	if (c->tok != TK_NAME)
+		compile_error(c, "unexpected '%s'", c->text);
+
+	if (tok_is(c, "if")) {
+		if_statement(c);
+	} else if (tok_is(c, "while")) {
+		while_statement(c);
+	} else if (tok_is(c, "for")) {
+		for_statement(c);
+	} else if (tok_is(c, "func")) {
+		func_statement(c);
+	} else if (tok_is(c, "return")) {
+		if (!c->in_func)
+			compile_error(c, "return outside a function");
+		int line = c->tok_line;
+		lex_next(c);
+		if (c->tok_line == line && !at_block_end(c))
+			expr(c);
+		else
+			emit_num(c, 0.0);
+		emit_op(c, OP_RET);
+	} else if (tok_is(c, "break")) {
+		if (c->loop == NULL)
+			compile_error(c, "break outside a loop");
+		if (c->loop->nbreaks >= VM_MAX_BREAKS)
+			compile_error(c, "too many breaks");
+		c->loop->breaks[c->loop->nbreaks++] = emit_jump(c, OP_JMP);
+		lex_next(c);
+	} else if (is_keyword(c->text)) {
+		compile_error(c, "unexpected '%s'", c->text);
+	} else {
+		char name[256];
+		strmcpy(name, c->text, sizeof(name));
+		const char* p = skip_blanks(c->p);
+		if (p[0] == '=' && p[1] != '=') {
+			lex_next(c);
+			lex_next(c);
+			expr(c);
+			emit_store(c, name);
+		} else if (p[0] == '(') {
+			call(c, name);
+			emit_op(c, OP_POP);
+		} else {
+			command(c, name);
+		}
+	}
+}
+
+static
+void block(struct vm_compiler* c)
+{
+	c->depth++;
+	while (!at_block_end(c))
+		statement(c);
+	c->depth--;
+}
+
+static
+struct vm_proto* compile(const char* src, const char* chunkname)
+{
+	struct vm_compiler c;
+	memset(&c, 0, sizeof(c));
+	c.p = src;
+	c.chunk = chunkname;
+	c.line = 1;
+	c.proto = proto_alloc(chunkname);
+	if (setjmp(c.fail)) {
+		proto_free(c.proto);
+		return NULL;
+	}
+	lex_next(&c);
+	while (c.tok != TK_EOF) {
+		if (at_block_end(&c))
+			compile_error(&c, "unexpected '%s'", c.text);
+		statement(&c);
+	}
+	emit_num(&c, 0.0);
+	emit_op(&c, OP_RET);
+	return c.proto;
+}
+
+/*
+  Interpreter
+ */
+
+static inline
+bool truthy(const struct script_value* v)
+{
+	return (v->type == SCRIPT_STR) ? v->str[0] != '\0' : v->num != 0.0;
+}
+
+static inline
+struct script_value num_value(double num)
+{
+	struct script_value v = { SCRIPT_NUM, num, NULL };
+	return v;
+}
+
+static
+bool values_equal(const struct script_value* a, const struct script_value* b)
+{
+	if (a->type == SCRIPT_STR && b->type == SCRIPT_STR)
+		return strcmp(a->str, b->str) == 0;
+	return script_tonum(a) == script_tonum(b);
+}
+
+static
+const char* value_string(const struct script_value* v, char* buf, size_t len)
+{
+	if (v->type == SCRIPT_STR)
+		return v->str;
+	snprintf(buf, len, "%.9g", v->num);
+	return buf;
+}
+
+#define READ(T) (ip += sizeof(T), *(const T*)memcpy(&tmp_##T, ip - sizeof(T), sizeof(T)))
+#define RUNTIME_ERROR(...) do { ui_console_printf(__VA_ARGS__); goto fail; } while (0)
+#define NEED(n) do { if (sp + (n) > VM_STACK) RUNTIME_ERROR("%s: stack overflow", frame->proto->name); } while (0)
+
+static
+int execute(struct vm_proto* main)
+{
+	struct script_value stack[VM_STACK];
+	struct vm_frame frames[VM_FRAMES];
+	struct vm_frame* frame = frames;
+	int sp = main->nlocals;
+	uint64_t budget = VM_BUDGET;
+	double tmp_double;
+	uint32_t tmp_uint32_t;
+	int32_t tmp_int32_t;
+	uint8_t tmp_uint8_t;
+
+	if (sp > VM_STACK)
+		return 1;
+	for (int i = 0; i < sp; ++i)
+		stack[i] = num_value(0.0);
+	frame->proto = main;
+	frame->ip = main->code;
+	frame->base = 0;
+	const uint8_t* ip = frame->ip;
+
+	for (;;) {
+		if (--budget == 0)
+			RUNTIME_ERROR("%s: instruction limit reached", frame->proto->name);
+		uint8_t op = *ip++;
+		switch (op) {
+		case OP_NUM:
+			NEED(1);
+			stack[sp++] = num_value(READ(double));
+			break;
+		case OP_STR: {
+			NEED(1);
+			struct script_value v = { SCRIPT_STR, 0.0, vm_syms[READ(uint32_t)].name };
+			stack[sp++] = v;
+		} break;
+		case OP_LOCAL:
+			NEED(1);
+			stack[sp] = stack[frame->base + READ(uint8_t)];
+			sp++;
+			break;
+		case OP_SETLOCAL:
+			stack[frame->base + READ(uint8_t)] = stack[--sp];
+			break;
+		case OP_GLOBAL: {
+			struct vm_sym* s = vm_syms + READ(uint32_t);
+			if (!s->has_global)
+				RUNTIME_ERROR("%s: %s is not defined", frame->proto->name, s->name);
+			NEED(1);
+			stack[sp++] = s->global;
+		} break;
+		case OP_SETGLOBAL: {
+			struct vm_sym* s = vm_syms + READ(uint32_t);
+			s->global = stack[--sp];
+			s->has_global = true;
+		} break;
+		case OP_VAR: {
+			struct vm_sym* s = vm_syms + READ(uint32_t);
+			struct script_value v;
+			if (!script_get_value(s->name, &v))
+				RUNTIME_ERROR("%s: %s is not set", frame->proto->name, s->name);
+			// the store may free the string on the next assignment
+			if (v.type == SCRIPT_STR)
+				v.str = vm_syms[sym_intern_str(v.str)].name;
+			NEED(1);
+			stack[sp++] = v;
+		} break;
+		case OP_SETVAR: {
+			char buf[32];
+			struct vm_sym* s = vm_syms + READ(uint32_t);
+			uint8_t echo = READ(uint8_t);
+			const char* str = value_string(&stack[--sp], buf, sizeof(buf));
+			if (echo)
+				script_set(s->name, str);
+			else
+				script_set_quiet(s->name, str);
+		} break;
+		case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD:
+		case OP_LT: case OP_LE: case OP_GT: case OP_GE: {
+			double b = script_tonum(&stack[--sp]);
+			double a = script_tonum(&stack[sp - 1]);
+			double r = 0.0;
+			switch (op) {
+			case OP_ADD: r = a + b; break;
+			case OP_SUB: r = a - b; break;
+			case OP_MUL: r = a * b; break;
+			case OP_DIV: r = a / b; break;
+			case OP_MOD: r = (b != 0.0) ? fmod(a, b) : 0.0; break;
+			case OP_LT: r = a < b; break;
+			case OP_LE: r = a <= b; break;
+			case OP_GT: r = a > b; break;
+			case OP_GE: r = a >= b; break;
+			}
+			stack[sp - 1] = num_value(r);
+		} break;
+		case OP_EQ: case OP_NE: {
+			bool eq = values_equal(&stack[sp - 2], &stack[sp - 1]);
+			--sp;
+			stack[sp - 1] = num_value((op == OP_EQ) ? eq : !eq);
+		} break;
+		case OP_NEG:
+			stack[sp - 1] = num_value(-script_tonum(&stack[sp - 1]));
+			break;
+		case OP_NOT:
+			stack[sp - 1] = num_value(!truthy(&stack[sp - 1]));
+			break;
+		case OP_JMP: {
+			int32_t rel = READ(int32_t);
+			ip += rel;
+		} break;
+		case OP_JMPF: {
+			int32_t rel = READ(int32_t);
+			if (!truthy(&stack[--sp]))
+				ip += rel;
+		} break;
+		case OP_AND: {
+			int32_t rel = READ(int32_t);
+			if (!truthy(&stack[sp - 1]))
+				ip += rel;
+			else
+				--sp;
+		} break;
+		case OP_OR: {
+			int32_t rel = READ(int32_t);
+			if (truthy(&stack[sp - 1]))
+				ip += rel;
+			else
+				--sp;
+		} break;
+		case OP_FORTEST: {
+			double step = script_tonum(&stack[--sp]);
+			double limit = script_tonum(&stack[--sp]);
+			double i = script_tonum(&stack[sp - 1]);
+			stack[sp - 1] = num_value((step >= 0.0) ? (i <= limit) : (i >= limit));
+		} break;
+		case OP_CALL: {
+			struct vm_sym* s = vm_syms + READ(uint32_t);
+			int argc = READ(uint8_t);
+			int args = sp - argc;
+			if (s->func != NULL) {
+				struct vm_proto* f = s->func;
+				if (argc != f->nparams)
+					RUNTIME_ERROR("%s takes %d arguments", s->name, f->nparams);
+				if (frame + 1 >= frames + VM_FRAMES)
+					RUNTIME_ERROR("%s: call stack overflow", s->name);
+				NEED(f->nlocals - argc);
+				frame->ip = ip;
+				++frame;
+				frame->proto = f;
+				frame->base = args;
+				for (int i = args + argc; i < args + f->nlocals; ++i)
+					stack[i] = num_value(0.0);
+				sp = args + f->nlocals;
+				ip = f->code;
+			} else if (s->native != NULL) {
+				double r = s->native(argc, stack + args);
+				sp = args;
+				stack[sp++] = num_value(r);
+			} else {
+				RUNTIME_ERROR("%s: %s is not a function", frame->proto->name, s->name);
+			}
+		} break;
+		case OP_CMD: {
+			struct vm_sym* s = vm_syms + READ(uint32_t);
+			int argc = READ(uint8_t);
+			char bufs[VM_MAX_ARGS][32];
+			char* argv[VM_MAX_ARGS + 1];
+			if (s->cmd == NULL)
+				RUNTIME_ERROR("undefined: %s", s->name);
+			argv[0] = s->name;
+			for (int i = 0; i < argc; ++i)
+				argv[i + 1] = (char*)value_string(&stack[sp - argc + i], bufs[i], sizeof(bufs[i]));
+			sp -= argc;
+			s->cmd(argc, argv);
+		} break;
+		case OP_POP:
+			--sp;
+			break;
+		case OP_RET: {
+			struct script_value r = stack[--sp];
+			if (frame == frames)
+				return 0;
+			sp = frame->base;
+			stack[sp++] = r;
+			--frame;
+			ip = frame->ip;
+		} break;
+		default:
+			RUNTIME_ERROR("bad opcode %d", op);
+		}
+	}
+fail:
+	return 1;
+}
+
+#undef READ
+#undef RUNTIME_ERROR
+#undef NEED
+
+int scriptvm_run(const char* src, const char* chunkname)
+{
+	struct vm_proto* f = compile(src, chunkname);
+	if (f == NULL)
+		return 1;
+	int ret = execute(f);
+	proto_free(f);
+	return ret;
+}
+
+/*
+  Builtin natives
+ */
+
+static
+double native_print(int argc, const struct script_value* argv)
+{
+	char line[256];
+	char num[32];
+	size_t n = 0;
+	line[0] = '\0';
+	for (int i = 0; i < argc && n < sizeof(line) - 1; ++i)
+		n += strmcpy(line + n, value_string(&argv[i], num, sizeof(num)), (unsigned)(sizeof(line) - n));
+	ui_console_printf("%s", line);
+	return 0.0;
+}
+
+static double native_floor(int argc, const struct script_value* argv) { return floor(script_tonum(argv)); }
+static double native_sqrt(int argc, const struct script_value* argv) { return sqrt(script_tonum(argv)); }
+static double native_abs(int argc, const struct script_value* argv) { return fabs(script_tonum(argv)); }
+static double native_sin(int argc, const struct script_value* argv) { return sin(script_tonum(argv)); }
+static double native_cos(int argc, const struct script_value* argv) { return cos(script_tonum(argv)); }
+static double native_min(int argc, const struct script_value* argv) { return ML_MIN(script_tonum(argv), script_tonum(argv + 1)); }
+static double native_max(int argc, const struct script_value* argv) { return ML_MAX(script_tonum(argv), script_tonum(argv + 1)); }
+static double native_time(int argc, const struct script_value* argv) { return (double)sys_timens() / 1e6; }
+
+// random(n): integer in [0, n), same sequence every run
+static
+double native_random(int argc, const struct script_value* argv)
+{
+	double n = script_tonum(argv);
+	vm_rng = rand64(vm_rng);
+	return (n >= 1.0) ? (double)(vm_rng % (uint64_t)n) : 0.0;
+}
+
+void scriptvm_init()
+{
+	vm_symcap = 256;
+	vm_nsyms = 0;
+	vm_syms = mem_alloc(MEM_SCRIPT, vm_symcap * sizeof(struct vm_sym));
+	vm_index = NULL;
+	sym_rehash(512);
+	vm_protos = NULL;
+	vm_rng = 0x9e3779b97f4a7c15ull;
+
+	scriptvm_defnative("print", -1, native_print);
+	scriptvm_defnative("floor", 1, native_floor);
+	scriptvm_defnative("sqrt", 1, native_sqrt);
+	scriptvm_defnative("abs", 1, native_abs);
+	scriptvm_defnative("sin", 1, native_sin);
+	scriptvm_defnative("cos", 1, native_cos);
+	scriptvm_defnative("min", 2, native_min);
+	scriptvm_defnative("max", 2, native_max);
+	scriptvm_defnative("time", 0, native_time);
+	scriptvm_defnative("random", 1, native_random);
+}
+
+void scriptvm_exit()
+{
+	while (vm_protos != NULL) {
+		struct vm_proto* next = vm_protos->next;
+		proto_free(vm_protos);
+		vm_protos = next;
+	}
+	for (uint32_t i = 0; i < vm_nsyms; ++i)
+		mem_free(vm_syms[i].name);
+	mem_free(vm_syms);
+	mem_free(vm_index);
+	vm_syms = NULL;
+	vm_index = NULL;
+	vm_nsyms = vm_symcap = vm_indexcap = 0;
+}
+
+void scriptvm_defun(const char* name, void (*cb)(int argc, char** argv))
+{
+	vm_syms[sym_intern_str(name)].cmd = cb;
+}
+
+void scriptvm_defnative(const char* name, int nargs, script_native fn)
+{
+	struct vm_sym* s = vm_syms + sym_intern_str(name);
+	s->native = fn;
+	s->nargs = nargs;
+}
+
+/*
+  Self test, "roam scripttest". Each case calls expect(got, want)
+  and the run fails if any expectation or compile does.
+ */
+
+static int selftest_failures;
+
+static
+double native_expect(int argc, const struct script_value* argv)
+{
+	double got = script_tonum(argv), want = script_tonum(argv + 1);
+	if (got != want) {
+		printf("scripttest: expected %g, got %g\n", want, got);
+		selftest_failures++;
+	}
+	return 0.0;
+}
+
+int scriptvm_selftest()
+{
+	static const char* cases[] = {
+		// a local first assigned in a for body outlives the loop
+		"func t_forbody()\n for i = 1, 3 do\n y = i\n end\n return y\nend\nexpect(t_forbody(), 3)\n",
+		"func t_nested()\n s = 0\n for i = 1, 3 do\n for j = i, 1, -1 do\n k = j\n s = s + k\n end\n last = i\n end\n return s * 10 + last\nend\nexpect(t_nested(), 103)\n",
+		"func t_break()\n n = 0\n while 1 do\n for i = 1, 10 do\n if i > 4 then\n break\n end\n n = n + 1\n end\n break\n end\n return n\nend\nexpect(t_break(), 4)\n",
+		"func t_fib(n)\n if n < 2 then\n return n\n end\n return t_fib(n - 1) + t_fib(n - 2)\nend\nexpect(t_fib(15), 610)\n",
+	};
+	scriptvm_init();
+	scriptvm_defnative("expect", 2, native_expect);
+	selftest_failures = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+		if (scriptvm_run(cases[i], "scripttest") != 0)
+			selftest_failures++;
+
+	// retired loop slots are reused, so loops in sequence don't run
+	// out of locals
+	char src[8192];
+	size_t n = (size_t)snprintf(src, sizeof(src), "func t_many()\n s = 0\n");
+	for (int i = 0; i < VM_MAX_LOCALS; ++i)
+		n += (size_t)snprintf(src + n, sizeof(src) - n, " for i = 1, 2 do s = s + i end\n");
+	snprintf(src + n, sizeof(src) - n, " return s\nend\nexpect(t_many(), %d)\n", VM_MAX_LOCALS * 3);
+	if (scriptvm_run(src, "scripttest") != 0)
+		selftest_failures++;
+
+	scriptvm_exit();
+	printf("scripttest: %s\n", selftest_failures ? "FAILED" : "ok");
+	return selftest_failures ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "common.h"
+#include "script.h"
+
+/*
+  Compiler and bytecode interpreter behind script_exec and
+  script_dofile. Source is compiled to a stack bytecode once and then
+  run; functions stay compiled until exit.
+
+    x = 1 + 2 * y            # global (local inside a func)
+    player.accel = x * 10    # dotted names are script variables
+    if x > 2 ... elseif x < 0 ... else ... end
+    while x < 10 ... end
+    for i = 0, 15 [, step] ... end       # inclusive, break leaves a loop
+    func f(a, b) return a + b end
+    print("f:", f(1, 2))
+    fill 0 60 0 (x) 70 15 stone  # command: raw words, "strings",
+                                 # $var or (expr), up to end of line or ;
+
+  Values are numbers or strings. Names are resolved at compile time:
+  inside a function, parameters and assigned names are locals and
+  everything else is a global. Commands (script_defun) and natives
+  (script_defnative) share one hashed symbol table, and calls in the
+  bytecode refer to symbols by index.
+ */
+
+void scriptvm_init(void);
+void scriptvm_exit(void);
+
+// compiles and runs src, errors go to the console. Returns 0 on success.
+int scriptvm_run(const char* src, const char* chunkname);
+
+void scriptvm_defun(const char* name, void (*cb)(int argc, char** argv));
+void scriptvm_defnative(const char* name, int nargs, script_native fn);
+
+// "roam scripttest": compiles and runs the language tests, 0 if all pass
+int scriptvm_selftest(void);
@@ -79,6 +79,24 @@ static const char* debug_vshader = "#version 330\n"
 	"    gl_Position = sspos;\n"
 	"}\n";
 
+// one box or sphere per instance. position.w is 1 where the unit
+// shape scales with the extent and 0 for the fixed size center cross.
+static const char* debug_instanced_vshader = "#version 330\n"
+	"uniform mat4 projmat;\n"
+	"uniform mat4 modelview;\n"
+	"layout (location = 0) in vec4 position;\n"
+	"layout (location = 1) in vec3 center;\n"
+	"layout (location = 2) in vec3 extent;\n"
+	"layout (location = 3) in vec4 color;\n"
+	"out vec4 out_color;\n"
+	"void main() {\n"
+	"    out_color = color;\n"
+	"    vec3 pos = center + position.xyz * mix(vec3(1, 1, 1), extent, position.w);\n"
+	"    vec4 sspos = projmat * modelview * vec4(pos, 1);\n"
+	"    sspos.z -= 0.005;\n"
+	"    gl_Position = sspos;\n"
+	"}\n";
+
 static const char* debug_fshader = "#version 330\n"
 	"precision highp float;\n"
 	"in vec4 out_color;\n"
@@ -92,9 +110,9 @@ static const char* chunk_vshader = "#version 330\n"
 	"uniform mat4 modelview;\n"
 	"uniform vec3 chunk_offset;\n"
 	"layout (location = 0) in vec4 position;\n"
-	"layout (location = 1) in vec2 texcoord;\n"
+	"layout (location = 1) in uvec2 texcoord;\n" // layer, corner
 	"layout (location = 2) in vec4 color;\n"
-	"out vec2 out_texcoord;\n"
+	"out vec3 out_texcoord;\n"
 	"out vec4 out_color;\n"
 	"out vec3 out_color2;\n"
 	"out float out_depth;\n"
@@ -104,7 +122,8 @@ static const char* chunk_vshader = "#version 330\n"
 	"    out_color = color;\n"
 	"    out_color2 = max(vec3(10, 10, 10) - (vec3(1, 1, 1) * length(tpos.xyz)), vec3(0, 0, 0)) * vec3(0.1, 0.1, 0.1);\n"
 	"    out_depth = length(tpos.xyz);\n"
-	"    out_texcoord = texcoord;\n"
+	"    const vec2 corners[4] = vec2[4](vec2(0, 1), vec2(1, 1), vec2(1, 0), vec2(0, 0));\n"
+	"    out_texcoord = vec3(corners[texcoord.y], float(texcoord.x));\n"
 	"    gl_Position = projmat * tpos;\n"
 	"}\n";
 
@@ -115,8 +134,8 @@ static const char* chunk_fshader = "#version 330\n"
 	"precision highp float;\n"
 	"uniform vec3 amb_light;\n"
 	"uniform vec4 fog_color;\n"
-	"uniform sampler2D tex0;\n"
-	"in vec2 out_texcoord;\n"
+	"uniform sampler2DArray tex0;\n"
+	"in vec3 out_texcoord;\n"
 	"in vec4 out_color;\n"
 	"in vec3 out_color2;\n"
 	"in float out_depth;\n"
@@ -128,7 +147,7 @@ static const char* chunk_fshader = "#version 330\n"
 	"}\n"
 	"void main() {\n"
 	"    vec4 tex = texture(tex0, out_texcoord);\n"
-	"    if (tex.w == 0) discard;\n"
+	"    if (tex.w < 0.5) discard;\n" // mips blend alpha at cutout edges
 	"    vec3 light = clamp(out_color.xyz + (amb_light.xyz * out_color.w) + (vec3(0.5, 0.5, 0.5) * out_color2.xyz), 0, 1);\n"
 //	"    vec3 light = clamp(((amb_light.xyz * out_color.w)), 0, 1);\n"
 //	"    vec3 base = light.xyz;\n"
@@ -143,8 +162,8 @@ static const char* chunkalpha_fshader = "#version 330\n"
 	"precision highp float;\n"
 	"uniform vec3 amb_light;\n"
 	"uniform vec4 fog_color;\n"
-	"uniform sampler2D tex0;\n"
-	"in vec2 out_texcoord;\n"
+	"uniform sampler2DArray tex0;\n"
+	"in vec3 out_texcoord;\n"
 	"in vec4 out_color;\n"
 	"in float out_depth;\n"
 	"out vec4 fragment;\n"
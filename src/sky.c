@@ -6,12 +6,18 @@
 #include "script.h"
 
 static mesh_t mesh;
+static float day_length;
+static float fast_day_length;
 
 
 void sky_init()
 {
-	make_hemisphere(&mesh, 5.f, 4);
-	m_set_material(&mesh, game.materials + MAT_SKY);
+	script_bind_float("game.day_length", &day_length, DAY_LENGTH, NULL, NULL);
+	script_bind_float("game.fast_day_length", &fast_day_length, 5.f, NULL, NULL);
+	if (!game.headless) {
+		make_hemisphere(&mesh, 5.f, 4);
+		m_set_material(&mesh, game.materials + MAT_SKY);
+	}
 	sky_tick(0);
 }
 
@@ -71,11 +77,7 @@ vec3_t mkrgb(uint32_t rgb)
 
 void sky_tick(float dt)
 {
-	double daylength;
-	if (game.fast_day_mode)
-		daylength = script_get("game.fast_day_length");
-	else
-		daylength = script_get("game.day_length");
+	double daylength = game.fast_day_mode ? fast_day_length : day_length;
 	double step = (dt / daylength);
 	game.time_of_day += step;
 	while (game.time_of_day >= 1.0) {
@@ -51,3 +51,13 @@ int sys_isfile(const char* filename)
 		return 0;
 	return 1;
 }
+
+bool sys_filestat(const char* filename, uint64_t* size, int64_t* mtime)
+{
+	struct stat tmp;
+	if (stat(filename, &tmp) == -1)
+		return false;
+	*size = (uint64_t)tmp.st_size;
+	*mtime = (int64_t)tmp.st_mtime;
+	return true;
+}
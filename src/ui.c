@@ -5,6 +5,8 @@
 #include "easing.h"
 #include "stb.h"
 #include "script.h"
+#include "arena.h"
+#include "mem.h"
 
 // UI drawing
 static material_t* ui_material = NULL;
@@ -12,23 +14,49 @@ static tex2d_t ui_font;
 static GLint ui_screensize_index = -1;
 static GLint ui_tex0_index = -1;
 static GLuint ui_vao = 0;
-static GLuint ui_vbo = 0;
+static GLuint ui_ibo = 0;
+static size_t ui_ibo_quads = 0;
 static GLsizei ui_count = 0;
 static float ui_scale = 1.5;
-#define MAX_UI_VERTICES 8192
-static uivert_t ui_vertices[MAX_UI_VERTICES];
-static GLsizei ui_maxcount = 0;
+static uivert_t* ui_vertices = NULL; // in arena_frame
+static size_t ui_capacity = 0;
+static uint32_t ui_resets = 0;
 
 // debug 3d drawing
-#define MAX_DEBUG_LINEVERTS 8192
 static material_t* debug_material = NULL;
 static GLint debug_projmat_index = -1;
 static GLint debug_modelview_index = -1;
-static posclrvert_t debug_lines[MAX_DEBUG_LINEVERTS];
+static posclrvert_t* debug_lines = NULL; // in arena_frame
 static size_t debug_linevertcount = 0;
+static size_t debug_capacity = 0;
+static uint32_t debug_resets = 0;
 static GLuint debug_vao = -1;
-static GLuint debug_vbo = -1;
-static size_t debug_maxcount = 0;
+
+// debug boxes and spheres, expanded from a unit shape in the vertex shader
+struct debug_instance {
+	vec3_t center;
+	vec3_t extent;
+	uint32_t clr;
+};
+
+struct debug_list {
+	struct debug_instance* items; // in arena_frame
+	size_t count;
+	size_t capacity;
+	uint32_t resets;
+};
+
+#define DEBUG_SPHERE_NDIV 7
+#define DEBUG_BOX_VERTS 24
+#define DEBUG_SPHERE_VERTS (DEBUG_SPHERE_NDIV*4 + 6)
+
+static material_t* debug_inst_material = NULL;
+static GLint debug_inst_projmat_index = -1;
+static GLint debug_inst_modelview_index = -1;
+static struct debug_list debug_boxes;
+static struct debug_list debug_spheres;
+static GLuint debug_inst_vao = 0;
+static GLuint debug_shape_vbo = 0; // box lines, then sphere lines
 
 static bool console_enabled = false;
 static bool console_first_char = true; // hack to discard toggle key
@@ -42,58 +70,343 @@ static int console_scrollback_pos = 0;
 #define UI_CHAR_W (9)
 #define UI_CHAR_H (9)
 
+/*
+  Vertices are collected in arena_frame during the frame and copied
+  into a stream buffer once, in ui_draw / ui_draw_debug. The stream is
+  split in three regions used in turn, each fenced after its draw, so
+  writing one never waits on the GPU reading another. With
+  ARB_buffer_storage the buffer is mapped once and written with
+  memcpy, otherwise each region is updated with glBufferSubData. A
+  frame that outgrows a region reallocates the stream at twice the
+  size.
+ */
+#define UI_STREAM_REGIONS 3
+
+struct ui_stream {
+	GLuint vbo;
+	uint8_t* mapped; // persistent mapping, or NULL
+	size_t region; // bytes
+	size_t stride;
+	int current;
+	GLsync fences[UI_STREAM_REGIONS];
+};
+
+static struct ui_stream ui_stream;
+static struct ui_stream debug_stream;
+static struct ui_stream debug_inst_stream;
+
+static
+void ui_stream_destroy(struct ui_stream* s)
+{
+	for (int i = 0; i < UI_STREAM_REGIONS; ++i) {
+		if (s->fences[i] != NULL) {
+			glClientWaitSync(s->fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+			glDeleteSync(s->fences[i]);
+			s->fences[i] = NULL;
+		}
+	}
+	if (s->vbo != 0) {
+		glBindBuffer(GL_ARRAY_BUFFER, s->vbo);
+		if (s->mapped != NULL)
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &s->vbo);
+		mem_track(MEM_GPU, -(ptrdiff_t)(s->region * UI_STREAM_REGIONS));
+	}
+	s->vbo = 0;
+	s->mapped = NULL;
+	s->region = 0;
+}
 
-void ui_init(material_t* uimat, material_t* debugmat)
+// returns true if the buffer was recreated and needs to be bound again
+static
+bool ui_stream_reserve(struct ui_stream* s, size_t bytes)
 {
-	ui_material = uimat;
-	ui_screensize_index = glGetUniformLocation(uimat->program, "screensize");
-	ui_tex0_index = glGetUniformLocation(uimat->program, "tex0");
+	if (bytes <= s->region && s->vbo != 0)
+		return false;
+	size_t region = ML_MAX(bytes, ML_MAX(s->region * 2, 64 * 1024));
+	region = (region + s->stride - 1) / s->stride * s->stride; // regions start on a whole vertex
+	ui_stream_destroy(s);
+	s->region = region;
+	s->current = 0;
+	glGenBuffers(1, &s->vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, s->vbo);
+	if (GLEW_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_ARRAY_BUFFER, (GLsizeiptr)(region * UI_STREAM_REGIONS), NULL, flags);
+		s->mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, (GLsizeiptr)(region * UI_STREAM_REGIONS), flags);
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(region * UI_STREAM_REGIONS), NULL, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	mem_track(MEM_GPU, (ptrdiff_t)(region * UI_STREAM_REGIONS));
+	return true;
+}
 
-	debug_material = debugmat;
-	debug_projmat_index = glGetUniformLocation(debugmat->program, "projmat");
-	debug_modelview_index = glGetUniformLocation(debugmat->program, "modelview");
-	printf("projmat: %d, modelview: %d\n", debug_projmat_index, debug_modelview_index);
+// copies the frame's vertices into the next region, returns the index
+// of the first one. Call stream_fence after the draw that uses them.
+static
+GLint ui_stream_push(struct ui_stream* s, const void* data, size_t bytes)
+{
+	s->current = (s->current + 1) % UI_STREAM_REGIONS;
+	GLsync fence = s->fences[s->current];
+	if (fence != NULL) {
+		glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		glDeleteSync(fence);
+		s->fences[s->current] = NULL;
+	}
+	size_t offset = s->region * (size_t)s->current;
+	if (s->mapped != NULL) {
+		memcpy(s->mapped + offset, data, bytes);
+	} else {
+		glBindBuffer(GL_ARRAY_BUFFER, s->vbo);
+		glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)offset, (GLsizeiptr)bytes, data);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	return (GLint)(offset / s->stride);
+}
 
-	m_tex2d_load(&ui_font, "data/font.png");
+static
+void ui_stream_fence(struct ui_stream* s)
+{
+	s->fences[s->current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
 
-	glGenBuffers(1, &ui_vbo);
-	glGenVertexArrays(1, &ui_vao);
+static
+void ui_bind_vao()
+{
 	glBindVertexArray(ui_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, ui_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, ui_stream.vbo);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(uivert_t), 0);
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(uivert_t), (void*)(1 * sizeof(vec2_t)));
 	glVertexAttribPointer(2, GL_BGRA, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(uivert_t), (void*)(2 * sizeof(vec2_t)));
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glEnableVertexAttribArray(2);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ui_ibo);
 	glBindVertexArray(0);
-	ui_count = 0;
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-	glGenBuffers(1, &debug_vbo);
-	glGenVertexArrays(1, &debug_vao);
+static
+void debug_bind_vao()
+{
 	glBindVertexArray(debug_vao);
-	glBindBuffer(GL_ARRAY_BUFFER, debug_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, debug_stream.vbo);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(posclrvert_t), 0);
 	glVertexAttribPointer(1, GL_BGRA, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(posclrvert_t), (void*)(sizeof(vec3_t)));
 	glEnableVertexAttribArray(0);
 	glEnableVertexAttribArray(1);
 	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void ui_text_cache_clear(void);
+
+static
+void debug_inst_bind_vao()
+{
+	glBindVertexArray(debug_inst_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, debug_shape_vbo);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(vec4_t), 0);
+	glEnableVertexAttribArray(0);
+	// the instance attributes point into the stream, set per draw
+	for (GLuint i = 1; i <= 3; ++i) {
+		glEnableVertexAttribArray(i);
+		glVertexAttribDivisor(i, 1);
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static
+void debug_inst_create_shapes()
+{
+	vec4_t v[DEBUG_BOX_VERTS + DEBUG_SPHERE_VERTS];
+	int n = 0;
+	// the twelve edges of the unit cube: each edge runs along one axis
+	for (int axis = 0; axis < 3; ++axis) {
+		for (int k = 0; k < 4; ++k) {
+			float a = (k & 1) ? 1.f : -1.f;
+			float b = (k & 2) ? 1.f : -1.f;
+			for (int end = -1; end <= 1; end += 2) {
+				float c[3];
+				c[axis] = (float)end;
+				c[(axis + 1) % 3] = a;
+				c[(axis + 2) % 3] = b;
+				m_setvec4(v[n], c[0], c[1], c[2], 1.f);
+				++n;
+			}
+		}
+	}
+	// circles around y and z
+	for (int i = 0; i < DEBUG_SPHERE_NDIV; ++i) {
+		float t0 = ((float)i / DEBUG_SPHERE_NDIV) * ML_TWO_PI;
+		float t1 = ((float)(i + 1) / DEBUG_SPHERE_NDIV) * ML_TWO_PI;
+		m_setvec4(v[n], sinf(t0), 0.f, cosf(t0), 1.f); ++n;
+		m_setvec4(v[n], sinf(t1), 0.f, cosf(t1), 1.f); ++n;
+		m_setvec4(v[n], sinf(t0), cosf(t0), 0.f, 1.f); ++n;
+		m_setvec4(v[n], sinf(t1), cosf(t1), 0.f, 1.f); ++n;
+	}
+	// the center cross keeps its size, like ui_debug_point
+	for (int axis = 0; axis < 3; ++axis) {
+		for (int end = -1; end <= 1; end += 2) {
+			float c[3] = { 0.f, 0.f, 0.f };
+			c[axis] = 0.05f * (float)end;
+			m_setvec4(v[n], c[0], c[1], c[2], 0.f);
+			++n;
+		}
+	}
+	glGenBuffers(1, &debug_shape_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, debug_shape_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(v), v, GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	mem_track(MEM_GPU, sizeof(v));
+}
+
+// UI quads are four vertices each, (x0,y0) (x1,y0) (x0,y1) (x1,y1),
+// drawn through one shared index buffer
+static
+void ui_reserve_indices(size_t nquads)
+{
+	if (nquads <= ui_ibo_quads)
+		return;
+	size_t cap = ML_MAX(nquads, ML_MAX(ui_ibo_quads * 2, 4096));
+	uint32_t* idx = arena_alloc(&arena_frame, cap * 6 * sizeof(uint32_t));
+	for (size_t q = 0; q < cap; ++q) {
+		uint32_t v = (uint32_t)q * 4;
+		idx[q*6 + 0] = v;
+		idx[q*6 + 1] = v + 1;
+		idx[q*6 + 2] = v + 2;
+		idx[q*6 + 3] = v + 2;
+		idx[q*6 + 4] = v + 1;
+		idx[q*6 + 5] = v + 3;
+	}
+	glBindVertexArray(0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ui_ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(cap * 6 * sizeof(uint32_t)), idx, GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	if (ui_ibo_quads != 0)
+		mem_track(MEM_GPU, -(ptrdiff_t)(ui_ibo_quads * 6 * sizeof(uint32_t)));
+	mem_track(MEM_GPU, (ptrdiff_t)(cap * 6 * sizeof(uint32_t)));
+	ui_ibo_quads = cap;
+}
+
+// make room for n more vertices in the frame arena. Anything queued
+// before the arena was last reset is gone.
+static
+uivert_t* ui_reserve(size_t n)
+{
+	if (ui_resets != arena_frame.resets) {
+		ui_vertices = NULL;
+		ui_capacity = 0;
+		ui_count = 0;
+		ui_resets = arena_frame.resets;
+	}
+	if (ui_count + n > ui_capacity) {
+		size_t cap = ML_MAX(ui_count + n, ML_MAX(ui_capacity * 2, 4096));
+		ui_vertices = (uivert_t*)arena_grow(&arena_frame, ui_vertices,
+		                                    ui_capacity * sizeof(uivert_t), cap * sizeof(uivert_t));
+		ui_capacity = cap;
+	}
+	return ui_vertices + ui_count;
+}
+
+static
+posclrvert_t* debug_reserve(size_t n)
+{
+	if (debug_resets != arena_frame.resets) {
+		debug_lines = NULL;
+		debug_capacity = 0;
+		debug_linevertcount = 0;
+		debug_resets = arena_frame.resets;
+	}
+	if (debug_linevertcount + n > debug_capacity) {
+		size_t cap = ML_MAX(debug_linevertcount + n, ML_MAX(debug_capacity * 2, 1024));
+		debug_lines = (posclrvert_t*)arena_grow(&arena_frame, debug_lines,
+		                                        debug_capacity * sizeof(posclrvert_t), cap * sizeof(posclrvert_t));
+		debug_capacity = cap;
+	}
+	return debug_lines + debug_linevertcount;
+}
+
+
+static
+struct debug_instance* debug_list_reserve(struct debug_list* list, size_t n)
+{
+	if (list->resets != arena_frame.resets) {
+		list->items = NULL;
+		list->capacity = 0;
+		list->count = 0;
+		list->resets = arena_frame.resets;
+	}
+	if (list->count + n > list->capacity) {
+		size_t cap = ML_MAX(list->count + n, ML_MAX(list->capacity * 2, 256));
+		list->items = (struct debug_instance*)arena_grow(&arena_frame, list->items,
+		                                                 list->capacity * sizeof(struct debug_instance),
+		                                                 cap * sizeof(struct debug_instance));
+		list->capacity = cap;
+	}
+	return list->items + list->count;
+}
+
+
+void ui_init(material_t* uimat, material_t* debugmat, material_t* instmat)
+{
+	script_bind_float("ui.scale", &ui_scale, 1.5f, NULL, NULL);
+	ui_material = uimat;
+	ui_screensize_index = glGetUniformLocation(uimat->program, "screensize");
+	ui_tex0_index = glGetUniformLocation(uimat->program, "tex0");
+
+	debug_material = debugmat;
+	debug_projmat_index = glGetUniformLocation(debugmat->program, "projmat");
+	debug_modelview_index = glGetUniformLocation(debugmat->program, "modelview");
+	printf("projmat: %d, modelview: %d\n", debug_projmat_index, debug_modelview_index);
+
+	m_tex2d_load(&ui_font, "data/font.png");
+
+	glGenBuffers(1, &ui_ibo);
+	glGenVertexArrays(1, &ui_vao);
+	ui_stream.stride = sizeof(uivert_t);
+	ui_stream_reserve(&ui_stream, 0);
+	ui_bind_vao();
+	ui_count = 0;
+
+	glGenVertexArrays(1, &debug_vao);
+	debug_stream.stride = sizeof(posclrvert_t);
+	ui_stream_reserve(&debug_stream, 0);
+	debug_bind_vao();
 	debug_linevertcount = 0;
+
+	debug_inst_material = instmat;
+	debug_inst_projmat_index = glGetUniformLocation(instmat->program, "projmat");
+	debug_inst_modelview_index = glGetUniformLocation(instmat->program, "modelview");
+	debug_inst_create_shapes();
+	glGenVertexArrays(1, &debug_inst_vao);
+	debug_inst_bind_vao();
+	debug_inst_stream.stride = sizeof(struct debug_instance);
+	ui_stream_reserve(&debug_inst_stream, 0);
 }
 
 void ui_exit()
 {
 	m_tex2d_destroy(&ui_font);
-	glDeleteBuffers(1, &ui_vbo);
+	ui_stream_destroy(&ui_stream);
+	ui_stream_destroy(&debug_stream);
+	glDeleteBuffers(1, &ui_ibo);
+	mem_track(MEM_GPU, -(ptrdiff_t)(ui_ibo_quads * 6 * sizeof(uint32_t)));
+	ui_ibo_quads = 0;
 	glDeleteVertexArrays(1, &ui_vao);
-	glDeleteBuffers(1, &debug_vbo);
 	glDeleteVertexArrays(1, &debug_vao);
+	ui_stream_destroy(&debug_inst_stream);
+	glDeleteBuffers(1, &debug_shape_vbo);
+	mem_track(MEM_GPU, -(ptrdiff_t)((DEBUG_BOX_VERTS + DEBUG_SPHERE_VERTS) * sizeof(vec4_t)));
+	glDeleteVertexArrays(1, &debug_inst_vao);
+	ui_text_cache_clear();
 }
 
 void ui_tick(float dt)
 {
-	ui_scale = script_get("ui.scale");
-
 	if (console_enabled)
 		console_fade = m_clamp(console_fade + dt*1.5f, 0, 1.f);
 	else
@@ -139,6 +452,7 @@ void ui_draw(SDL_Point* viewport)
 		ui_text(2, viewport->y - (int)yoffs - UI_CHAR_H*ui_scale - 2, (alpha<<24)|0xeeeeec, "#%s", console_cmdline + offset);
 	}
 
+	ui_reserve(0);
 	if (ui_count > 0) {
 		vec2_t screensize = { (float)viewport->x, (float)viewport->y };
 		glEnable(GL_BLEND);
@@ -149,16 +463,20 @@ void ui_draw(SDL_Point* viewport)
 		m_tex2d_bind(&ui_font, 0);
 		glUniform2fv(ui_screensize_index, 1, (float*)&screensize);
 		glUniform1i(ui_tex0_index, 0);
-		glBindVertexArray(ui_vao);
-		glBindBuffer(GL_ARRAY_BUFFER, ui_vbo);
-		if (ui_count > ui_maxcount) {
-			glBufferData(GL_ARRAY_BUFFER, (unsigned long)(ui_count)*sizeof(uivert_t), ui_vertices, GL_DYNAMIC_DRAW);
-			ui_maxcount = ui_count;
-		} else {
-			glBufferSubData(GL_ARRAY_BUFFER, 0, (unsigned long)(ui_count)*sizeof(uivert_t), ui_vertices);
+		size_t bytes = (size_t)ui_count * sizeof(uivert_t);
+		size_t nquads = (size_t)ui_count / 4;
+		bool rebind = ui_stream_reserve(&ui_stream, bytes);
+		if (nquads > ui_ibo_quads) {
+			ui_reserve_indices(nquads);
+			rebind = true;
 		}
-		glDrawArrays(GL_TRIANGLES, 0, ui_count);
+		if (rebind)
+			ui_bind_vao();
+		GLint base = ui_stream_push(&ui_stream, ui_vertices, bytes);
+		glBindVertexArray(ui_vao);
+		glDrawElementsBaseVertex(GL_TRIANGLES, (GLsizei)(nquads * 6), GL_UNSIGNED_INT, 0, base);
 		glBindVertexArray(0);
+		ui_stream_fence(&ui_stream);
 		glUseProgram(0);
 		glDisable(GL_BLEND);
 //		glEnable(GL_CULL_FACE);
@@ -172,22 +490,54 @@ void ui_set_scale(float scale)
 	ui_scale = scale;
 }
 
-#define MAX_TEXT_LEN 256
+#define MAX_TEXT_LEN 512
+
+/*
+  Formats into buf, or into arena_frame if the text doesn't fit.
+  Strings without a conversion, and a plain "%s", are used as they
+  are (a NULL argument still shows as "(null)").
+ */
+static
+const char* ui_format(char* buf, size_t size, size_t* len, const char* str, va_list va_args)
+{
+	const char* text = str;
+	if (strcmp(str, "%s") == 0) {
+		text = va_arg(va_args, const char*);
+		if (text == NULL)
+			text = "(null)"; // as vsnprintf prints it
+	} else if (strchr(str, '%') != NULL) {
+		va_list again;
+		va_copy(again, va_args);
+		int n = vsnprintf(buf, size, str, va_args);
+		if (n < 0) {
+			buf[0] = '\0';
+			n = 0;
+		} else if ((size_t)n >= size) {
+			char* big = arena_alloc(&arena_frame, (size_t)n + 1);
+			vsnprintf(big, (size_t)n + 1, str, again);
+			buf = big;
+		}
+		va_end(again);
+		*len = (size_t)n;
+		return buf;
+	}
+	*len = strlen(text);
+	return text;
+}
 
 void ui_text_measure(int* w, int* h, const char* str, ...)
 {
 	char buf[MAX_TEXT_LEN];
+	size_t len;
 	va_list va_args;
 	va_start(va_args, str);
-	vsnprintf(buf, MAX_TEXT_LEN, str, va_args);
+	const char* text = ui_format(buf, sizeof(buf), &len, str, va_args);
 	va_end(va_args);
 	int scale = ui_scale * UI_CHAR_H;
 
-	size_t len;
-	len = strlen(buf);
 	int cx = 0, cy = scale, mx = 0;
 	for (size_t i = 0; i < len; ++i) {
-		if (buf[i] == '\n') {
+		if (text[i] == '\n') {
 			mx = (cx > mx) ? cx : mx;
 			cx = 0;
 			cy += scale;
@@ -198,65 +548,120 @@ void ui_text_measure(int* w, int* h, const char* str, ...)
 	*h = cy;
 }
 
+static
+size_t ui_text_tessellate(uivert_t* out, float x, float y, uint32_t clr, const char* text, size_t len)
+{
+	float scale = (float)(int)(ui_scale * UI_CHAR_H);
+	float d = (float)UI_CHAR_W / (float)ui_font.w;
+	float v = (float)UI_CHAR_H / (float)ui_font.h;
+	uivert_t* ptr = out;
+	vec2_t rpos = { x, y };
+	for (size_t i = 0; i < len; ++i) {
+		if (text[i] == '\n') {
+			rpos.x = x;
+			rpos.y -= scale;
+			continue;
+		} else if (text[i] == ' ') {
+			rpos.x += scale;
+			continue;
+		}
+		float u = (float)(text[i] - ' ') * d;
+		float x1 = rpos.x + scale, y1 = rpos.y + scale;
+		ptr[0].pos.x = rpos.x, ptr[0].pos.y = rpos.y, ptr[0].tc.x = u,     ptr[0].tc.y = v,   ptr[0].clr = clr;
+		ptr[1].pos.x = x1,     ptr[1].pos.y = rpos.y, ptr[1].tc.x = u + d, ptr[1].tc.y = v,   ptr[1].clr = clr;
+		ptr[2].pos.x = rpos.x, ptr[2].pos.y = y1,     ptr[2].tc.x = u,     ptr[2].tc.y = 0.f, ptr[2].clr = clr;
+		ptr[3].pos.x = x1,     ptr[3].pos.y = y1,     ptr[3].tc.x = u + d, ptr[3].tc.y = 0.f, ptr[3].clr = clr;
+		ptr += 4;
+		rpos.x += scale;
+	}
+	return (size_t)(ptr - out);
+}
+
+/*
+  Glyph layout cache: text drawn again at the same place, in the same
+  color and scale is copied from the quads built the last time. Most
+  of the console and the static parts of the debug overlay hit. Direct
+  mapped on a hash of everything that goes into the layout.
+ */
+#define UI_TEXT_CACHE 128
+#define UI_TEXT_CACHE_MAXLEN 4096
+
+struct ui_text_entry {
+	uint64_t hash;
+	float x, y, scale;
+	uint32_t clr;
+	char* text;
+	size_t len;
+	uivert_t* verts;
+	size_t nverts;
+	size_t capacity; // chars, there is room for 4 vertices each
+};
+
+static struct ui_text_entry ui_text_cache[UI_TEXT_CACHE];
+
+static
+void ui_text_cache_clear()
+{
+	for (int i = 0; i < UI_TEXT_CACHE; ++i) {
+		mem_free(ui_text_cache[i].text);
+		mem_free(ui_text_cache[i].verts);
+	}
+	memset(ui_text_cache, 0, sizeof(ui_text_cache));
+}
+
+static inline
+uint64_t ui_text_hash(float x, float y, uint32_t clr, const char* text, size_t len)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (size_t i = 0; i < len; ++i)
+		h = (h ^ (uint8_t)text[i]) * 1099511628211ull;
+	float key[3] = { x, y, ui_scale };
+	uint32_t bits[3];
+	memcpy(bits, key, sizeof(bits));
+	for (int i = 0; i < 3; ++i)
+		h = (h ^ bits[i]) * 1099511628211ull;
+	return (h ^ clr) * 1099511628211ull;
+}
 
 void ui_text(float x, float y, uint32_t clr, const char* str, ...)
 {
 	char buf[MAX_TEXT_LEN];
 	size_t len;
-	int scale;
-	float d, v;
-	uivert_t* ptr = ui_vertices + ui_count;
 	va_list va_args;
 	va_start(va_args, str);
-	vsnprintf(buf, MAX_TEXT_LEN, str, va_args);
+	const char* text = ui_format(buf, sizeof(buf), &len, str, va_args);
 	va_end(va_args);
-	len = strlen(buf);
-	if (ui_count + len*6 > MAX_UI_VERTICES)
+	if (len == 0)
 		return;
 
-	scale = ui_scale * UI_CHAR_H;
-
-	int cx = 0, w = 0, h = scale;
-	for (size_t i = 0; i < len; ++i) {
-		if (buf[i] == '\n') {
-			w = (cx > w) ? cx : w;
-			cx = 0;
-			h += scale;
-		}
-		cx += scale;
+	uint64_t h = ui_text_hash(x, y, clr, text, len);
+	struct ui_text_entry* e = ui_text_cache + (h % UI_TEXT_CACHE);
+	if (e->hash == h && e->len == len && e->x == x && e->y == y && e->clr == clr &&
+	    e->scale == ui_scale && memcmp(e->text, text, len) == 0) {
+		memcpy(ui_reserve(e->nverts), e->verts, e->nverts * sizeof(uivert_t));
+		ui_count += (GLsizei)e->nverts;
+		return;
 	}
 
-	d = (float)UI_CHAR_W / (float)ui_font.w;
-	v = (float)UI_CHAR_H / (float)ui_font.h;
-
-	vec2_t rpos = { x, y };
-	for (size_t i = 0; i < len; ++i) {
-		if (buf[i] == '\n') {
-			rpos.x = x;
-			rpos.y -= scale;
-			continue;
-		} else if (buf[i] == ' ') {
-			rpos.x += scale;
-			continue;
-		}
-		vec2_t tc = { (buf[i] - ' ') * d, 0.f };
-		vec2_t p1 = { rpos.x, rpos.y };
-		vec2_t p2 = { rpos.x + scale, rpos.y + scale };
-		vec2_t t1 = { tc.x, 0.f };
-		vec2_t t2 = { tc.x + d, v };
-		uivert_t quad[6];
-		quad[0].pos = p1,                           quad[0].tc.x = t1.x, quad[0].tc.y = t2.y, quad[0].clr = clr;
-		quad[1].pos = p2,                           quad[1].tc.x = t2.x, quad[1].tc.y = t1.y, quad[1].clr = clr;
-		quad[2].pos.x = p1.x, quad[2].pos.y = p2.y, quad[2].tc = t1,                          quad[2].clr = clr;
-		quad[3].pos = p2,                           quad[3].tc.x = t2.x, quad[3].tc.y = t1.y, quad[3].clr = clr;
-		quad[4].pos = p1,                           quad[4].tc.x = t1.x, quad[4].tc.y = t2.y, quad[4].clr = clr;
-		quad[5].pos.x = p2.x, quad[5].pos.y = p1.y, quad[5].tc = t2,                          quad[5].clr = clr;
-
-		memcpy(ptr, quad, sizeof(quad));
-		ptr += 6;
-		ui_count += 6;
-		rpos.x += scale;
+	uivert_t* ptr = ui_reserve(len*4);
+	size_t n = ui_text_tessellate(ptr, x, y, clr, text, len);
+	ui_count += (GLsizei)n;
+	if (len > UI_TEXT_CACHE_MAXLEN)
+		return;
+	if (len > e->capacity) {
+		e->capacity = ML_MAX(len, 64);
+		e->text = mem_realloc(MEM_UI, e->text, e->capacity);
+		e->verts = mem_realloc(MEM_UI, e->verts, e->capacity * 4 * sizeof(uivert_t));
 	}
+	e->hash = h;
+	e->x = x;
+	e->y = y;
+	e->scale = ui_scale;
+	e->clr = clr;
+	e->len = len;
+	memcpy(e->text, text, len);
+	memcpy(e->verts, ptr, n * sizeof(uivert_t));
+	e->nverts = n;
 }
 
 void ui_rect(float x, float y, float w, float h, uint32_t clr)
@@ -264,29 +669,24 @@ void ui_rect(float x, float y, float w, float h, uint32_t clr)
 	float tl = 0.5f / (float)ui_font.w;
 	float br = 7.5f / (float)ui_font.w;
 	float v = 2.f / (float)ui_font.h;
-	if (ui_count + 6 > MAX_UI_VERTICES)
-		return;
-	uivert_t quad[6] = {
+	uivert_t quad[4] = {
 		{ { x, y }, { tl, v }, clr },
 		{ { x + w, y }, { br, v }, clr },
 		{ { x, y + h }, { tl, 0 }, clr },
-		{ { x, y + h }, { tl, 0 }, clr },
-		{ { x + w, y }, { br, v }, clr },
 		{ { x + w, y + h }, { br, 0 }, clr },
 	};
-	memcpy(ui_vertices + ui_count, quad, sizeof(quad));
-	ui_count += 6;
+	memcpy(ui_reserve(4), quad, sizeof(quad));
+	ui_count += 4;
 }
 
 
 void ui_debug_line(vec3_t p1, vec3_t p2, uint32_t clr)
 {
-	if (debug_linevertcount + 2 > MAX_DEBUG_LINEVERTS)
-		return;
-	debug_lines[debug_linevertcount + 0].pos = p1;
-	debug_lines[debug_linevertcount + 0].clr = clr;
-	debug_lines[debug_linevertcount + 1].pos = p2;
-	debug_lines[debug_linevertcount + 1].clr = clr;
+	posclrvert_t* line = debug_reserve(2);
+	line[0].pos = p1;
+	line[0].clr = clr;
+	line[1].pos = p2;
+	line[1].clr = clr;
 	debug_linevertcount += 2;
 
 	//printf("(%.1f, %.1f, %.1f) - (%.1f, %.1f, %.1f)\n",
@@ -295,46 +695,18 @@ void ui_debug_line(vec3_t p1, vec3_t p2, uint32_t clr)
 
 void ui_debug_aabb(vec3_t center, vec3_t extent, uint32_t clr)
 {
-	vec3_t maxp = m_vec3add(center, extent);
-	vec3_t minp = m_vec3sub(center, extent);
-	vec3_t corners[8] = {
-		{ minp.x, minp.y, minp.z },
-		{ maxp.x, minp.y, minp.z },
-		{ maxp.x, minp.y, maxp.z },
-		{ minp.x, minp.y, maxp.z },
-
-		{ minp.x, maxp.y, minp.z },
-		{ maxp.x, maxp.y, minp.z },
-		{ maxp.x, maxp.y, maxp.z },
-		{ minp.x, maxp.y, maxp.z },
-	};
-	ui_debug_line(corners[0], corners[1], clr);
-	ui_debug_line(corners[1], corners[2], clr);
-	ui_debug_line(corners[2], corners[3], clr);
-	ui_debug_line(corners[3], corners[0], clr);
-
-	ui_debug_line(corners[4], corners[5], clr);
-	ui_debug_line(corners[5], corners[6], clr);
-	ui_debug_line(corners[6], corners[7], clr);
-	ui_debug_line(corners[7], corners[4], clr);
-
-	ui_debug_line(corners[0], corners[4], clr);
-	ui_debug_line(corners[1], corners[5], clr);
-	ui_debug_line(corners[2], corners[6], clr);
-	ui_debug_line(corners[3], corners[7], clr);
+	struct debug_instance* box = debug_list_reserve(&debug_boxes, 1);
+	box->center = center;
+	box->extent = extent;
+	box->clr = clr;
+	debug_boxes.count++;
 }
 
 void ui_debug_block(ivec3_t block, uint32_t clr)
 {
-	vec3_t pos;
 	vec3_t ext;
-	chunkpos_t camera = player_chunk();
-	m_setvec3(pos,
-	             block.x - camera.x*CHUNK_SIZE,
-	             block.y,
-	             block.z - camera.z*CHUNK_SIZE);
 	m_setvec3(ext, 0.5f, 0.5f, 0.5f);
-	ui_debug_aabb(pos, ext, clr);
+	ui_debug_aabb(render_block(block), ext, clr);
 }
 
 
@@ -355,55 +727,87 @@ void ui_debug_point(vec3_t p, uint32_t clr)
 
 void ui_debug_sphere(vec3_t p, float r, uint32_t clr)
 {
-	#define SPHERE_NDIV 7
-
-	ui_debug_point(p, clr);
-
-	for (int i = 0; i < SPHERE_NDIV; ++i) {
-		float st = sin(((float)i / SPHERE_NDIV) * ML_TWO_PI);
-		float ct = cos(((float)i / SPHERE_NDIV) * ML_TWO_PI);
-		int i2 = i + 1;
-		if (i2 == SPHERE_NDIV)
-			i2 = 0;
-		float st1 = sin(((float)i2 / SPHERE_NDIV) * ML_TWO_PI);
-		float ct1 = cos(((float)i2 / SPHERE_NDIV) * ML_TWO_PI);
-		vec3_t p1 = { p.x + r * st, p.y, p.z + r * ct };
-		vec3_t p2 = { p.x + r * st1, p.y, p.z + r * ct1 };
-		vec3_t p3 = { p.x + r * st, p.y + r * ct, p.z };
-		vec3_t p4 = { p.x + r * st1, p.y + r * ct1, p.z };
-		ui_debug_line(p1, p2, clr);
-		ui_debug_line(p3, p4, clr);
-	}
+	struct debug_instance* sphere = debug_list_reserve(&debug_spheres, 1);
+	sphere->center = p;
+	m_setvec3(sphere->extent, r, r, r);
+	sphere->clr = clr;
+	debug_spheres.count++;
+}
+
+// byte offset of the instances in the stream
+static
+void debug_inst_draw(size_t offset, GLint first, GLsizei count, size_t ninstances)
+{
+	glBindVertexArray(debug_inst_vao);
+	glBindBuffer(GL_ARRAY_BUFFER, debug_inst_stream.vbo);
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(struct debug_instance), (void*)offset);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(struct debug_instance), (void*)(offset + sizeof(vec3_t)));
+	glVertexAttribPointer(3, GL_BGRA, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct debug_instance), (void*)(offset + 2 * sizeof(vec3_t)));
+	glDrawArraysInstanced(GL_LINES, first, count, (GLsizei)ninstances);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static
+void debug_draw_instances(mtxstack_t* projection, mtxstack_t* modelview)
+{
+	debug_list_reserve(&debug_boxes, 0);
+	debug_list_reserve(&debug_spheres, 0);
+	size_t nboxes = debug_boxes.count;
+	size_t nspheres = debug_spheres.count;
+	if (nboxes + nspheres == 0)
+		return;
+
+	// both lists go into one region, boxes first
+	size_t bytes = (nboxes + nspheres) * sizeof(struct debug_instance);
+	struct debug_instance* all = arena_alloc(&arena_frame, bytes);
+	memcpy(all, debug_boxes.items, nboxes * sizeof(struct debug_instance));
+	memcpy(all + nboxes, debug_spheres.items, nspheres * sizeof(struct debug_instance));
+	ui_stream_reserve(&debug_inst_stream, bytes);
+	size_t base = (size_t)ui_stream_push(&debug_inst_stream, all, bytes) * sizeof(struct debug_instance);
+
+	glUseProgram(debug_inst_material->program);
+	m_uniform_mat44(debug_inst_projmat_index, m_getmatrix(projection));
+	m_uniform_mat44(debug_inst_modelview_index, m_getmatrix(modelview));
+	if (nboxes > 0)
+		debug_inst_draw(base, 0, DEBUG_BOX_VERTS, nboxes);
+	if (nspheres > 0)
+		debug_inst_draw(base + nboxes * sizeof(struct debug_instance),
+		                DEBUG_BOX_VERTS, DEBUG_SPHERE_VERTS, nspheres);
+	ui_stream_fence(&debug_inst_stream);
+	debug_boxes.count = debug_spheres.count = 0;
 }
 
 void ui_draw_debug(mtxstack_t* projection, mtxstack_t* modelview)
 {
+	glEnable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LEQUAL);
+	glDepthMask(GL_FALSE);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	debug_reserve(0);
 	if (debug_linevertcount > 0) {
-		glEnable(GL_BLEND);
-		glEnable(GL_DEPTH_TEST);
-		glDepthFunc(GL_LEQUAL);
-		glDepthMask(GL_FALSE);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		glUseProgram(debug_material->program);
 		m_uniform_mat44(debug_projmat_index, m_getmatrix(projection));
 		m_uniform_mat44(debug_modelview_index, m_getmatrix(modelview));
+		size_t bytes = sizeof(posclrvert_t)*debug_linevertcount;
+		if (ui_stream_reserve(&debug_stream, bytes))
+			debug_bind_vao();
+		GLint base = ui_stream_push(&debug_stream, debug_lines, bytes);
 		glBindVertexArray(debug_vao);
-		glBindBuffer(GL_ARRAY_BUFFER, debug_vbo);
-		if (debug_linevertcount > debug_maxcount) {
-			glBufferData(GL_ARRAY_BUFFER, sizeof(posclrvert_t)*debug_linevertcount, debug_lines, GL_DYNAMIC_DRAW);
-			debug_maxcount = debug_linevertcount;
-		} else {
-			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(posclrvert_t)*debug_linevertcount, debug_lines);
-		}
-		glDrawArrays(GL_LINES, 0, debug_linevertcount);
+		glDrawArrays(GL_LINES, base, (GLsizei)debug_linevertcount);
 		glBindVertexArray(0);
-		glUseProgram(0);
-		glDisable(GL_BLEND);
-		glEnable(GL_DEPTH_TEST);
-		glDepthFunc(GL_LESS);
-		glDepthMask(GL_TRUE);
+		ui_stream_fence(&debug_stream);
 		debug_linevertcount = 0;
 	}
+	debug_draw_instances(projection, modelview);
+
+	glUseProgram(0);
+	glDisable(GL_BLEND);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
 }
 
 void ui_console_toggle(bool enable)
@@ -2,7 +2,7 @@
 #include "common.h"
 #include "math3d.h"
 
-void ui_init(material_t* ui, material_t* debug);
+void ui_init(material_t* ui, material_t* debug, material_t* debug_instanced);
 void ui_exit(void);
 void ui_tick(float dt);
 void ui_draw(SDL_Point* viewport);
@@ -12,6 +12,8 @@ void ui_text_measure(int* w, int* h, const char* str, ...);
 void ui_text(float x, float y, uint32_t clr, const char* str, ...);
 void ui_rect(float x, float y, float w, float h, uint32_t clr);
 
+// lines are expanded on the CPU, boxes and spheres are one instance
+// each and drawn in a single call per shape
 void ui_debug_line(vec3_t p1, vec3_t p2, uint32_t clr);
 void ui_debug_aabb(vec3_t center, vec3_t extent, uint32_t clr);
 void ui_debug_block(ivec3_t block, uint32_t clr);